@@ -9,27 +9,57 @@ CONFIG += c++11
 # In order to do so, uncomment the following line.
 DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+# The Raspberry Pi 3 (ARMv8) has NEON even with a 32 bit OS: let the blend kernels use it
+# (they check at run time that the CPU has it)
+equals(QT_ARCH, "arm"): QMAKE_CXXFLAGS += -march=armv8-a -mfpu=neon-fp-armv8
+
 SOURCES += \
+    blendkernels.cpp \
+    contentsync.cpp \
+    deltapatcher.cpp \
     fileupdater.cpp \
+    framepool.cpp \
     main.cpp \
+    mediacache.cpp \
     messagewindow.cpp \
+    multicastreceiver.cpp \
+    netlinkwatcher.cpp \
+    panelsimulator.cpp \
+    peerserver.cpp \
+    rawchannel.cpp \
     scorepanel.cpp \
     serverdiscoverer.cpp \
+    slidedecoder.cpp \
     slidewindow.cpp \
     timeoutwindow.cpp \
+    transferscheduler.cpp \
+    transitionrenderer.cpp \
     utility.cpp \
     volleyapplication.cpp \
     volleypanel.cpp
 
 
 HEADERS += \
+    blendkernels.h \
+    contentsync.h \
+    deltapatcher.h \
     fileupdater.h \
+    framepool.h \
+    mediacache.h \
     messagewindow.h \
+    multicastreceiver.h \
+    netlinkwatcher.h \
     panelorientation.h \
+    panelsimulator.h \
+    peerserver.h \
+    rawchannel.h \
     scorepanel.h \
     serverdiscoverer.h \
+    slidedecoder.h \
     slidewindow.h \
     timeoutwindow.h \
+    transferscheduler.h \
+    transitionrenderer.h \
     utility.h \
     volleyapplication.h \
     volleypanel.h
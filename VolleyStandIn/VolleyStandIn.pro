@@ -0,0 +1,32 @@
+QT += core
+QT += network
+QT += websockets
+QT -= gui
+
+CONFIG += c++11
+CONFIG += console
+CONFIG -= app_bundle
+
+# You can make your code fail to compile if it uses deprecated APIs.
+# In order to do so, uncomment the following line.
+DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    ../utility.cpp \
+    main.cpp \
+    standincontroller.cpp \
+    standinfileserver.cpp
+
+
+HEADERS += \
+    ../utility.h \
+    standincontroller.h \
+    standinfileserver.h
+
+
+# Default rules for deployment.
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
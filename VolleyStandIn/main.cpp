@@ -0,0 +1,109 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QTextStream>
+
+#include "standincontroller.h"
+
+
+int
+main(int argc, char *argv[]) {
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationVersion(QString("0.1"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QString("A headless stand-in for the Volley Controller"));
+    parser.addHelpOption();
+    parser.addVersionOption();
+    QCommandLineOption spotOption(QString("spots"),
+                                  QString("The directory with the Spots to serve."),
+                                  QString("dir"));
+    QCommandLineOption slideOption(QString("slides"),
+                                   QString("The directory with the Slides to serve."),
+                                   QString("dir"));
+    QCommandLineOption scenarioOption(QString("scenario"),
+                                      QString("The scenario to play."),
+                                      QString("file"));
+    QCommandLineOption addressOption(QString("address"),
+                                     QString("Announce only this address (e.g. 127.0.0.1)."),
+                                     QString("ip"));
+    QCommandLineOption panelTypeOption(QString("panel-type"),
+                                       QString("The Panel Type to announce."),
+                                       QString("type"), QString("0"));
+    QCommandLineOption beaconOption(QString("beacon"),
+                                    QString("Periodically announce the Server."));
+    QCommandLineOption rateOption(QString("rate"),
+                                  QString("Limit the File Servers to this rate (bytes/s)."),
+                                  QString("bytes"), QString("0"));
+    QCommandLineOption logOption(QString("log"),
+                                 QString("Log on this file instead of the console."),
+                                 QString("file"));
+    parser.addOption(spotOption);
+    parser.addOption(slideOption);
+    parser.addOption(scenarioOption);
+    parser.addOption(addressOption);
+    parser.addOption(panelTypeOption);
+    parser.addOption(beaconOption);
+    parser.addOption(rateOption);
+    parser.addOption(logOption);
+    parser.process(a);
+
+    QTextStream err(stderr);
+    QFile *logFile = Q_NULLPTR;
+    if(parser.isSet(logOption)) {
+        logFile = new QFile(parser.value(logOption));
+        if(!logFile->open(QIODevice::WriteOnly)) {
+            err << QString("Unable to open %1: %2\n")
+                   .arg(logFile->fileName())
+                   .arg(logFile->errorString());
+            delete logFile;
+            logFile = Q_NULLPTR;
+        }
+    }
+
+    StandInController controller(parser.value(spotOption),
+                                 parser.value(slideOption),
+                                 logFile);
+    controller.setAddress(parser.value(addressOption));
+    controller.setPanelType(parser.value(panelTypeOption).toInt());
+    controller.setRate(parser.value(rateOption).toLongLong());
+    if(parser.isSet(scenarioOption) &&
+       !controller.loadScenario(parser.value(scenarioOption)))
+    {
+        err << QString("Unable to read the scenario %1\n").arg(parser.value(scenarioOption));
+        return 1;
+    }
+    if(!controller.start()) {
+        err << QString("Unable to start: are the Controller ports already in use ?\n");
+        return 1;
+    }
+    controller.setBeacon(parser.isSet(beaconOption));
+    QObject::connect(&controller, SIGNAL(finished()),
+                     &a, SLOT(quit()), Qt::QueuedConnection);
+
+    int iResult = a.exec();
+    controller.stop();
+    if(logFile) {
+        logFile->close();
+        delete logFile;
+    }
+    return iResult;
+}
@@ -0,0 +1,564 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#include <QUdpSocket>
+#include <QWebSocketServer>
+#include <QWebSocket>
+#include <QNetworkInterface>
+#include <QRandomGenerator>
+#include <QFile>
+#include <QTextStream>
+#include <QDateTime>
+
+#include "standincontroller.h"
+#include "standinfileserver.h"
+#include "utility.h"
+
+
+#define DISCOVERY_PORT 45453
+#define SERVER_PORT    45454
+#define SPOT_PORT      45455
+#define SLIDE_PORT     45456
+
+#define DISCOVERY_ADDRESS "224.0.0.1"
+#define BEACON_TIME    2000 // In msec
+
+
+/*!
+ * \brief StandInController::StandInController A headless stand-in for the VolleyController
+ * \param sSpotDir The directory with the Spots to serve
+ * \param sSlideDir The directory with the Slides to serve
+ * \param myLogFile The File for logging (if any).
+ * \param parent The parent object.
+ *
+ * Answers the Panel discovery, serves the Panel control socket and the
+ * Spot and Slide File Servers, so that the Panel can be exercised (and
+ * benchmarked) on a single machine through the loopback interface.
+ * A scenario file scripts what happens: every line is
+ * "<wait in ms> <command> [arguments]" (see executeCommand()).
+ */
+StandInController::StandInController(QString sSpotDir, QString sSlideDir,
+                                     QFile *myLogFile, QObject *parent)
+    : QObject(parent)
+    , logFile(myLogFile)
+    , pDiscoverySocket(Q_NULLPTR)
+    , pPanelServer(Q_NULLPTR)
+    , panelType(0)
+    , servizio(0)
+    , iScenarioLine(0)
+    , burstLeft(0)
+    , burstInterval(0)
+{
+    pSpotServer  = new StandInFileServer(QString("Spots"),  sSpotDir,  SPOT_PORT,  logFile, this);
+    pSlideServer = new StandInFileServer(QString("Slides"), sSlideDir, SLIDE_PORT, logFile, this);
+    for(int i=0; i<2; i++) {
+        team[i]    = QString("Team %1").arg(i+1);
+        score[i]   = 0;
+        set[i]     = 0;
+        timeout[i] = 0;
+    }
+    connect(&beaconTimer, SIGNAL(timeout()),
+            this, SLOT(onTimeToSendBeacon()));
+    scenarioTimer.setSingleShot(true);
+    connect(&scenarioTimer, SIGNAL(timeout()),
+            this, SLOT(onTimeToRunScenario()));
+    restartTimer.setSingleShot(true);
+    connect(&restartTimer, SIGNAL(timeout()),
+            this, SLOT(onTimeToRestart()));
+}
+
+
+/*!
+ * \brief StandInController::setAddress Announce only this address
+ * (e.g. 127.0.0.1 to test on a single machine)
+ */
+void
+StandInController::setAddress(QString sAddress) {
+    sServerAddress = sAddress;
+}
+
+
+/*!
+ * \brief StandInController::setPanelType The Panel Type announced
+ */
+void
+StandInController::setPanelType(int iPanelType) {
+    panelType = iPanelType;
+}
+
+
+/*!
+ * \brief StandInController::setBeacon Periodically announce the Server
+ */
+void
+StandInController::setBeacon(bool bEnable) {
+    if(bEnable)
+        beaconTimer.start(BEACON_TIME);
+    else
+        beaconTimer.stop();
+}
+
+
+/*!
+ * \brief StandInController::setRate Limit the File Servers rate (0 = unlimited)
+ */
+void
+StandInController::setRate(qint64 bytesPerSecond) {
+    pSpotServer->setRate(bytesPerSecond);
+    pSlideServer->setRate(bytesPerSecond);
+}
+
+
+/*!
+ * \brief StandInController::start Open all the Server sockets
+ * \return false if some port is not available
+ */
+bool
+StandInController::start() {
+    pDiscoverySocket = new QUdpSocket(this);
+    if(!pDiscoverySocket->bind(QHostAddress::AnyIPv4, DISCOVERY_PORT,
+                               QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint))
+    {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Unable to bind the Discovery Socket"));
+        return false;
+    }
+    pDiscoverySocket->joinMulticastGroup(QHostAddress(DISCOVERY_ADDRESS));
+    connect(pDiscoverySocket, SIGNAL(readyRead()),
+            this, SLOT(onProcessDiscoveryPendingDatagrams()));
+
+    pPanelServer = new QWebSocketServer(QString("Panel Server"),
+                                        QWebSocketServer::NonSecureMode,
+                                        this);
+    if(!pPanelServer->listen(QHostAddress::Any, SERVER_PORT)) {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Unable to listen on port %1").arg(SERVER_PORT));
+        return false;
+    }
+    connect(pPanelServer, SIGNAL(newConnection()),
+            this, SLOT(onNewPanelConnection()));
+    if(!pSpotServer->start() || !pSlideServer->start())
+        return false;
+    if(!scenario.isEmpty() && !scenarioTimer.isActive() && iScenarioLine == 0)
+        scenarioTimer.start(qMax(0, scenario.at(0).section(QChar(' '), 0, 0).toInt()));
+    return true;
+}
+
+
+/*!
+ * \brief StandInController::stop Close all the Server sockets
+ */
+void
+StandInController::stop() {
+    dropPanels();
+    if(pPanelServer) {
+        pPanelServer->close();
+        pPanelServer->deleteLater();
+    }
+    pPanelServer = Q_NULLPTR;
+    if(pDiscoverySocket) {
+        pDiscoverySocket->disconnect(this);
+        pDiscoverySocket->abort();
+        pDiscoverySocket->deleteLater();
+    }
+    pDiscoverySocket = Q_NULLPTR;
+    pSpotServer->stop();
+    pSlideServer->stop();
+}
+
+
+/*!
+ * \brief StandInController::loadScenario
+ * \param sFileName The scenario file
+ * \return false if the file can't be read
+ */
+bool
+StandInController::loadScenario(QString sFileName) {
+    QFile file(sFileName);
+    if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+    QTextStream stream(&file);
+    scenario.clear();
+    while(!stream.atEnd()) {
+        QString sLine = stream.readLine().trimmed();
+        if(sLine.isEmpty() || sLine.startsWith(QChar('#')))
+            continue;
+        scenario.append(sLine);
+    }
+    file.close();
+    iScenarioLine = 0;
+    return true;
+}
+
+
+/*!
+ * \brief StandInController::serverAnswer
+ * \return The <serverIP> message with our addresses
+ */
+QString
+StandInController::serverAnswer() {
+    QStringList addresses;
+    if(!sServerAddress.isEmpty())
+        addresses.append(QString("%1,%2").arg(sServerAddress).arg(panelType));
+    else {
+        QList<QHostAddress> hostAddresses = QNetworkInterface::allAddresses();
+        for(int i=0; i<hostAddresses.count(); i++) {
+            if(hostAddresses.at(i).protocol() == QAbstractSocket::IPv4Protocol &&
+               !hostAddresses.at(i).isLoopback())
+                addresses.append(QString("%1,%2").arg(hostAddresses.at(i).toString()).arg(panelType));
+        }
+        if(addresses.isEmpty())
+            addresses.append(QString("127.0.0.1,%1").arg(panelType));
+    }
+    return QString("<serverIP>%1</serverIP>").arg(addresses.join(";"));
+}
+
+
+/*!
+ * \brief StandInController::onProcessDiscoveryPendingDatagrams
+ * Answer the <getServer> requests of the Panels
+ */
+void
+StandInController::onProcessDiscoveryPendingDatagrams() {
+    while(pDiscoverySocket->hasPendingDatagrams()) {
+        QByteArray datagram;
+        datagram.resize(int(pDiscoverySocket->pendingDatagramSize()));
+        QHostAddress senderAddress;
+        quint16 senderPort;
+        if(pDiscoverySocket->readDatagram(datagram.data(), datagram.size(),
+                                          &senderAddress, &senderPort) < 0)
+            continue;
+        QString sToken = XML_Parse(QString::fromUtf8(datagram), "getServer");
+        if(sToken == QString("NoData"))
+            continue;// Our own beacons
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Discovery request from %1 (%2)")
+                   .arg(sToken)
+                   .arg(senderAddress.toString()));
+        QByteArray answer = serverAnswer().toUtf8();
+        pDiscoverySocket->writeDatagram(answer, senderAddress, senderPort);
+    }
+}
+
+
+/*!
+ * \brief StandInController::onTimeToSendBeacon
+ */
+void
+StandInController::onTimeToSendBeacon() {
+    if(!pDiscoverySocket)
+        return;
+    QByteArray beacon = serverAnswer().toUtf8();
+    pDiscoverySocket->writeDatagram(beacon, QHostAddress(DISCOVERY_ADDRESS), DISCOVERY_PORT);
+}
+
+
+/*!
+ * \brief StandInController::onNewPanelConnection
+ */
+void
+StandInController::onNewPanelConnection() {
+    panel newPanel;
+    newPanel.pSocket  = pPanelServer->nextPendingConnection();
+    newPanel.sequence = 0;
+    connect(newPanel.pSocket, SIGNAL(textMessageReceived(QString)),
+            this, SLOT(onProcessPanelMessage(QString)));
+    connect(newPanel.pSocket, SIGNAL(disconnected()),
+            this, SLOT(onPanelDisconnected()));
+    panels.append(newPanel);
+    if(downClock.isValid()) {// How long did the Panel need to come back ?
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Panel %1 reconnected after %2 ms")
+                   .arg(newPanel.pSocket->peerAddress().toString())
+                   .arg(downClock.elapsed()));
+        downClock.invalidate();
+    }
+    else {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Panel %1 connected")
+                   .arg(newPanel.pSocket->peerAddress().toString()));
+    }
+}
+
+
+/*!
+ * \brief StandInController::onPanelDisconnected
+ */
+void
+StandInController::onPanelDisconnected() {
+    QWebSocket *pSocket = qobject_cast<QWebSocket *>(sender());
+    for(int i=0; i<panels.count(); i++) {
+        if(panels.at(i).pSocket == pSocket) {
+            panels.removeAt(i);
+            break;
+        }
+    }
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               QString("Panel %1 disconnected")
+               .arg(pSocket->peerAddress().toString()));
+    pSocket->deleteLater();
+}
+
+
+/*!
+ * \brief StandInController::onProcessPanelMessage
+ * \param sMessage A message from a Panel
+ */
+void
+StandInController::onProcessPanelMessage(QString sMessage) {
+    QWebSocket *pSocket = qobject_cast<QWebSocket *>(sender());
+    if(XML_Parse(sMessage, "getStatus") != QString("NoData")) {
+        for(int i=0; i<panels.count(); i++) {
+            if(panels.at(i).pSocket == pSocket) {
+                pSocket->sendTextMessage(statusMessage() +
+                                         QString("<seq>%1</seq><ts>%2</ts>")
+                                         .arg(panels[i].sequence++)
+                                         .arg(QDateTime::currentMSecsSinceEpoch()));
+                break;
+            }
+        }
+        return;
+    }
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               QString("%1: %2")
+               .arg(pSocket->peerAddress().toString())
+               .arg(sMessage));
+}
+
+
+/*!
+ * \brief StandInController::statusMessage
+ * \return The whole game status
+ */
+QString
+StandInController::statusMessage() {
+    QString sMessage;
+    for(int i=0; i<2; i++) {
+        sMessage += QString("<team%1>%2</team%1>").arg(i).arg(team[i]);
+        sMessage += QString("<set%1>%2</set%1>").arg(i).arg(set[i]);
+        sMessage += QString("<timeout%1>%2</timeout%1>").arg(i).arg(timeout[i]);
+        sMessage += QString("<score%1>%2</score%1>").arg(i).arg(score[i]);
+    }
+    sMessage += QString("<servizio>%1</servizio>").arg(servizio);
+    return sMessage;
+}
+
+
+/*!
+ * \brief StandInController::sendToPanels Send a message to all the Panels
+ * (each message carries the Panel sequence number and the time it was
+ * sent, so that the Panels can measure their update latency)
+ */
+void
+StandInController::sendToPanels(QString sMessage) {
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for(int i=0; i<panels.count(); i++) {
+        panels.at(i).pSocket->sendTextMessage(sMessage +
+                                              QString("<seq>%1</seq><ts>%2</ts>")
+                                              .arg(panels[i].sequence++)
+                                              .arg(now));
+    }
+}
+
+
+/*!
+ * \brief StandInController::dropPanels Abort all the Panel connections
+ */
+void
+StandInController::dropPanels() {
+    for(int i=0; i<panels.count(); i++) {
+        panels.at(i).pSocket->disconnect(this);
+        panels.at(i).pSocket->abort();
+        panels.at(i).pSocket->deleteLater();
+    }
+    panels.clear();
+    pSpotServer->closeConnections();
+    pSlideServer->closeConnections();
+}
+
+
+/*!
+ * \brief StandInController::scorePoint A team scored
+ */
+void
+StandInController::scorePoint(int iTeam) {
+    score[iTeam]++;
+    servizio = iTeam;
+    if(score[iTeam] >= 25 && score[iTeam]-score[1-iTeam] >= 2) {// Set won
+        set[iTeam]++;
+        for(int i=0; i<2; i++) {
+            score[i]   = 0;
+            timeout[i] = 0;
+        }
+        sendToPanels(statusMessage());
+        return;
+    }
+    sendToPanels(QString("<score%1>%2</score%1><servizio>%3</servizio>")
+                 .arg(iTeam)
+                 .arg(score[iTeam])
+                 .arg(servizio));
+}
+
+
+/*!
+ * \brief StandInController::onTimeToRunScenario
+ * Execute the next scenario step and schedule the following one
+ */
+void
+StandInController::onTimeToRunScenario() {
+    if(burstLeft > 0) {
+        scorePoint(QRandomGenerator::global()->bounded(2));
+        burstLeft--;
+    }
+    else if(iScenarioLine < scenario.count()) {
+        QString sLine = scenario.at(iScenarioLine);
+        iScenarioLine++;
+        executeCommand(sLine.section(QChar(' '), 1).trimmed());
+    }
+    // Schedule the next step
+    if(burstLeft > 0)
+        scenarioTimer.start(burstInterval);
+    else if(iScenarioLine < scenario.count())
+        scenarioTimer.start(qMax(0, scenario.at(iScenarioLine).section(QChar(' '), 0, 0).toInt()));
+}
+
+
+/*!
+ * \brief StandInController::executeCommand Execute a scenario command
+ * \param sLine The command and its arguments:
+ * - team <0|1> <name>, score <0|1> <n>, set <0|1> <n>, timeout <0|1> <n>,
+ *   servizio <-1|0|1>, point <0|1>
+ * - burst <points> <interval ms>: random points in a quick sequence
+ * - newgame: clear scores, sets and timeouts
+ * - starttimeout <s>, stoptimeout
+ * - spotloop, endspotloop, slideshow, endslideshow, live, endlive
+ * - disconnect: abort all the connections
+ * - restart <ms>: close all the Server sockets for a while
+ * - rate <bytes/s>: limit the File Servers (0 = unlimited)
+ * - skipseq: skip a sequence number (a lost message)
+ * - loop: restart the scenario, quit: stop the stand-in
+ */
+void
+StandInController::executeCommand(QString sLine) {
+    QStringList arguments = sLine.split(QChar(' '), Qt::SkipEmptyParts);
+    if(arguments.isEmpty())
+        return;
+    QString sCommand = arguments.takeFirst().toLower();
+    int iTeam = arguments.isEmpty() ? 0 : qBound(0, arguments.at(0).toInt(), 1);
+    int iValue = arguments.count() > 1 ? arguments.at(1).toInt() : 0;
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               sLine);
+
+    if(sCommand == QString("team") && arguments.count() > 1) {
+        team[iTeam] = arguments.mid(1).join(QChar(' '));
+        sendToPanels(QString("<team%1>%2</team%1>").arg(iTeam).arg(team[iTeam]));
+    }
+    else if(sCommand == QString("score")) {
+        score[iTeam] = iValue;
+        sendToPanels(QString("<score%1>%2</score%1>").arg(iTeam).arg(iValue));
+    }
+    else if(sCommand == QString("set")) {
+        set[iTeam] = iValue;
+        sendToPanels(QString("<set%1>%2</set%1>").arg(iTeam).arg(iValue));
+    }
+    else if(sCommand == QString("timeout")) {
+        timeout[iTeam] = iValue;
+        sendToPanels(QString("<timeout%1>%2</timeout%1>").arg(iTeam).arg(iValue));
+    }
+    else if(sCommand == QString("servizio")) {
+        servizio = arguments.isEmpty() ? 0 : qBound(-1, arguments.at(0).toInt(), 1);
+        sendToPanels(QString("<servizio>%1</servizio>").arg(servizio));
+    }
+    else if(sCommand == QString("point")) {
+        scorePoint(iTeam);
+    }
+    else if(sCommand == QString("burst")) {
+        burstLeft     = arguments.isEmpty() ? 0 : arguments.at(0).toInt();
+        burstInterval = qMax(0, iValue);
+    }
+    else if(sCommand == QString("newgame")) {
+        for(int i=0; i<2; i++) {
+            score[i]   = 0;
+            set[i]     = 0;
+            timeout[i] = 0;
+        }
+        servizio = 0;
+        sendToPanels(statusMessage());
+    }
+    else if(sCommand == QString("starttimeout")) {
+        int seconds = arguments.isEmpty() ? 30 : arguments.at(0).toInt();
+        sendToPanels(QString("<startTimeout>%1</startTimeout>").arg(seconds));
+    }
+    else if(sCommand == QString("stoptimeout")) {
+        sendToPanels(QString("<stopTimeout>1</stopTimeout>"));
+    }
+    else if(sCommand == QString("spotloop")     || sCommand == QString("endspotloop") ||
+            sCommand == QString("slideshow")    || sCommand == QString("endslideshow") ||
+            sCommand == QString("live")         || sCommand == QString("endlive"))
+    {
+        sendToPanels(QString("<%1>1</%1>").arg(sCommand));
+    }
+    else if(sCommand == QString("disconnect")) {
+        dropPanels();
+        downClock.start();
+    }
+    else if(sCommand == QString("restart")) {
+        stop();
+        downClock.start();
+        restartTimer.start(arguments.isEmpty() ? 0 : arguments.at(0).toInt());
+    }
+    else if(sCommand == QString("rate")) {
+        setRate(arguments.isEmpty() ? 0 : arguments.at(0).toLongLong());
+    }
+    else if(sCommand == QString("skipseq")) {
+        for(int i=0; i<panels.count(); i++)
+            panels[i].sequence++;
+    }
+    else if(sCommand == QString("loop")) {
+        iScenarioLine = 0;
+    }
+    else if(sCommand == QString("quit")) {
+        iScenarioLine = scenario.count();
+        emit finished();
+    }
+    else {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Unknown command: %1").arg(sCommand));
+    }
+}
+
+
+/*!
+ * \brief StandInController::onTimeToRestart The end of a simulated Controller restart
+ */
+void
+StandInController::onTimeToRestart() {
+    if(!start())
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Unable to restart"));
+}
@@ -0,0 +1,101 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#ifndef STANDINCONTROLLER_H
+#define STANDINCONTROLLER_H
+
+#include <QObject>
+#include <QList>
+#include <QStringList>
+#include <QTimer>
+#include <QElapsedTimer>
+
+QT_FORWARD_DECLARE_CLASS(QUdpSocket)
+QT_FORWARD_DECLARE_CLASS(QWebSocketServer)
+QT_FORWARD_DECLARE_CLASS(QWebSocket)
+QT_FORWARD_DECLARE_CLASS(QFile)
+QT_FORWARD_DECLARE_CLASS(StandInFileServer)
+
+
+class StandInController : public QObject
+{
+    Q_OBJECT
+public:
+    explicit StandInController(QString sSpotDir, QString sSlideDir,
+                               QFile *myLogFile = Q_NULLPTR, QObject *parent = Q_NULLPTR);
+    bool start();
+    void stop();
+    void setAddress(QString sAddress);
+    void setPanelType(int iPanelType);
+    void setBeacon(bool bEnable);
+    void setRate(qint64 bytesPerSecond);
+    bool loadScenario(QString sFileName);
+
+signals:
+    void finished();/*!< \brief emitted when the scenario executes "quit" */
+
+private slots:
+    void onProcessDiscoveryPendingDatagrams();
+    void onNewPanelConnection();
+    void onPanelDisconnected();
+    void onProcessPanelMessage(QString sMessage);
+    void onTimeToSendBeacon();
+    void onTimeToRunScenario();
+    void onTimeToRestart();
+
+private:
+    struct panel {
+        QWebSocket *pSocket;
+        int         sequence;
+    };
+    QString serverAnswer();
+    QString statusMessage();
+    void    sendToPanels(QString sMessage);
+    void    dropPanels();
+    void    executeCommand(QString sLine);
+    void    scorePoint(int iTeam);
+
+private:
+    QFile              *logFile;
+    QUdpSocket         *pDiscoverySocket;
+    QWebSocketServer   *pPanelServer;
+    StandInFileServer  *pSpotServer;
+    StandInFileServer  *pSlideServer;
+    QList<panel>        panels;
+    QString             sServerAddress;
+    int                 panelType;
+    QTimer              beaconTimer;
+    QElapsedTimer       downClock;
+
+    // The game status
+    QString             team[2];
+    int                 score[2];
+    int                 set[2];
+    int                 timeout[2];
+    int                 servizio;
+
+    // The scenario
+    QStringList         scenario;
+    int                 iScenarioLine;
+    QTimer              scenarioTimer;
+    QTimer              restartTimer;
+    int                 burstLeft;
+    int                 burstInterval;
+};
+
+#endif // STANDINCONTROLLER_H
@@ -0,0 +1,476 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#include <QWebSocketServer>
+#include <QWebSocket>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QtEndian>
+
+#include "standinfileserver.h"
+#include "utility.h"
+
+
+#define RAW_PORT_OFFSET  100 // As in the Panel FileUpdater
+#define RAW_HEADER_SIZE  16  // offset (8) and length (8), big endian
+#define HEADER_SIZE      1024
+#define MAX_CHUNK_SIZE   4*1024*1024
+#define RAW_TOKEN_SIZE   8   // As in the Panel RawChannel
+#define RAW_PAIR_WAIT    10  // ms between the checks for a raw connection not yet paired
+#define RAW_PAIR_WAITS   100 // Then the raw request is dropped
+
+
+/*!
+ * \brief StandInFileServer::StandInFileServer A chunked File Server for a media category
+ * \param sName The category name (for logging)
+ * \param sDir The directory with the files to serve
+ * \param port The WebSocket port (the raw transfers use port+RAW_PORT_OFFSET)
+ * \param myLogFile The File for logging (if any).
+ * \param parent The parent object.
+ *
+ * Implements the same protocol of the VolleyController File Servers:
+ * - <send_file_list> is answered with <file_list>name;size;md5,...</file_list>
+ * - <get>name,offset,length</get> is answered with a binary message
+ *   (with a HEADER_SIZE bytes "name,size" header when offset is 0)
+ * - <get_raw>name,offset,length</get_raw> is answered on the raw TCP
+ *   connection with a RAW_HEADER_SIZE bytes header and the data.
+ *   The raw connection is paired with the WebSocket by the token the
+ *   Panel announces with <raw_token>token</raw_token> and sends as
+ *   the first RAW_TOKEN_SIZE bytes on the raw connection.
+ * - A request for a missing file is answered with <file_error>name</file_error>
+ * - The delta requests are answered with <delta_refused>name</delta_refused>
+ * The answers are queued and can be throttled to simulate a slow link.
+ */
+StandInFileServer::StandInFileServer(QString sName, QString sDir, quint16 port,
+                                     QFile *myLogFile, QObject *parent)
+    : QObject(parent)
+    , logFile(myLogFile)
+    , sMyName(sName)
+    , sDirectory(sDir)
+    , serverPort(port)
+    , pServer(Q_NULLPTR)
+    , pRawServer(Q_NULLPTR)
+    , rate(0)
+    , bytesSent(0)
+{
+    if(!sDirectory.endsWith(QString("/"))) sDirectory += QString("/");
+    sendTimer.setSingleShot(true);
+    connect(&sendTimer, SIGNAL(timeout()),
+            this, SLOT(onTimeToSend()));
+}
+
+
+/*!
+ * \brief StandInFileServer::~StandInFileServer
+ */
+StandInFileServer::~StandInFileServer() {
+    stop();
+}
+
+
+/*!
+ * \brief StandInFileServer::start Start listening
+ * \return false if the ports are not available
+ */
+bool
+StandInFileServer::start() {
+    if(pServer)
+        return true;
+    pServer = new QWebSocketServer(sMyName, QWebSocketServer::NonSecureMode, this);
+    if(!pServer->listen(QHostAddress::Any, serverPort)) {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("%1: unable to listen on port %2")
+                   .arg(sMyName)
+                   .arg(serverPort));
+        delete pServer;
+        pServer = Q_NULLPTR;
+        return false;
+    }
+    connect(pServer, SIGNAL(newConnection()),
+            this, SLOT(onNewConnection()));
+    pRawServer = new QTcpServer(this);
+    if(pRawServer->listen(QHostAddress::Any, quint16(serverPort+RAW_PORT_OFFSET))) {
+        connect(pRawServer, SIGNAL(newConnection()),
+                this, SLOT(onNewRawConnection()));
+    }
+    else {
+        delete pRawServer;
+        pRawServer = Q_NULLPTR;
+    }
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               QString("%1: serving %2 on port %3")
+               .arg(sMyName)
+               .arg(sDirectory)
+               .arg(serverPort));
+    return true;
+}
+
+
+/*!
+ * \brief StandInFileServer::stop Close the connections and stop listening
+ */
+void
+StandInFileServer::stop() {
+    closeConnections();
+    if(pServer) {
+        pServer->close();
+        pServer->deleteLater();
+    }
+    pServer = Q_NULLPTR;
+    if(pRawServer) {
+        pRawServer->close();
+        pRawServer->deleteLater();
+    }
+    pRawServer = Q_NULLPTR;
+}
+
+
+/*!
+ * \brief StandInFileServer::closeConnections Drop all the clients
+ */
+void
+StandInFileServer::closeConnections() {
+    sendTimer.stop();
+    requests.clear();
+    for(int i=0; i<clients.count(); i++) {
+        clients.at(i)->disconnect(this);
+        clients.at(i)->abort();
+        clients.at(i)->deleteLater();
+    }
+    clients.clear();
+    clientTokens.clear();
+    for(int i=0; i<rawClients.count(); i++) {
+        rawClients.at(i)->disconnect(this);
+        rawClients.at(i)->abort();
+        rawClients.at(i)->deleteLater();
+    }
+    rawClients.clear();
+    rawTokens.clear();
+}
+
+
+/*!
+ * \brief StandInFileServer::setRate Limit the transfer rate
+ * \param bytesPerSecond The rate limit (0 = unlimited)
+ */
+void
+StandInFileServer::setRate(qint64 bytesPerSecond) {
+    rate = qMax(qint64(0), bytesPerSecond);
+    bytesSent = 0;
+    rateClock.start();
+}
+
+
+/*!
+ * \brief StandInFileServer::onNewConnection
+ */
+void
+StandInFileServer::onNewConnection() {
+    QWebSocket *pClient = pServer->nextPendingConnection();
+    connect(pClient, SIGNAL(textMessageReceived(QString)),
+            this, SLOT(onProcessTextMessage(QString)));
+    connect(pClient, SIGNAL(binaryMessageReceived(QByteArray)),
+            this, SLOT(onProcessBinaryMessage(QByteArray)));
+    connect(pClient, SIGNAL(disconnected()),
+            this, SLOT(onClientDisconnected()));
+    clients.append(pClient);
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               QString("%1: client %2 connected")
+               .arg(sMyName)
+               .arg(pClient->peerAddress().toString()));
+}
+
+
+/*!
+ * \brief StandInFileServer::onNewRawConnection
+ */
+void
+StandInFileServer::onNewRawConnection() {
+    QTcpSocket *pClient = pRawServer->nextPendingConnection();
+    connect(pClient, SIGNAL(readyRead()),
+            this, SLOT(onRawReadyRead()));
+    connect(pClient, SIGNAL(disconnected()),
+            this, SLOT(onRawClientDisconnected()));
+    rawClients.append(pClient);
+}
+
+
+/*!
+ * \brief StandInFileServer::onRawReadyRead
+ * The Panel sends only its token on the raw connection
+ */
+void
+StandInFileServer::onRawReadyRead() {
+    QTcpSocket *pClient = qobject_cast<QTcpSocket *>(sender());
+    if(rawTokens.contains(pClient)) {
+        pClient->readAll();// Nothing else is expected
+        return;
+    }
+    if(pClient->bytesAvailable() < RAW_TOKEN_SIZE)
+        return;
+    QByteArray baToken = pClient->read(RAW_TOKEN_SIZE);
+    rawTokens.insert(pClient, qFromBigEndian<quint64>(baToken.constData()));
+}
+
+
+/*!
+ * \brief StandInFileServer::onClientDisconnected
+ */
+void
+StandInFileServer::onClientDisconnected() {
+    QWebSocket *pClient = qobject_cast<QWebSocket *>(sender());
+    for(int i=requests.count()-1; i>=0; i--) {
+        if(requests.at(i).pClient == pClient)
+            requests.removeAt(i);
+    }
+    clients.removeOne(pClient);
+    clientTokens.remove(pClient);
+    pClient->deleteLater();
+}
+
+
+/*!
+ * \brief StandInFileServer::onRawClientDisconnected
+ */
+void
+StandInFileServer::onRawClientDisconnected() {
+    QTcpSocket *pClient = qobject_cast<QTcpSocket *>(sender());
+    rawClients.removeOne(pClient);
+    rawTokens.remove(pClient);
+    pClient->deleteLater();
+}
+
+
+/*!
+ * \brief StandInFileServer::onProcessTextMessage
+ * \param sMessage The request from the Panel
+ */
+void
+StandInFileServer::onProcessTextMessage(QString sMessage) {
+    QWebSocket *pClient = qobject_cast<QWebSocket *>(sender());
+    QString sToken;
+    QString sNoData = QString("NoData");
+
+    sToken = XML_Parse(sMessage, "send_file_list");
+    if(sToken != sNoData)
+        sendFileList(pClient);
+
+    sToken = XML_Parse(sMessage, "get");
+    if(sToken != sNoData)
+        enqueue(pClient, sToken, false);
+
+    sToken = XML_Parse(sMessage, "get_raw");
+    if(sToken != sNoData)
+        enqueue(pClient, sToken, true);
+
+    sToken = XML_Parse(sMessage, "raw_token");
+    if(sToken != sNoData)
+        clientTokens.insert(pClient, sToken.toULongLong());
+}
+
+
+/*!
+ * \brief StandInFileServer::onProcessBinaryMessage
+ * \param baMessage The binary request from the Panel
+ *
+ * The only binary requests are the delta ones
+ * ("delta,name,block size,blocks" header and the signature):
+ * the Stand-In has no delta encoder, so they are refused and
+ * the Panel asks the whole file.
+ */
+void
+StandInFileServer::onProcessBinaryMessage(QByteArray baMessage) {
+    QWebSocket *pClient = qobject_cast<QWebSocket *>(sender());
+    QString sHeader = QString::fromUtf8(baMessage.left(HEADER_SIZE).constData());
+    QStringList arguments = sHeader.split(",");
+    if(arguments.count() < 2 || arguments.at(0) != QString("delta")) {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("%1: unknown binary request %2")
+                   .arg(sMyName)
+                   .arg(sHeader.left(64)));
+        return;
+    }
+    pClient->sendTextMessage(QString("<delta_refused>%1</delta_refused>")
+                             .arg(arguments.at(1)));
+}
+
+
+/*!
+ * \brief StandInFileServer::sendFileList
+ */
+void
+StandInFileServer::sendFileList(QWebSocket *pClient) {
+    QDir dir(sDirectory);
+    QFileInfoList fileList = dir.entryInfoList(QDir::Files | QDir::NoDotAndDotDot, QDir::Name);
+    QStringList entries;
+    for(int i=0; i<fileList.count(); i++) {
+        entries.append(QString("%1;%2;%3")
+                       .arg(fileList.at(i).fileName())
+                       .arg(fileList.at(i).size())
+                       .arg(fileMd5(fileList.at(i).absoluteFilePath())));
+    }
+    pClient->sendTextMessage(QString("<file_list>%1</file_list>").arg(entries.join(",")));
+}
+
+
+/*!
+ * \brief StandInFileServer::enqueue Queue a chunk request
+ * \param sArguments "name,offset,length"
+ * \param bRaw true to answer on the raw TCP connection
+ */
+void
+StandInFileServer::enqueue(QWebSocket *pClient, QString sArguments, bool bRaw) {
+    QStringList arguments = sArguments.split(",");
+    if(arguments.count() < 3) {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("%1: malformed request %2")
+                   .arg(sMyName)
+                   .arg(sArguments));
+        return;
+    }
+    request newRequest;
+    newRequest.pClient   = pClient;
+    newRequest.sFileName = arguments.at(0);
+    newRequest.offset    = arguments.at(1).toLongLong();
+    newRequest.length    = qBound(qint64(1), arguments.at(2).toLongLong(), qint64(MAX_CHUNK_SIZE));
+    newRequest.bRaw      = bRaw;
+    newRequest.pairWaits = 0;
+    requests.enqueue(newRequest);
+    if(!sendTimer.isActive())
+        sendTimer.start(0);
+}
+
+
+/*!
+ * \brief StandInFileServer::onTimeToSend Answer the next queued request
+ * (waiting as needed to respect the rate limit)
+ */
+void
+StandInFileServer::onTimeToSend() {
+    if(requests.isEmpty())
+        return;
+    if(rate > 0) {
+        qint64 due = bytesSent*1000/rate - rateClock.elapsed();
+        if(due > 0) {
+            sendTimer.start(int(due));
+            return;
+        }
+    }
+    request aRequest = requests.dequeue();
+    QTcpSocket *pRaw = Q_NULLPTR;
+    if(aRequest.bRaw) {
+        pRaw = rawSocketFor(aRequest.pClient);
+        // The token could still be on its way on the raw connection
+        if(!pRaw && clientTokens.contains(aRequest.pClient) &&
+           aRequest.pairWaits < RAW_PAIR_WAITS)
+        {
+            aRequest.pairWaits++;
+            requests.prepend(aRequest);
+            sendTimer.start(RAW_PAIR_WAIT);
+            return;
+        }
+    }
+    qint64 fileSize = 0;
+    QByteArray baData = readChunk(aRequest, &fileSize);
+    if(fileSize < 0) {
+        aRequest.pClient->sendTextMessage(QString("<file_error>%1</file_error>")
+                                          .arg(aRequest.sFileName));
+    }
+    else if(aRequest.bRaw) {
+        if(!pRaw) {
+            logMessage(logFile,
+                       Q_FUNC_INFO,
+                       QString("%1: no raw connection for %2")
+                       .arg(sMyName)
+                       .arg(aRequest.pClient->peerAddress().toString()));
+        }
+        else {
+            uchar header[RAW_HEADER_SIZE];
+            qToBigEndian<quint64>(quint64(aRequest.offset), header);
+            qToBigEndian<quint64>(quint64(baData.size()), header+8);
+            pRaw->write(reinterpret_cast<const char *>(header), RAW_HEADER_SIZE);
+            pRaw->write(baData);
+        }
+    }
+    else {
+        QByteArray baMessage;
+        if(aRequest.offset == 0) {
+            baMessage = QString("%1,%2")
+                        .arg(aRequest.sFileName)
+                        .arg(fileSize)
+                        .toUtf8();
+            baMessage.append(HEADER_SIZE-baMessage.size(), '\0');
+        }
+        baMessage.append(baData);
+        aRequest.pClient->sendBinaryMessage(baMessage);
+    }
+    bytesSent += baData.size();
+    if(!requests.isEmpty())
+        sendTimer.start(0);
+}
+
+
+/*!
+ * \brief StandInFileServer::readChunk
+ * \param aRequest The request
+ * \param pFileSize [out] The whole file size (-1 if the file is missing)
+ * \return The requested data
+ */
+QByteArray
+StandInFileServer::readChunk(const request &aRequest, qint64 *pFileSize) {
+    QFile file(sDirectory + QFileInfo(aRequest.sFileName).fileName());
+    *pFileSize = -1;
+    if(!file.open(QIODevice::ReadOnly)) {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("%1: unable to open %2")
+                   .arg(sMyName)
+                   .arg(file.fileName()));
+        return QByteArray();
+    }
+    *pFileSize = file.size();
+    if(!file.seek(aRequest.offset))
+        return QByteArray();
+    QByteArray baData = file.read(aRequest.length);
+    file.close();
+    return baData;
+}
+
+
+/*!
+ * \brief StandInFileServer::rawSocketFor
+ * \return The raw connection that sent the token announced
+ * on this WebSocket (if any)
+ *
+ * Many Panels (e.g. the simulated ones) can share the same address:
+ * only the token tells the raw connections apart.
+ */
+QTcpSocket*
+StandInFileServer::rawSocketFor(QWebSocket *pClient) {
+    if(!clientTokens.contains(pClient))
+        return Q_NULLPTR;
+    return rawTokens.key(clientTokens.value(pClient), Q_NULLPTR);
+}
@@ -0,0 +1,90 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#ifndef STANDINFILESERVER_H
+#define STANDINFILESERVER_H
+
+#include <QObject>
+#include <QList>
+#include <QMap>
+#include <QQueue>
+#include <QTimer>
+#include <QElapsedTimer>
+
+QT_FORWARD_DECLARE_CLASS(QWebSocketServer)
+QT_FORWARD_DECLARE_CLASS(QWebSocket)
+QT_FORWARD_DECLARE_CLASS(QTcpServer)
+QT_FORWARD_DECLARE_CLASS(QTcpSocket)
+QT_FORWARD_DECLARE_CLASS(QFile)
+
+
+class StandInFileServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit StandInFileServer(QString sName, QString sDir, quint16 port,
+                               QFile *myLogFile = Q_NULLPTR, QObject *parent = Q_NULLPTR);
+    ~StandInFileServer();
+    bool start();
+    void stop();
+    void setRate(qint64 bytesPerSecond);
+    void closeConnections();
+
+private slots:
+    void onNewConnection();
+    void onNewRawConnection();
+    void onClientDisconnected();
+    void onRawClientDisconnected();
+    void onRawReadyRead();
+    void onProcessTextMessage(QString sMessage);
+    void onProcessBinaryMessage(QByteArray baMessage);
+    void onTimeToSend();
+
+private:
+    struct request {
+        QWebSocket *pClient;
+        QString     sFileName;
+        qint64      offset;
+        qint64      length;
+        bool        bRaw;
+        int         pairWaits;// Times waited for the raw connection
+    };
+    void        sendFileList(QWebSocket *pClient);
+    void        enqueue(QWebSocket *pClient, QString sArguments, bool bRaw);
+    QByteArray  readChunk(const request &aRequest, qint64 *pFileSize);
+    QTcpSocket *rawSocketFor(QWebSocket *pClient);
+
+private:
+    QFile              *logFile;
+    QString             sMyName;
+    QString             sDirectory;
+    quint16             serverPort;
+    QWebSocketServer   *pServer;
+    QTcpServer         *pRawServer;
+    QList<QWebSocket*>  clients;
+    QList<QTcpSocket*>  rawClients;
+    QMap<QWebSocket*, quint64> clientTokens;// Announced with <raw_token>
+    QMap<QTcpSocket*, quint64> rawTokens;// Sent on the raw connection
+    QQueue<request>     requests;
+    QTimer              sendTimer;
+    QElapsedTimer       rateClock;
+    qint64              rate;
+    qint64              bytesSent;
+};
+
+#endif // STANDINFILESERVER_H
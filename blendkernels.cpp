@@ -0,0 +1,375 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#include <cstring>
+
+#include "blendkernels.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+    #define BLEND_NEON
+    #if defined(__arm__) && defined(__linux__)
+        #include <sys/auxv.h>
+        #include <asm/hwcap.h>
+    #endif
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+    #define BLEND_SSE2
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #include <immintrin.h>
+    #define BLEND_AVX2
+#endif
+
+
+//=====================================================================
+// The slide transitions work on opaque ARGB32_Premultiplied frames
+// (RGB16 in the low memory mode). Every kernel computes, for each
+// 8 bit channel (or 5/6 bit channel of an RGB16 pixel):
+//     d = (from*(256-alpha) + to*alpha) >> 8    with 0 < alpha < 256
+// so that all of them give exactly the same result.
+//=====================================================================
+
+
+/*!
+ * \brief fadeRowScalar Two channels at a time in a 32 bit register
+ */
+static void
+fadeRowScalar(const quint32 *pFrom, const quint32 *pTo, quint32 *pDest, int n, int alpha) {
+    quint32 inverse = quint32(256-alpha);
+    for(int i=0; i<n; i++) {
+        quint32 from = pFrom[i];
+        quint32 to   = pTo[i];
+        quint32 rb = (((from & 0x00ff00ff)*inverse + (to & 0x00ff00ff)*quint32(alpha)) >> 8) & 0x00ff00ff;
+        quint32 ag = (((from >> 8) & 0x00ff00ff)*inverse + ((to >> 8) & 0x00ff00ff)*quint32(alpha)) & 0xff00ff00;
+        pDest[i] = rb | ag;
+    }
+}
+
+
+#ifdef BLEND_NEON
+/*!
+ * \brief fadeRowNeon 4 pixels (16 channels) per iteration
+ */
+static void
+fadeRowNeon(const quint32 *pFrom, const quint32 *pTo, quint32 *pDest, int n, int alpha) {
+    uint8x8_t va = vdup_n_u8(uint8_t(alpha));
+    uint8x8_t vi = vdup_n_u8(uint8_t(256-alpha));
+    int i = 0;
+    for(; i+4<=n; i+=4) {
+        uint8x16_t from = vld1q_u8(reinterpret_cast<const uint8_t *>(pFrom+i));
+        uint8x16_t to   = vld1q_u8(reinterpret_cast<const uint8_t *>(pTo+i));
+        uint16x8_t lo = vmull_u8(vget_low_u8(from), vi);
+        lo = vmlal_u8(lo, vget_low_u8(to), va);
+        uint16x8_t hi = vmull_u8(vget_high_u8(from), vi);
+        hi = vmlal_u8(hi, vget_high_u8(to), va);
+        vst1q_u8(reinterpret_cast<uint8_t *>(pDest+i),
+                 vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8)));
+    }
+    fadeRowScalar(pFrom+i, pTo+i, pDest+i, n-i, alpha);
+}
+#endif
+
+
+#ifdef BLEND_SSE2
+/*!
+ * \brief fadeRowSse2 4 pixels (16 channels) per iteration
+ */
+static void
+fadeRowSse2(const quint32 *pFrom, const quint32 *pTo, quint32 *pDest, int n, int alpha) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i va = _mm_set1_epi16(short(alpha));
+    const __m128i vi = _mm_set1_epi16(short(256-alpha));
+    int i = 0;
+    for(; i+4<=n; i+=4) {
+        __m128i from = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pFrom+i));
+        __m128i to   = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pTo+i));
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(from, zero), vi),
+                                   _mm_mullo_epi16(_mm_unpacklo_epi8(to, zero), va));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(from, zero), vi),
+                                   _mm_mullo_epi16(_mm_unpackhi_epi8(to, zero), va));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(pDest+i),
+                         _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+    }
+    fadeRowScalar(pFrom+i, pTo+i, pDest+i, n-i, alpha);
+}
+#endif
+
+
+#ifdef BLEND_AVX2
+/*!
+ * \brief fadeRowAvx2 8 pixels (32 channels) per iteration (selected at run time)
+ */
+__attribute__((target("avx2")))
+static void
+fadeRowAvx2(const quint32 *pFrom, const quint32 *pTo, quint32 *pDest, int n, int alpha) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i va = _mm256_set1_epi16(short(alpha));
+    const __m256i vi = _mm256_set1_epi16(short(256-alpha));
+    int i = 0;
+    for(; i+8<=n; i+=8) {
+        __m256i from = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pFrom+i));
+        __m256i to   = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pTo+i));
+        // unpack and pack work within each 128 bit lane: the order is preserved
+        __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(from, zero), vi),
+                                      _mm256_mullo_epi16(_mm256_unpacklo_epi8(to, zero), va));
+        __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(from, zero), vi),
+                                      _mm256_mullo_epi16(_mm256_unpackhi_epi8(to, zero), va));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(pDest+i),
+                            _mm256_packus_epi16(_mm256_srli_epi16(lo, 8), _mm256_srli_epi16(hi, 8)));
+    }
+    fadeRowScalar(pFrom+i, pTo+i, pDest+i, n-i, alpha);
+}
+#endif
+
+
+typedef void (*fadeRowFunction)(const quint32 *, const quint32 *, quint32 *, int, int);
+
+
+/*!
+ * \brief fadeRow16Scalar One RGB16 pixel at a time
+ */
+static void
+fadeRow16Scalar(const quint16 *pFrom, const quint16 *pTo, quint16 *pDest, int n, int alpha) {
+    quint32 inverse = quint32(256-alpha);
+    for(int i=0; i<n; i++) {
+        quint32 from = pFrom[i];
+        quint32 to   = pTo[i];
+        quint32 r = ((from >> 11)*inverse + (to >> 11)*quint32(alpha)) >> 8;
+        quint32 g = (((from >> 5) & 0x3f)*inverse + ((to >> 5) & 0x3f)*quint32(alpha)) >> 8;
+        quint32 b = ((from & 0x1f)*inverse + (to & 0x1f)*quint32(alpha)) >> 8;
+        pDest[i] = quint16((r << 11) | (g << 5) | b);
+    }
+}
+
+
+#ifdef BLEND_SSE2
+/*!
+ * \brief fadeRow16Sse2 8 RGB16 pixels per iteration
+ */
+static void
+fadeRow16Sse2(const quint16 *pFrom, const quint16 *pTo, quint16 *pDest, int n, int alpha) {
+    const __m128i va = _mm_set1_epi16(short(alpha));
+    const __m128i vi = _mm_set1_epi16(short(256-alpha));
+    const __m128i mask5 = _mm_set1_epi16(0x1f);
+    const __m128i mask6 = _mm_set1_epi16(0x3f);
+    int i = 0;
+    for(; i+8<=n; i+=8) {
+        __m128i from = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pFrom+i));
+        __m128i to   = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pTo+i));
+        // At most 63*256: the products fit in 16 bits
+        __m128i r = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_srli_epi16(from, 11), vi),
+                                                 _mm_mullo_epi16(_mm_srli_epi16(to, 11), va)), 8);
+        __m128i g = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(from, 5), mask6), vi),
+                                                 _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(to, 5), mask6), va)), 8);
+        __m128i b = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(from, mask5), vi),
+                                                 _mm_mullo_epi16(_mm_and_si128(to, mask5), va)), 8);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(pDest+i),
+                         _mm_or_si128(_mm_or_si128(_mm_slli_epi16(r, 11), _mm_slli_epi16(g, 5)), b));
+    }
+    fadeRow16Scalar(pFrom+i, pTo+i, pDest+i, n-i, alpha);
+}
+#endif
+
+
+typedef void (*fadeRow16Function)(const quint16 *, const quint16 *, quint16 *, int, int);
+
+
+#ifdef BLEND_NEON
+/*!
+ * \brief hasNeon
+ * \return true if the CPU running the code has NEON
+ * (optional on 32 bit ARM, always present on AArch64)
+ */
+static bool
+hasNeon() {
+#if defined(__arm__) && defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#else
+    return true;
+#endif
+}
+#endif
+
+
+/*!
+ * \brief selectFadeRow
+ * \return The fastest kernel for this CPU
+ */
+static fadeRowFunction
+selectFadeRow() {
+#ifdef BLEND_AVX2
+    __builtin_cpu_init();// We may run before the other static initializers
+    if(__builtin_cpu_supports("avx2"))
+        return fadeRowAvx2;
+#endif
+#if defined(BLEND_SSE2)
+    return fadeRowSse2;
+#else
+#ifdef BLEND_NEON
+    if(hasNeon())
+        return fadeRowNeon;
+#endif
+    return fadeRowScalar;
+#endif
+}
+
+
+/*!
+ * \brief selectFadeRow16
+ * \return The fastest RGB16 kernel for this CPU
+ */
+static fadeRow16Function
+selectFadeRow16() {
+#if defined(BLEND_SSE2)
+    return fadeRow16Sse2;
+#else
+    return fadeRow16Scalar;// Also on ARM: there is no RGB16 NEON kernel
+#endif
+}
+
+
+static fadeRowFunction   fadeRow   = selectFadeRow();
+static fadeRow16Function fadeRow16 = selectFadeRow16();
+
+
+/*!
+ * \brief setBlendKernel Force the row kernels (e.g. to compare them in the tests)
+ * \param kernel One of blendKernel
+ * \return false if the kernel is not available on this CPU (nothing changes)
+ *
+ * Not thread safe: don't call it while a transition is being rendered.
+ */
+bool
+setBlendKernel(int kernel) {
+    switch(kernel) {
+    case kernel_Auto:
+        fadeRow   = selectFadeRow();
+        fadeRow16 = selectFadeRow16();
+        return true;
+    case kernel_Scalar:
+        fadeRow   = fadeRowScalar;
+        fadeRow16 = fadeRow16Scalar;
+        return true;
+#ifdef BLEND_SSE2
+    case kernel_Sse2:
+        fadeRow   = fadeRowSse2;
+        fadeRow16 = fadeRow16Sse2;
+        return true;
+#endif
+#if defined(BLEND_AVX2) && defined(BLEND_SSE2)
+    case kernel_Avx2:
+        if(!__builtin_cpu_supports("avx2"))
+            return false;
+        fadeRow   = fadeRowAvx2;
+        fadeRow16 = fadeRow16Sse2;
+        return true;
+#endif
+#ifdef BLEND_NEON
+    case kernel_Neon:
+        if(!hasNeon())
+            return false;
+        fadeRow   = fadeRowNeon;
+        fadeRow16 = fadeRow16Scalar;
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+
+/*!
+ * \brief isBlendable
+ * \return true if the kernels can work on these frames
+ */
+static bool
+isBlendable(const QImage &first, const QImage &second, const QImage *pDestination) {
+    if(pDestination == Q_NULLPTR)
+        return false;
+    if(first.size() != second.size() || first.size() != pDestination->size())
+        return false;
+    if((first.format() != second.format()) || (first.format() != pDestination->format()))
+        return false;
+    return (first.depth() == 32) || (first.format() == QImage::Format_RGB16);
+}
+
+
+/*!
+ * \brief crossFade Blend two frames straight into the destination
+ * \param from The frame fading out
+ * \param to The frame fading in
+ * \param alpha The weight of the "to" frame (0..256)
+ * \param pDestination The frame to write (same size and format)
+ * \return false if the frames are not suitable (use QPainter then)
+ */
+bool
+crossFade(const QImage &from, const QImage &to, int alpha, QImage *pDestination) {
+    if(!isBlendable(from, to, pDestination))
+        return false;
+    alpha = qBound(0, alpha, 256);
+    int width  = from.width();
+    int height = from.height();
+    int bytesPerPixel = from.depth()/8;
+    for(int y=0; y<height; y++) {
+        const uchar *pFrom = from.constScanLine(y);
+        const uchar *pTo   = to.constScanLine(y);
+        uchar *pDest = pDestination->scanLine(y);
+        if(alpha == 0)
+            memcpy(pDest, pFrom, size_t(width)*bytesPerPixel);
+        else if(alpha == 256)
+            memcpy(pDest, pTo, size_t(width)*bytesPerPixel);
+        else if(bytesPerPixel == 4)
+            fadeRow(reinterpret_cast<const quint32 *>(pFrom),
+                    reinterpret_cast<const quint32 *>(pTo),
+                    reinterpret_cast<quint32 *>(pDest), width, alpha);
+        else
+            fadeRow16(reinterpret_cast<const quint16 *>(pFrom),
+                      reinterpret_cast<const quint16 *>(pTo),
+                      reinterpret_cast<quint16 *>(pDest), width, alpha);
+    }
+    return true;
+}
+
+
+/*!
+ * \brief wipeFromLeft The next frame enters from the left pushing the present one
+ * \param present The frame leaving on the right
+ * \param next The frame entering from the left
+ * \param xSplit The width of the next frame already visible
+ * \param pDestination The frame to write (same size and format)
+ * \return false if the frames are not suitable (use QPainter then)
+ */
+bool
+wipeFromLeft(const QImage &present, const QImage &next, int xSplit, QImage *pDestination) {
+    if(!isBlendable(present, next, pDestination))
+        return false;
+    int width  = present.width();
+    int height = present.height();
+    size_t bytesPerPixel = size_t(present.depth()/8);
+    xSplit = qBound(0, xSplit, width);
+    for(int y=0; y<height; y++) {
+        const uchar *pPresent = present.constScanLine(y);
+        const uchar *pNext    = next.constScanLine(y);
+        uchar *pDest = pDestination->scanLine(y);
+        memcpy(pDest, pNext+(width-xSplit)*bytesPerPixel, size_t(xSplit)*bytesPerPixel);
+        memcpy(pDest+xSplit*bytesPerPixel, pPresent, size_t(width-xSplit)*bytesPerPixel);
+    }
+    return true;
+}
@@ -0,0 +1,40 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#ifndef BLENDKERNELS_H
+#define BLENDKERNELS_H
+
+#include <QImage>
+
+
+/*!
+ * \brief The row kernels that can be forced with setBlendKernel()
+ */
+enum blendKernel {
+    kernel_Auto,  // The fastest one for this CPU
+    kernel_Scalar,
+    kernel_Sse2,
+    kernel_Avx2,  // RGB16 frames use the SSE2 kernel
+    kernel_Neon   // RGB16 frames use the scalar kernel
+};
+
+bool setBlendKernel(int kernel);
+bool crossFade(const QImage &from, const QImage &to, int alpha, QImage *pDestination);
+bool wipeFromLeft(const QImage &present, const QImage &next, int xSplit, QImage *pDestination);
+
+#endif // BLENDKERNELS_H
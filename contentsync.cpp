@@ -0,0 +1,458 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#include <QFile>
+#include <QTimer>
+#include <QUrl>
+#include <QMutexLocker>
+
+#include "contentsync.h"
+#include "fileupdater.h"
+#include "mediacache.h"
+#include "peerserver.h"
+#include "multicastreceiver.h"
+#include "utility.h"
+
+
+#define RETRY_MIN_TIME  1000 // In msec
+#define RETRY_MAX_TIME 60000 // In msec
+#define RATE_SAMPLE_TIME 500 // In msec
+
+
+/*! \todo Do we have to send the port numbers to use with
+ * the message sent by the Server upon a connection ?
+ */
+/*!
+ * \brief The content categories kept in sync with the Server.
+ * Adding a category only requires a new row.
+ */
+static const struct {
+    const char *sName;      /*!< The category (and File Updater) name */
+    quint16     port;       /*!< The File Server port */
+    const char *sDir;       /*!< The local folder (relative to the base dir) */
+    const char *sExtensions;/*!< The files to look for */
+} contentTable[] = {
+    { "spots",  45455, "spots/",  "*.mp4 *.MP4" },
+    { "slides", 45456, "slides/", "*.jpg *.jpeg *.png *.JPG *.JPEG *.PNG" },
+};
+
+
+/*!
+ * \brief ContentSync::ContentSync The engine keeping the local media in sync with the Server
+ * \param sBaseDir The folder containing the category folders
+ * \param myLogFile The File for logging (if any).
+ * \param parent The parent object.
+ *
+ * A single ContentSync, living in its own Thread, drives one FileUpdater
+ * for each of the categories listed in contentTable.
+ * The File Server connections are kept open between updates and a failed
+ * update is retried with an exponential backoff (with random jitter, so
+ * that all the panels don't hit the Server at the same time).
+ */
+ContentSync::ContentSync(QString sBaseDir, QFile *myLogFile, QObject *parent)
+    : QObject(parent)
+    , logFile(myLogFile)
+    , pPeerServer(Q_NULLPTR)
+    , pMulticastReceiver(Q_NULLPTR)
+    , pMediaCache(Q_NULLPTR)
+{
+    if(!sBaseDir.endsWith(QString("/"))) sBaseDir+= QString("/");
+    int nCategories = int(sizeof(contentTable)/sizeof(contentTable[0]));
+    for(int i=0; i<nCategories; i++) {
+        category newCategory;
+        newCategory.sName       = QString(contentTable[i].sName);
+        newCategory.port        = contentTable[i].port;
+        newCategory.sDir        = sBaseDir + QString(contentTable[i].sDir);
+        newCategory.sExtensions = QString(contentTable[i].sExtensions);
+        newCategory.pUpdater    = new FileUpdater(newCategory.sName, QUrl(), logFile, this);
+        newCategory.pUpdater->setDestination(newCategory.sDir, newCategory.sExtensions);
+        connect(newCategory.pUpdater, SIGNAL(transferDone(int)),
+                this, SLOT(onUpdaterDone(int)));
+        connect(newCategory.pUpdater, SIGNAL(progress(int,qint64,qint64,qint64)),
+                this, SLOT(onUpdaterProgress(int,qint64,qint64,qint64)));
+        connect(newCategory.pUpdater, SIGNAL(fileReady(QString)),
+                this, SLOT(onUpdaterFileReady(QString)));
+        newCategory.lastTransferred = 0;
+        newCategory.pRetryTimer = new QTimer(this);
+        newCategory.pRetryTimer->setSingleShot(true);
+        newCategory.pRetryTimer->setObjectName(newCategory.sName);
+        connect(newCategory.pRetryTimer, SIGNAL(timeout()),
+                this, SLOT(onTimeToRetry()));
+        categoryList.append(newCategory);
+
+        syncStatus newStatus;
+        newStatus.state      = state_Idle;
+        newStatus.returnCode = FileUpdater::TRANSFER_DONE;
+        newStatus.retries    = 0;
+        newStatus.retryDelay = 0;
+        newStatus.filesPending = 0;
+        newStatus.bytesDone    = 0;
+        newStatus.bytesTotal   = 0;
+        newStatus.throughput   = 0;
+        newStatus.eta          = -1;
+        statusMap.insert(newCategory.sName, newStatus);
+    }
+}
+
+
+/*!
+ * \brief ContentSync::setScheduler Share the scheduler among all the categories
+ * (to be called before moving the object to its Thread)
+ */
+void
+ContentSync::setScheduler(TransferScheduler *pTransferScheduler) {
+    for(int i=0; i<categoryList.count(); i++)
+        categoryList.at(i).pUpdater->setScheduler(pTransferScheduler);
+}
+
+
+/*!
+ * \brief ContentSync::setDeltaMode Enable the delta transfers for all the categories
+ * (to be called before moving the object to its Thread)
+ */
+void
+ContentSync::setDeltaMode(bool bEnable) {
+    for(int i=0; i<categoryList.count(); i++)
+        categoryList.at(i).pUpdater->setDeltaMode(bEnable);
+}
+
+
+/*!
+ * \brief ContentSync::setCache Keep the media of all the categories within a disk budget
+ * (to be called before moving the object to its Thread)
+ */
+void
+ContentSync::setCache(MediaCache *pCache) {
+    pMediaCache = pCache;
+    for(int i=0; i<categoryList.count(); i++) {
+        pMediaCache->addDirectory(categoryList.at(i).sName, categoryList.at(i).sDir);
+        categoryList.at(i).pUpdater->setCache(pMediaCache);
+    }
+    if(pMulticastReceiver)
+        pMulticastReceiver->setCache(pMediaCache);
+}
+
+
+/*!
+ * \brief ContentSync::setPeerMode Share the media with the other panels
+ * (to be called before moving the object to its Thread)
+ * \param bEnable true to serve our files and pull from the peers
+ * \param port The port where to serve the files (0 = any free port)
+ */
+void
+ContentSync::setPeerMode(bool bEnable, quint16 port) {
+    if(!bEnable || pPeerServer)
+        return;
+    pPeerServer = new PeerServer(port, logFile, this);
+    for(int i=0; i<categoryList.count(); i++) {
+        pPeerServer->addCategory(categoryList.at(i).sName, categoryList.at(i).sDir);
+        categoryList.at(i).pUpdater->setPeerServer(pPeerServer);
+    }
+}
+
+
+/*!
+ * \brief ContentSync::setMulticastMode Receive the files multicast by the Server
+ * (to be called before moving the object to its Thread)
+ */
+void
+ContentSync::setMulticastMode(bool bEnable) {
+    if(!bEnable || pMulticastReceiver)
+        return;
+    pMulticastReceiver = new MulticastReceiver(logFile, this);
+    pMulticastReceiver->setCache(pMediaCache);
+    for(int i=0; i<categoryList.count(); i++) {
+        pMulticastReceiver->addCategory(categoryList.at(i).sName, categoryList.at(i).sDir);
+        categoryList.at(i).pUpdater->setMulticastReceiver(pMulticastReceiver);
+    }
+}
+
+
+/*!
+ * \brief ContentSync::setRawMode Receive the file data on a plain TCP connection
+ * (to be called before moving the object to its Thread)
+ */
+void
+ContentSync::setRawMode(bool bEnable) {
+    for(int i=0; i<categoryList.count(); i++)
+        categoryList.at(i).pUpdater->setRawMode(bEnable);
+}
+
+
+/*!
+ * \brief ContentSync::categories
+ * \return The names of the managed categories
+ */
+QStringList
+ContentSync::categories() {
+    QStringList names;
+    for(int i=0; i<categoryList.count(); i++)
+        names.append(categoryList.at(i).sName);
+    return names;
+}
+
+
+/*!
+ * \brief ContentSync::status The status of a category (thread safe)
+ * \param sCategory The category name
+ */
+syncStatus
+ContentSync::status(QString sCategory) {
+    QMutexLocker locker(&statusMutex);
+    return statusMap.value(sCategory);
+}
+
+
+/*!
+ * \brief ContentSync::startSync Start updating all the categories
+ * \param sServerAddress The File Server address
+ */
+void
+ContentSync::startSync(QString sServerAddress) {
+    this->sServerAddress = sServerAddress;
+    if(pPeerServer)// Sockets must be created in this Thread
+        pPeerServer->start();
+    if(pMulticastReceiver) {
+        pMulticastReceiver->setServerAddress(sServerAddress);
+        pMulticastReceiver->start();
+    }
+    for(int i=0; i<categoryList.count(); i++) {
+        // A busy updater ends here with SERVER_DISCONNECTED and schedules
+        // a retry: the retry timer is stopped afterwards
+        categoryList.at(i).pUpdater->setServerUrl(QUrl(QString("ws://%1:%2")
+                                                       .arg(sServerAddress)
+                                                       .arg(categoryList.at(i).port)));
+        categoryList.at(i).pRetryTimer->stop();
+        {
+            QMutexLocker locker(&statusMutex);
+            statusMap[categoryList.at(i).sName].retries = 0;
+        }
+        startCategory(i);
+    }
+}
+
+
+/*!
+ * \brief ContentSync::stopSync Stop all the updates and close the connections
+ */
+void
+ContentSync::stopSync() {
+    for(int i=0; i<categoryList.count(); i++) {
+        categoryList.at(i).pRetryTimer->stop();
+        categoryList.at(i).pUpdater->stopUpdate();
+        setStatus(i, state_Idle, FileUpdater::TRANSFER_DONE);
+    }
+}
+
+
+/*!
+ * \brief ContentSync::onUpdaterDone Invoked asynchronously at the end of an update
+ * \param returnCode The update result
+ */
+void
+ContentSync::onUpdaterDone(int returnCode) {
+    int iCategory = findUpdater(sender());
+    if(iCategory < 0)
+        return;
+    QString sName = categoryList.at(iCategory).sName;
+    {
+        QMutexLocker locker(&statusMutex);
+        statusMap[sName].throughput = 0;
+        if(returnCode == FileUpdater::TRANSFER_DONE)
+            statusMap[sName].eta = 0;
+        else {
+            statusMap[sName].eta = -1;
+            statusMap[sName].sLastError = categoryList.at(iCategory).pUpdater->errorString();
+        }
+    }
+    if(returnCode == FileUpdater::TRANSFER_DONE) {
+#ifdef LOG_VERBOSE
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   sName + QString(" updated without errors"));
+#endif
+        {
+            QMutexLocker locker(&statusMutex);
+            statusMap[sName].retries = 0;
+        }
+        setStatus(iCategory, state_UpToDate, returnCode);
+    }
+    else if(returnCode == FileUpdater::ERROR_SOCKET ||
+            returnCode == FileUpdater::SERVER_DISCONNECTED ||
+            returnCode == FileUpdater::DISK_FULL) {
+        int delay;
+        {
+            QMutexLocker locker(&statusMutex);
+            int retries = ++statusMap[sName].retries;
+            delay = RETRY_MIN_TIME << qMin(retries-1, 6);
+            delay = qMin(delay, RETRY_MAX_TIME);
+            delay = delay/2 + rand()%(delay/2+1);
+            statusMap[sName].retryDelay = delay;
+        }
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   sName +
+                   QString(" %1: retrying in %2 ms")
+                   .arg(returnCode == FileUpdater::ERROR_SOCKET ?
+                            QString("closed with errors") :
+                        returnCode == FileUpdater::DISK_FULL ?
+                            QString("not enough disk space") :
+                            QString("Server Unexpectedly Closed the Connection"))
+                   .arg(delay));
+        categoryList.at(iCategory).pRetryTimer->start(delay);
+        setStatus(iCategory, state_Retrying, returnCode);
+    }
+    else if(returnCode == FileUpdater::FILE_ERROR) {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   sName + QString(" got a File Error"));
+        setStatus(iCategory, state_Failed, returnCode);
+    }
+    else {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   sName +
+                   QString(" closed for Unknown Reason: %1")
+                   .arg(returnCode));
+        setStatus(iCategory, state_Failed, returnCode);
+    }
+}
+
+
+/*!
+ * \brief ContentSync::onUpdaterFileReady Tell which category the new file belongs to
+ * \param sFileName The file (full path) just transferred
+ */
+void
+ContentSync::onUpdaterFileReady(QString sFileName) {
+    int iCategory = findUpdater(sender());
+    if(iCategory < 0)
+        return;
+    emit fileReady(categoryList.at(iCategory).sName, sFileName);
+}
+
+
+/*!
+ * \brief ContentSync::onUpdaterProgress Keep track of the transfer progress
+ * \param filesPending The files still to transfer
+ * \param bytesDone The bytes of these files already present
+ * \param bytesTotal The total bytes of these files
+ * \param bytesTransferred The bytes received so far from the network
+ *
+ * The throughput is sampled every RATE_SAMPLE_TIME ms and smoothed
+ * with an exponentially weighted moving average.
+ * No statusChanged() is emitted: progress is polled with status().
+ */
+void
+ContentSync::onUpdaterProgress(int filesPending, qint64 bytesDone, qint64 bytesTotal, qint64 bytesTransferred) {
+    int iCategory = findUpdater(sender());
+    if(iCategory < 0)
+        return;
+    category &cat = categoryList[iCategory];
+    QMutexLocker locker(&statusMutex);
+    syncStatus &status = statusMap[cat.sName];
+    status.filesPending = filesPending;
+    status.bytesDone    = bytesDone;
+    status.bytesTotal   = bytesTotal;
+    if(!cat.rateClock.isValid() || bytesTransferred < cat.lastTransferred) {
+        cat.rateClock.start();
+        cat.lastTransferred = bytesTransferred;
+    }
+    qint64 elapsed = cat.rateClock.elapsed();
+    if(elapsed >= RATE_SAMPLE_TIME) {
+        qint64 rate = (bytesTransferred-cat.lastTransferred)*1000/elapsed;
+        if(status.throughput == 0)
+            status.throughput = rate;
+        else
+            status.throughput = (3*status.throughput + rate)/4;
+        cat.rateClock.restart();
+        cat.lastTransferred = bytesTransferred;
+    }
+    if(bytesDone >= bytesTotal)
+        status.eta = 0;
+    else if(status.throughput > 0)
+        status.eta = int((bytesTotal-bytesDone)/status.throughput);
+    else
+        status.eta = -1;
+}
+
+
+/*!
+ * \brief ContentSync::onTimeToRetry Retry a failed update
+ */
+void
+ContentSync::onTimeToRetry() {
+    int iCategory = findCategory(sender()->objectName());
+    if(iCategory >= 0)
+        startCategory(iCategory);
+}
+
+
+/*!
+ * \brief ContentSync::findCategory
+ * \return The index of the named category or -1
+ */
+int
+ContentSync::findCategory(QString sName) {
+    for(int i=0; i<categoryList.count(); i++) {
+        if(categoryList.at(i).sName == sName)
+            return i;
+    }
+    return -1;
+}
+
+
+/*!
+ * \brief ContentSync::findUpdater
+ * \return The index of the category served by pUpdater or -1
+ */
+int
+ContentSync::findUpdater(QObject *pUpdater) {
+    for(int i=0; i<categoryList.count(); i++) {
+        if(categoryList.at(i).pUpdater == pUpdater)
+            return i;
+    }
+    return -1;
+}
+
+
+/*!
+ * \brief ContentSync::startCategory Start (or restart) the update of a category
+ */
+void
+ContentSync::startCategory(int iCategory) {
+    if(sServerAddress.isEmpty())
+        return;
+    setStatus(iCategory, state_Transferring, FileUpdater::TRANSFER_DONE);
+    categoryList.at(iCategory).pUpdater->startUpdate();
+}
+
+
+/*!
+ * \brief ContentSync::setStatus Update the status of a category and notify it
+ */
+void
+ContentSync::setStatus(int iCategory, int state, int returnCode) {
+    QString sName = categoryList.at(iCategory).sName;
+    {
+        QMutexLocker locker(&statusMutex);
+        statusMap[sName].state      = state;
+        statusMap[sName].returnCode = returnCode;
+    }
+    emit statusChanged(sName);
+}
@@ -0,0 +1,121 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#ifndef CONTENTSYNC_H
+#define CONTENTSYNC_H
+
+#include <QObject>
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QStringList>
+#include <QElapsedTimer>
+
+QT_FORWARD_DECLARE_CLASS(QFile)
+QT_FORWARD_DECLARE_CLASS(QTimer)
+QT_FORWARD_DECLARE_CLASS(FileUpdater)
+QT_FORWARD_DECLARE_CLASS(TransferScheduler)
+QT_FORWARD_DECLARE_CLASS(MediaCache)
+QT_FORWARD_DECLARE_CLASS(PeerServer)
+QT_FORWARD_DECLARE_CLASS(MulticastReceiver)
+
+
+/*!
+ * \brief The synchronization status of a content category
+ */
+struct syncStatus {
+    int     state;     /*!< \brief One of ContentSync::syncState */
+    int     returnCode;/*!< \brief The last FileUpdater return code */
+    int     retries;   /*!< \brief Consecutive failed attempts */
+    int     retryDelay;/*!< \brief Delay (ms) before the next attempt */
+    int     filesPending;/*!< \brief Files still to transfer */
+    qint64  bytesDone; /*!< \brief Bytes of the pending files already present */
+    qint64  bytesTotal;/*!< \brief Total bytes of the pending files */
+    qint64  throughput;/*!< \brief Current download rate (bytes/s) */
+    int     eta;       /*!< \brief Estimated time (s) to complete or -1 if unknown */
+    QString sLastError;/*!< \brief The description of the last error occurred */
+};
+
+
+class ContentSync : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ContentSync(QString sBaseDir, QFile *myLogFile = Q_NULLPTR, QObject *parent = Q_NULLPTR);
+    void        setScheduler(TransferScheduler *pTransferScheduler);
+    void        setDeltaMode(bool bEnable);
+    void        setCache(MediaCache *pMediaCache);
+    void        setPeerMode(bool bEnable, quint16 port);
+    void        setMulticastMode(bool bEnable);
+    void        setRawMode(bool bEnable);
+    QStringList categories();
+    syncStatus  status(QString sCategory);
+
+    /*!
+     * \brief The syncState enum
+     */
+    enum syncState {
+        state_Idle,        /*!< Never started */
+        state_Transferring,/*!< Update in progress */
+        state_UpToDate,    /*!< All the files are present */
+        state_Retrying,    /*!< Waiting to retry after an error */
+        state_Failed       /*!< Stopped after an unrecoverable error */
+    };
+
+signals:
+    void statusChanged(QString sCategory);/*!< \brief emitted when a category changes its state */
+    void fileReady(QString sCategory, QString sFileName);/*!< \brief emitted when a file has been updated */
+
+public slots:
+    void startSync(QString sServerAddress);
+    void stopSync();
+
+private slots:
+    void onUpdaterDone(int returnCode);
+    void onUpdaterProgress(int filesPending, qint64 bytesDone, qint64 bytesTotal, qint64 bytesTransferred);
+    void onUpdaterFileReady(QString sFileName);
+    void onTimeToRetry();
+
+private:
+    struct category {
+        QString      sName;
+        quint16      port;
+        QString      sDir;
+        QString      sExtensions;
+        FileUpdater *pUpdater;
+        QTimer      *pRetryTimer;
+        QElapsedTimer rateClock;
+        qint64       lastTransferred;
+    };
+    int  findCategory(QString sName);
+    int  findUpdater(QObject *pUpdater);
+    void startCategory(int iCategory);
+    void setStatus(int iCategory, int state, int returnCode);
+
+private:
+    QFile                     *logFile;
+    QString                    sServerAddress;
+    PeerServer                *pPeerServer;
+    MulticastReceiver         *pMulticastReceiver;
+    MediaCache                *pMediaCache;
+    QList<category>            categoryList;
+    QMutex                     statusMutex;
+    QMap<QString, syncStatus>  statusMap;
+};
+
+#endif // CONTENTSYNC_H
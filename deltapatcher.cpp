@@ -0,0 +1,294 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#include <QtEndian>
+
+#include "deltapatcher.h"
+
+
+/*!
+ * \brief DeltaPatcher::DeltaPatcher Rebuilds a modified file from an old local copy
+ *
+ * The panel sends the Server the signature of its old copy of a file
+ * (a weak "rolling" checksum and a strong MD5 for each block).
+ * The Server answers with a stream of instructions:
+ * "copy block n from the old file" or "here are some literal bytes",
+ * terminated by the MD5 of the whole new file.
+ * Only the blocks that really changed travel on the network.
+ * The new file is written aside and the old one is left untouched
+ * (and playable) until the patch has been completed and verified.
+ */
+DeltaPatcher::DeltaPatcher()
+    : outHash(QCryptographicHash::Md5)
+    , iBlockSize(0)
+    , expectedFileSize(0)
+    , writtenBytes(0)
+    , literalRemaining(0)
+    , bDone(false)
+    , bFailed(false)
+{
+}
+
+
+/*!
+ * \brief DeltaPatcher::~DeltaPatcher
+ */
+DeltaPatcher::~DeltaPatcher() {
+    if(baseFile.isOpen()) baseFile.close();
+    if(outFile.isOpen())  outFile.close();
+}
+
+
+/*!
+ * \brief DeltaPatcher::weakChecksum The rsync "rolling" checksum of a block
+ * \param data The block
+ * \param len Its length
+ * \return (b << 16) | a where a and b are the two 16 bit sums
+ */
+quint32
+DeltaPatcher::weakChecksum(const char *data, int len) {
+    quint32 a = 0;
+    quint32 b = 0;
+    for(int i=0; i<len; i++) {
+        a += quint8(data[i]);
+        b += quint32(len-i) * quint8(data[i]);
+    }
+    return ((b & 0xffff) << 16) | (a & 0xffff);
+}
+
+
+/*!
+ * \brief DeltaPatcher::signature Compute the block signature of a file
+ * \param sBaseFile The file to sign
+ * \param blockSize The block size (in bytes)
+ * \return SIGNATURE_RECORD_SIZE bytes per block or an empty array on error
+ */
+QByteArray
+DeltaPatcher::signature(QString sBaseFile, int blockSize) {
+    QByteArray baSignature;
+    QFile file(sBaseFile);
+    if(blockSize <= 0 || !file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    baSignature.reserve(int((file.size()/blockSize+1)*SIGNATURE_RECORD_SIZE));
+    uchar weak[4];
+    while(!file.atEnd()) {
+        QByteArray block = file.read(blockSize);
+        if(block.isEmpty())
+            break;
+        qToBigEndian<quint32>(weakChecksum(block.constData(), block.size()), weak);
+        baSignature.append(reinterpret_cast<const char*>(weak), 4);
+        baSignature.append(QCryptographicHash::hash(block, QCryptographicHash::Md5));
+    }
+    file.close();
+    return baSignature;
+}
+
+
+/*!
+ * \brief DeltaPatcher::start Prepare to rebuild a file
+ * \param sBaseFile The old local copy the Server will refer to
+ * \param sOutFile The file to write
+ * \param blockSize The block size used for the signature
+ * \param expectedSize The size of the new file (as sent by the Server)
+ * \return true if both files can be opened
+ */
+bool
+DeltaPatcher::start(QString sBaseFile, QString sOutFile, int blockSize, qint64 expectedSize) {
+    abort();
+    iBlockSize       = blockSize;
+    expectedFileSize = expectedSize;
+    writtenBytes     = 0;
+    literalRemaining = 0;
+    pending.clear();
+    outHash.reset();
+    bDone   = false;
+    bFailed = false;
+    sErrorString = QString();
+
+    baseFile.setFileName(sBaseFile);
+    if(!baseFile.open(QIODevice::ReadOnly))
+        return fail(QString("Unable to open %1").arg(sBaseFile));
+    outFile.setFileName(sOutFile);
+    if(!outFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return fail(QString("Unable to open %1").arg(sOutFile));
+    return true;
+}
+
+
+/*!
+ * \brief DeltaPatcher::feed Process a piece of the instruction stream
+ * \param baData The bytes received (instructions may span several frames)
+ * \return false if the stream is corrupted or the output can't be written
+ */
+bool
+DeltaPatcher::feed(const QByteArray &baData) {
+    if(bFailed)
+        return false;
+    const char *p = baData.constData();
+    qint64 left = baData.size();
+    while(left > 0) {
+        if(bDone)
+            return fail(QString("Unexpected data after the end of the delta"));
+        if(literalRemaining > 0) {// Literal data go straight to the file
+            qint64 len = qMin(left, literalRemaining);
+            if(!writeOut(p, len))
+                return false;
+            p                += len;
+            left             -= len;
+            literalRemaining -= len;
+            continue;
+        }
+        char op = pending.isEmpty() ? *p : pending.at(0);
+        int needed;
+        if(op == OP_COPY || op == OP_LITERAL)
+            needed = 1+4;
+        else if(op == OP_END)
+            needed = 1+16;
+        else
+            return fail(QString("Unknown delta instruction: %1").arg(int(op)));
+        int take = int(qMin(left, qint64(needed-pending.size())));
+        pending.append(p, take);
+        p    += take;
+        left -= take;
+        if(pending.size() < needed)
+            break;// Wait for the rest of the instruction
+        if(op == OP_COPY) {
+            if(!copyBlock(qFromBigEndian<quint32>(pending.constData()+1)))
+                return false;
+        }
+        else if(op == OP_LITERAL) {
+            literalRemaining = qFromBigEndian<quint32>(pending.constData()+1);
+        }
+        else {// OP_END
+            if(writtenBytes != expectedFileSize)
+                return fail(QString("Size mismatch: %1/%2")
+                            .arg(writtenBytes)
+                            .arg(expectedFileSize));
+            if(outHash.result() != pending.mid(1, 16))
+                return fail(QString("Checksum mismatch"));
+            bDone = true;
+        }
+        pending.clear();
+    }
+    return true;
+}
+
+
+/*!
+ * \brief DeltaPatcher::isDone
+ * \return true if the whole stream has been received and verified
+ */
+bool
+DeltaPatcher::isDone() {
+    return bDone && !bFailed;
+}
+
+
+/*!
+ * \brief DeltaPatcher::finish Close the files
+ * \return true if the new file is complete and verified
+ */
+bool
+DeltaPatcher::finish() {
+    baseFile.close();
+    if(outFile.isOpen() && !outFile.flush())
+        fail(QString("Unable to flush %1").arg(outFile.fileName()));
+    outFile.close();
+    if(!bDone && !bFailed)
+        fail(QString("Delta stream truncated"));
+    return isDone();
+}
+
+
+/*!
+ * \brief DeltaPatcher::abort Discard the partially rebuilt file
+ */
+void
+DeltaPatcher::abort() {
+    if(baseFile.isOpen())
+        baseFile.close();
+    if(outFile.isOpen()) {
+        outFile.close();
+        outFile.remove();
+    }
+    bDone = false;
+}
+
+
+/*!
+ * \brief DeltaPatcher::bytesWritten
+ * \return The size of the new file rebuilt so far
+ */
+qint64
+DeltaPatcher::bytesWritten() {
+    return writtenBytes;
+}
+
+
+/*!
+ * \brief DeltaPatcher::errorString
+ * \return The reason of the last failure
+ */
+QString
+DeltaPatcher::errorString() {
+    return sErrorString;
+}
+
+
+/*!
+ * \brief DeltaPatcher::copyBlock Copy an unchanged block from the old file
+ * \param blockIndex The block index
+ * \return false on error
+ */
+bool
+DeltaPatcher::copyBlock(quint32 blockIndex) {
+    qint64 offset = qint64(blockIndex)*iBlockSize;
+    if(offset >= baseFile.size() || !baseFile.seek(offset))
+        return fail(QString("Invalid block index: %1").arg(blockIndex));
+    QByteArray block = baseFile.read(iBlockSize);
+    if(block.isEmpty())
+        return fail(QString("Unable to read block %1").arg(blockIndex));
+    return writeOut(block.constData(), block.size());
+}
+
+
+/*!
+ * \brief DeltaPatcher::writeOut Append data to the new file
+ */
+bool
+DeltaPatcher::writeOut(const char *data, qint64 len) {
+    if(writtenBytes+len > expectedFileSize)
+        return fail(QString("Delta exceeds the announced size"));
+    if(outFile.write(data, len) != len)
+        return fail(QString("Unable to write %1").arg(outFile.fileName()));
+    outHash.addData(data, int(len));
+    writtenBytes += len;
+    return true;
+}
+
+
+/*!
+ * \brief DeltaPatcher::fail Record the failure reason
+ * \return always false
+ */
+bool
+DeltaPatcher::fail(QString sError) {
+    bFailed = true;
+    sErrorString = sError;
+    return false;
+}
@@ -0,0 +1,69 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#ifndef DELTAPATCHER_H
+#define DELTAPATCHER_H
+
+#include <QString>
+#include <QByteArray>
+#include <QFile>
+#include <QCryptographicHash>
+
+
+class DeltaPatcher
+{
+public:
+    DeltaPatcher();
+    ~DeltaPatcher();
+
+    static quint32    weakChecksum(const char *data, int len);
+    static QByteArray signature(QString sBaseFile, int blockSize);
+
+    bool    start(QString sBaseFile, QString sOutFile, int blockSize, qint64 expectedSize);
+    bool    feed(const QByteArray &baData);
+    bool    isDone();
+    bool    finish();
+    void    abort();
+    qint64  bytesWritten();
+    QString errorString();
+
+    static const int  SIGNATURE_RECORD_SIZE = 4+16;/*!< \brief weak (BE) + MD5 */
+    static const char OP_COPY    = 'C';/*!< \brief 'C' + quint32 block index */
+    static const char OP_LITERAL = 'L';/*!< \brief 'L' + quint32 length + data */
+    static const char OP_END     = 'E';/*!< \brief 'E' + MD5 of the whole new file */
+
+private:
+    bool copyBlock(quint32 blockIndex);
+    bool writeOut(const char *data, qint64 len);
+    bool fail(QString sError);
+
+private:
+    QFile              baseFile;
+    QFile              outFile;
+    QCryptographicHash outHash;
+    int                iBlockSize;
+    qint64             expectedFileSize;
+    qint64             writtenBytes;
+    qint64             literalRemaining;
+    QByteArray         pending;
+    bool               bDone;
+    bool               bFailed;
+    QString            sErrorString;
+};
+
+#endif // DELTAPATCHER_H
@@ -20,10 +20,25 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <QtNetwork>
 #include <QTime>
 #include <QTimer>
+#include <QRandomGenerator>
 
 #include "utility.h"
+#include "transferscheduler.h"
+#include "mediacache.h"
+#include "peerserver.h"
+#include "multicastreceiver.h"
+#include "rawchannel.h"
 
 #define CHUNK_SIZE 512*1024
+#define DELTA_BLOCK_SIZE 64*1024
+#define DELTA_TIMEOUT    30000 // In msec: silence of the Server after a delta request
+
+#define MCAST_START_WAIT 3000 // In msec: time given to the Server to start multicasting
+#define MCAST_POLL_TIME  1000 // In msec
+#define MCAST_MAX_NACKS  3    // Then the missing ranges are asked by unicast
+
+#define RAW_PORT_OFFSET  100  // The raw transfer port is the File Server port + 100
+#define RAW_MAX_EMPTY_CHUNKS 2 // Then the chunks are asked on the WebSocket
 
 
 /*!
@@ -47,6 +62,97 @@ FileUpdater::FileUpdater(QString sName, QUrl myServerUrl, QFile *myLogFile, QObj
     pUpdateSocket = Q_NULLPTR;
     destinationDir = QString(".");
     bytesReceived = 0;
+    bDeltaMode = false;
+    bDeltaInProgress = false;
+    bDeltaHeaderReceived = false;
+    pDeltaTimer = new QTimer(this);
+    pDeltaTimer->setSingleShot(true);
+    pDeltaTimer->setInterval(DELTA_TIMEOUT);
+    connect(pDeltaTimer, SIGNAL(timeout()),
+            this, SLOT(onDeltaTimeout()));
+    pChunkTimer = new QTimer(this);
+    pChunkTimer->setSingleShot(true);
+    connect(pChunkTimer, SIGNAL(timeout()),
+            this, SLOT(onTimeToRequestChunk()));
+    pMulticastTimer = new QTimer(this);
+    pMulticastTimer->setSingleShot(true);
+    pMulticastTimer->setInterval(MCAST_POLL_TIME);
+    connect(pMulticastTimer, SIGNAL(timeout()),
+            this, SLOT(onTimeToCheckMulticast()));
+    pScheduler = Q_NULLPTR;
+    pCache = Q_NULLPTR;
+    pPeers = Q_NULLPTR;
+    pPeerSocket = Q_NULLPTR;
+    pDataSocket = Q_NULLPTR;
+    pMulticast = Q_NULLPTR;
+    bRepairInProgress = false;
+    bRepairHeaderPending = false;
+    repairOffset = 0;
+    pRaw = Q_NULLPTR;
+    bRawMode = false;
+    bRawTransfer = false;
+    emptyRawChunks = 0;
+    bOutOfSpace = false;
+    bBusy = false;
+    returnCode = TRANSFER_DONE;
+    bytesTotal = 0;
+    bytesCompleted = 0;
+    bytesTransferred = 0;
+}
+
+
+/*!
+ * \brief FileUpdater::setServerUrl Change the File Server to get the files from
+ * \param myServerUrl The Url of the File Server
+ *
+ * A connection to a different Server will be dropped and the running
+ * update (if any) ends with SERVER_DISCONNECTED
+ */
+void
+FileUpdater::setServerUrl(QUrl myServerUrl) {
+    if(myServerUrl == serverUrl)
+        return;
+    serverUrl = myServerUrl;
+    if(pRaw)
+        pRaw->close();
+    if(pUpdateSocket) {
+        pUpdateSocket->disconnect();
+        pUpdateSocket->abort();
+        pUpdateSocket->deleteLater();
+        pUpdateSocket = Q_NULLPTR;
+        pDataSocket = Q_NULLPTR;
+    }
+    // Last: the transferDone() receiver may start a new update at once
+    if(bBusy) {
+        sLastError = QString("Server changed");
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   sMyName +
+                   QString(" Server changed to %1 while updating")
+                   .arg(serverUrl.toString()));
+        closePeerSocket();
+        done(SERVER_DISCONNECTED);
+    }
+}
+
+
+/*!
+ * \brief FileUpdater::errorString
+ * \return A description of the last error occurred
+ */
+QString
+FileUpdater::errorString() {
+    return sLastError;
+}
+
+
+/*!
+ * \brief FileUpdater::isBusy
+ * \return true while an update is in progress
+ */
+bool
+FileUpdater::isBusy() {
+    return bBusy;
 }
 
 
@@ -80,12 +186,98 @@ FileUpdater::setDestination(QString myDstinationDir, QString sExtensions) {
 }
 
 
+/*!
+ * \brief FileUpdater::setDeltaMode Enable or disable the "delta" transfers
+ * \param bEnable true to transfer only the changed blocks of modified files
+ *
+ * When enabled the local copy of a file that changed on the Server is
+ * not removed but used as the base for a block level (rsync like)
+ * delta transfer. The Server must support the "delta" request.
+ */
+void
+FileUpdater::setDeltaMode(bool bEnable) {
+    bDeltaMode = bEnable;
+}
+
+
+/*!
+ * \brief FileUpdater::setScheduler Share the link with the other transfers
+ * \param pTransferScheduler The scheduler deciding when to request the chunks
+ */
+void
+FileUpdater::setScheduler(TransferScheduler *pTransferScheduler) {
+    pScheduler = pTransferScheduler;
+}
+
+
+/*!
+ * \brief FileUpdater::setCache Keep the files within a disk budget
+ * \param pMediaCache The cache of the media no more requested
+ */
+void
+FileUpdater::setCache(MediaCache *pMediaCache) {
+    pCache = pMediaCache;
+}
+
+
+/*!
+ * \brief FileUpdater::setPeerServer Pull the files from the other panels when possible
+ * \param pPeerServer The server knowing which peer holds which file
+ */
+void
+FileUpdater::setPeerServer(PeerServer *pPeerServer) {
+    pPeers = pPeerServer;
+}
+
+
+/*!
+ * \brief FileUpdater::setMulticastReceiver Receive the files multicast by the Server
+ * \param pReceiver The receiver of the multicast stream
+ */
+void
+FileUpdater::setMulticastReceiver(MulticastReceiver *pReceiver) {
+    pMulticast = pReceiver;
+}
+
+
+/*!
+ * \brief FileUpdater::setRawMode Receive the file data on a plain TCP connection
+ * \param bEnable true to use the raw channel when the Server offers it
+ */
+void
+FileUpdater::setRawMode(bool bEnable) {
+    bRawMode = bEnable;
+}
+
+
 /*!
  * \brief FileUpdater::startUpdate
- * Try to connect asynchronously to the File Server
+ * Start a new update, connecting asynchronously to the File Server
+ * if the connection is not already open.
+ * The end of the update is signalled by transferDone().
  */
 void
 FileUpdater::startUpdate() {
+    if(bBusy)
+        return;
+    bBusy = true;
+    bDeltaInProgress = false;
+    bRepairInProgress = false;
+    if(pUpdateSocket && pUpdateSocket->state() == QAbstractSocket::ConnectedState) {
+        // Reuse the connection
+        if(bRawMode && (!pRaw || !pRaw->isConnected()))
+            openRawChannel();
+        askFileList();
+        return;
+    }
+    if(pUpdateSocket) {
+        pUpdateSocket->disconnect();
+        pUpdateSocket->abort();
+        pUpdateSocket->deleteLater();
+        if(pDataSocket == pUpdateSocket)
+            pDataSocket = Q_NULLPTR;
+        pUpdateSocket = Q_NULLPTR;
+    }
 #ifdef LOG_VERBOSE
     logMessage(logFile,
                Q_FUNC_INFO,
@@ -94,7 +286,7 @@ FileUpdater::startUpdate() {
                .arg(serverUrl.toString()));
 #endif
     // Initialize the socket...
-    pUpdateSocket = new QWebSocket();
+    pUpdateSocket = new QWebSocket(QString(), QWebSocketProtocol::VersionLatest, this);
     // And connect its various signals with the local slots
     connect(pUpdateSocket, SIGNAL(connected()),
             this, SLOT(onUpdateSocketConnected()));
@@ -113,6 +305,39 @@ FileUpdater::startUpdate() {
 }
 
 
+/*!
+ * \brief FileUpdater::stopUpdate
+ * Silently abort the running update (if any) and close the connection
+ */
+void
+FileUpdater::stopUpdate() {
+    bBusy = false;
+    bRepairInProgress = false;
+    if(file.isOpen())
+        file.close();
+    pDeltaTimer->stop();
+    pChunkTimer->stop();
+    pMulticastTimer->stop();
+    if(bDeltaInProgress) {
+        deltaPatcher.abort();
+        bDeltaInProgress = false;
+    }
+    if(pScheduler)
+        pScheduler->clearPending(sMyName);
+    bRawTransfer = false;
+    if(pRaw)
+        pRaw->close();
+    closePeerSocket();
+    if(pUpdateSocket) {
+        pUpdateSocket->disconnect();
+        pUpdateSocket->abort();
+        pUpdateSocket->deleteLater();
+        pUpdateSocket = Q_NULLPTR;
+        pDataSocket = Q_NULLPTR;
+    }
+}
+
+
 /*!
  * \brief FileUpdater::onUpdateSocketConnected
  * Invoked asynchronously when the server socket connects
@@ -128,6 +353,8 @@ FileUpdater::onUpdateSocketConnected() {
                QString(" Connected to: %1")
                .arg(pUpdateSocket->peerAddress().toString()));
 #endif
+    if(bRawMode)
+        openRawChannel();
     // Query the file's list
     askFileList();
 }
@@ -148,8 +375,7 @@ FileUpdater::askFileList() {
                        Q_FUNC_INFO,
                        sMyName +
                        QString(" Unable to ask for file list"));
-            returnCode = ERROR_SOCKET;
-            thread()->exit(returnCode);
+            done(ERROR_SOCKET);
             return;
         }
 #ifdef LOG_MESG
@@ -170,17 +396,19 @@ FileUpdater::askFileList() {
  * \brief FileUpdater::onServerDisconnected
  * Invoked asynchronously whe the server disconnects
  *
- * Stop the running Thread with SERVER_DISCONNECTED return code
+ * Ends the running update (if any) with SERVER_DISCONNECTED return code
  */
 void
 FileUpdater::onServerDisconnected() {
+    if(!bBusy)// An idle connection has been closed: no harm
+        return;
+    sLastError = QString("Server disconnected");
     logMessage(logFile,
                Q_FUNC_INFO,
                sMyName +
                QString(" WebSocket disconnected from: %1")
                .arg(pUpdateSocket->peerAddress().toString()));
-    returnCode = SERVER_DISCONNECTED;
-    thread()->exit(returnCode);
+    done(SERVER_DISCONNECTED);
 }
 
 
@@ -189,10 +417,13 @@ FileUpdater::onServerDisconnected() {
  * File transfer error handler
  * \param error The socket error
  *
- * It stops the Thread with SOCKET_ERROR return code
+ * It ends the running update (if any) with SOCKET_ERROR return code
  */
 void
 FileUpdater::onUpdateSocketError(QAbstractSocket::SocketError error) {
+    if(!bBusy)
+        return;
+    sLastError = pUpdateSocket->errorString();
     logMessage(logFile,
                Q_FUNC_INFO,
                sMyName +
@@ -200,8 +431,7 @@ FileUpdater::onUpdateSocketError(QAbstractSocket::SocketError error) {
                .arg(pUpdateSocket->localAddress().toString())
                .arg(pUpdateSocket->errorString())
                .arg(error));
-    returnCode = ERROR_SOCKET;
-    thread()->exit(returnCode);
+    done(ERROR_SOCKET);
 }
 
 
@@ -213,15 +443,26 @@ FileUpdater::onUpdateSocketError(QAbstractSocket::SocketError error) {
  */
 void
 FileUpdater::onProcessBinaryFrame(QByteArray baMessage, bool isLastFrame) {
-    QString sMessage;
+    if(!bBusy)// Late frames of an aborted update
+        return;
     // Check if the file transfer must be stopped
     if(thread()->isInterruptionRequested()) {
         logMessage(logFile,
                    Q_FUNC_INFO,
                    sMyName +
                    QString(" Received an Exit Request"));
-        returnCode = TRANSFER_DONE;
-        thread()->exit(returnCode);
+        done(TRANSFER_DONE);
+        return;
+    }
+    if(pScheduler)
+        pScheduler->consume(baMessage.size());
+    bytesTransferred += baMessage.size();
+    if(bRepairInProgress) {
+        processRepairFrame(baMessage, isLastFrame);
+        return;
+    }
+    if(bDeltaInProgress) {
+        processDeltaFrame(baMessage, isLastFrame);
         return;
     }
     if(bytesReceived == 0) {// It's a new file...
@@ -288,96 +529,245 @@ FileUpdater::onProcessBinaryFrame(QByteArray baMessage, bool isLastFrame) {
                sMyName +
                QString(" Received %1 bytes").arg(bytesReceived));
 #endif
+    reportProgress();
     if(isLastFrame) {
         if(bytesReceived < queryList.last().fileSize) {// File length mismatch !!!!
-            sMessage = QString("<get>%1,%2,%3</get>")
-                       .arg(queryList.last().fileName)
-                       .arg(bytesReceived)
-                       .arg(CHUNK_SIZE);
-            qint64 written = pUpdateSocket->sendTextMessage(sMessage);
-            if(written != sMessage.length()) {
-                logMessage(logFile,
-                           Q_FUNC_INFO,
-                           sMyName +
-                           QString(" Error writing %1").arg(sMessage));
-                returnCode = ERROR_SOCKET;
-                thread()->exit(returnCode);
-                return;
-            }
-#ifdef LOG_VERBOSE
-            else {
-                logMessage(logFile,
-                           Q_FUNC_INFO,
-                           sMyName +
-                           QString(" Sent %1 to: %2")
-                           .arg(sMessage)
-                           .arg(pUpdateSocket->peerAddress().toString()));
-            }
-#endif
+            requestNextChunk();
         }// if(File length Mismatch !!!!)
+        else if(bytesReceived > queryList.last().fileSize) {
+            file.close();
+            oversizedFile();
+        }
         else {// OK: File length Match
             file.close();
+            if(!checkPeerData())
+                return;
             QDir renamed;// Remove the .temp exstension
             renamed.rename(destinationDir + sCurrentFileName + QString(".temp"),
                            destinationDir + sCurrentFileName);
             // Go to transfer the next file (if any)
-            queryList.removeLast();
-            if(!queryList.isEmpty()) {
-                bytesReceived = 0;
-                QFile tempFile;
-                sCurrentFileName = destinationDir + queryList.last().fileName;
-                tempFile.setFileName(sCurrentFileName + QString(".temp"));
-                if(tempFile.exists()) {
-                    bytesReceived = tempFile.size();
-                    file.setFileName(sCurrentFileName + QString(".temp"));
-                    if(!file.open(QIODevice::Append)) {
-                        logMessage(logFile,
-                                   Q_FUNC_INFO,
-                                   sMyName +
-                                   QString(" Unable to open file: %1")
-                                   .arg(sCurrentFileName + QString(".temp")));
-                        handleOpenFileError();
-                        return;
-                    }
-                }
-                QString sMessage = QString("<get>%1,%2,%3</get>")
-                                   .arg(queryList.last().fileName)
-                                   .arg(bytesReceived)
-                                   .arg(CHUNK_SIZE);
-                qint64 written = pUpdateSocket->sendTextMessage(sMessage);
-                if(written != sMessage.length()) {
-                    logMessage(logFile,
-                               Q_FUNC_INFO,
-                               sMyName +
-                               QString(" Error writing %1").arg(sMessage));
-                    returnCode = ERROR_SOCKET;
-                    thread()->exit(returnCode);
-                    return;
-                }
+            completeCurrentFile();
+        }
+    }
+}
+
+
+/*!
+ * \brief FileUpdater::processDeltaFrame
+ * Handle the chunks of information of a delta transfer
+ * \param baMessage [in] the chunk of information
+ * \param isLastFrame [in] is this the last chunk ?
+ *
+ * The old copy of the file is replaced only when the new one has been
+ * completely rebuilt and verified. On failure the whole file is requested.
+ * The delta may span several messages: it ends with its OP_END.
+ */
+void
+FileUpdater::processDeltaFrame(QByteArray baMessage, bool isLastFrame) {
+    pDeltaTimer->start();// The Server is answering
+    if(!bDeltaHeaderReceived) {// Same header of a full transfer
+        QByteArray header = baMessage.left(1024);
+        int iSeparator = header.indexOf(",");
+        header = header.mid(iSeparator+1);
+        iSeparator = header.indexOf('\0');
+        qint64 newSize = header.left(iSeparator).toLongLong();
+        baMessage = baMessage.mid(1024);
+        bDeltaHeaderReceived = true;
+        if(!deltaPatcher.start(destinationDir + sCurrentFileName,
+                               destinationDir + sCurrentFileName + QString(".delta"),
+                               DELTA_BLOCK_SIZE,
+                               newSize))
+        {
+            logMessage(logFile,
+                       Q_FUNC_INFO,
+                       sMyName +
+                       QString(" %1").arg(deltaPatcher.errorString()));
+        }
+    }
+    // After an error the remaining frames are simply discarded
+    bool bOk = deltaPatcher.feed(baMessage);
+    // The progress is about the new file: the delta stream size
+    // counts only in bytesTransferred (the throughput)
+    bytesReceived = deltaPatcher.bytesWritten();
+    reportProgress();
+    if(bOk && !deltaPatcher.isDone())
+        return;// More to come (maybe in the next messages)
+    if(!bOk && !isLastFrame)
+        return;// Skip the rest of the message
+
+    pDeltaTimer->stop();
+    bDeltaInProgress = false;
+    if(deltaPatcher.finish()) {
+        QString sFileName = destinationDir + sCurrentFileName;
+        QFile::remove(sFileName);
+        if(!QFile::rename(sFileName + QString(".delta"), sFileName)) {
+            file.setFileName(sFileName);
+            handleWriteFileError();
+            return;
+        }
 #ifdef LOG_VERBOSE
-                else {
-                    logMessage(logFile,
-                               Q_FUNC_INFO,
-                               sMyName +
-                               QString(" Sent %1 to: %2")
-                               .arg(sMessage)
-                               .arg(pUpdateSocket->peerAddress().toString()));
-                }
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   sMyName +
+                   QString(" %1 patched: %2 bytes written")
+                   .arg(sCurrentFileName)
+                   .arg(deltaPatcher.bytesWritten()));
 #endif
-            }
-            else {
+        completeCurrentFile();
+    }
+    else {
+        abandonDelta(deltaPatcher.errorString());
+    }
+}
+
+
+/*!
+ * \brief FileUpdater::abandonDelta Ask the whole current file instead of its delta
+ * \param sReason Why the delta transfer failed
+ */
+void
+FileUpdater::abandonDelta(QString sReason) {
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               sMyName +
+               QString(" Delta transfer of %1 failed (%2): asking the whole file")
+               .arg(sCurrentFileName)
+               .arg(sReason));
+    pDeltaTimer->stop();
+    bDeltaInProgress = false;
+    deltaPatcher.abort();
+    QFile::remove(destinationDir + sCurrentFileName + QString(".delta"));
+    deltaFailedList.append(sCurrentFileName);
+    askNextFile();
+}
+
+
+/*!
+ * \brief FileUpdater::onDeltaTimeout
+ * The Server did not answer (or stopped answering) a delta request
+ */
+void
+FileUpdater::onDeltaTimeout() {
+    if(!bBusy || !bDeltaInProgress)
+        return;
+    abandonDelta(QString("no answer from the Server"));
+}
+
+
+/*!
+ * \brief FileUpdater::completeCurrentFile
+ * The current file is done: go to transfer the next one (if any)
+ */
+void
+FileUpdater::completeCurrentFile() {
+    completeFile(queryList.count()-1);
+    bytesReceived = 0;
+    reportProgress();
+    if(!queryList.isEmpty()) {
+        askNextFile();
+    }
+    else {
 #ifdef LOG_VERBOSE
-                logMessage(logFile,
-                           Q_FUNC_INFO,
-                           sMyName +
-                           QString(" No more file to transfer"));
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   sMyName +
+                   QString(" No more file to transfer"));
 #endif
-                returnCode = TRANSFER_DONE;
-                thread()->exit(returnCode);
-                return;
-            }
-        }
+        done(TRANSFER_DONE);
+    }
+}
+
+
+/*!
+ * \brief FileUpdater::completeFile Take a file, now complete on disk, off the queue
+ * \param iFile The index of the file in queryList
+ *
+ * Whichever way the file arrived (Server, peer or multicast)
+ * it is announced and can be shared with the peers.
+ */
+void
+FileUpdater::completeFile(int iFile) {
+    emit fileReady(destinationDir + queryList.at(iFile).fileName);
+    if(pPeers)// Now we can share it
+        pPeers->contentChanged();
+    bytesCompleted += queryList.at(iFile).fileSize;
+    queryList.removeAt(iFile);
+}
+
+
+/*!
+ * \brief FileUpdater::reserveSpace Make room on the disk for the current file
+ * \return false if the file can't fit in the disk budget
+ */
+bool
+FileUpdater::reserveSpace() {
+    if(!pCache)
+        return true;
+    qint64 needed = queryList.last().fileSize;
+    QFileInfo tempFile(destinationDir + sCurrentFileName + QString(".temp"));
+    if(tempFile.exists())
+        needed -= tempFile.size();
+    return pCache->makeRoom(needed);
+}
+
+
+/*!
+ * \brief FileUpdater::skipCurrentFile
+ * The current file doesn't fit on the disk: go on with the others
+ * (the smaller ones could fit) and report the problem at the end.
+ */
+void
+FileUpdater::skipCurrentFile() {
+    bOutOfSpace = true;
+    sLastError = QString("No room for %1").arg(sCurrentFileName);
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               sMyName +
+               QString(" Not enough disk space for %1 (%2 bytes)")
+               .arg(sCurrentFileName)
+               .arg(queryList.last().fileSize));
+    bytesTotal -= queryList.last().fileSize;
+    queryList.removeLast();
+    reportProgress();
+    if(!queryList.isEmpty())
+        askNextFile();
+    else
+        done(TRANSFER_DONE);
+}
+
+
+/*!
+ * \brief FileUpdater::dropCurrentFile
+ * The Server can't send the current file (e.g. it has been removed after
+ * sending the file list): forget it and go on with the others.
+ */
+void
+FileUpdater::dropCurrentFile() {
+    sLastError = QString("%1 not available").arg(sCurrentFileName);
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               sMyName +
+               QString(" The Server can't send %1").arg(sCurrentFileName));
+    pChunkTimer->stop();
+    pDeltaTimer->stop();
+    if(bDeltaInProgress) {
+        deltaPatcher.abort();
+        bDeltaInProgress = false;
+        QFile::remove(destinationDir + sCurrentFileName + QString(".delta"));
     }
+    bRawTransfer = false;
+    if(pRaw)
+        pRaw->closeTarget();
+    if(file.isOpen())
+        file.close();
+    QFile::remove(destinationDir + sCurrentFileName + QString(".temp"));
+    bytesTotal -= queryList.last().fileSize;
+    queryList.removeLast();
+    reportProgress();
+    if(!queryList.isEmpty())
+        askNextFile();
+    else
+        done(TRANSFER_DONE);
 }
 
 
@@ -386,13 +776,15 @@ FileUpdater::onProcessBinaryFrame(QByteArray baMessage, bool isLastFrame) {
  */
 void
 FileUpdater::handleWriteFileError() {
+    bool bDiskFull = (file.error() == QFileDevice::ResourceError);
     file.close();
+    sLastError = QString("Error writing %1").arg(QFileInfo(file.fileName()).fileName());
     logMessage(logFile,
                Q_FUNC_INFO,
                QString("Error writing File: %1")
                .arg(file.fileName()));
-    returnCode = FILE_ERROR;
-    thread()->exit(returnCode);
+    // A full disk is not a permanent failure: the update will be retried
+    done(bDiskFull ? DISK_FULL : FILE_ERROR);
 }
 
 
@@ -401,12 +793,12 @@ FileUpdater::handleWriteFileError() {
  */
 void
 FileUpdater::handleOpenFileError() {
+    sLastError = QString("Error opening %1").arg(QFileInfo(file.fileName()).fileName());
     logMessage(logFile,
                Q_FUNC_INFO,
                QString("Error Opening File: %1")
                .arg(file.fileName()));
-    returnCode = FILE_ERROR;
-    thread()->exit(returnCode);
+    done(FILE_ERROR);
 }
 
 
@@ -415,12 +807,28 @@ FileUpdater::handleOpenFileError() {
  * Asynchronously handle the text messages
  * \param sMessage
  *
- * The only message handled is the one conatining the list of files to transfer
+ * The messages handled are the one conatining the list of files to transfer,
+ * the refusal of a delta request (<delta_refused>file name</delta_refused>)
+ * and the files the Server can't send (<file_error>file name</file_error>)
  */
 void
 FileUpdater::onProcessTextMessage(QString sMessage) {
+    if(!bBusy)
+        return;
     QString sToken;
     QString sNoData = QString("NoData");
+    sToken = XML_Parse(sMessage, "delta_refused");
+    if(sToken != sNoData) {// The Server can't (or won't) send the delta
+        if(bDeltaInProgress && sToken == sCurrentFileName)
+            abandonDelta(QString("refused by the Server"));
+        return;
+    }
+    sToken = XML_Parse(sMessage, "file_error");
+    if(sToken != sNoData) {// The file is not available (anymore)
+        if(!queryList.isEmpty() && sToken == sCurrentFileName)
+            dropCurrentFile();
+        return;
+    }
     sToken = XML_Parse(sMessage, "file_list");
 #ifdef LOG_VERBOSE
     logMessage(logFile,
@@ -439,6 +847,8 @@ FileUpdater::onProcessTextMessage(QString sMessage) {
                 files newFile;
                 newFile.fileName = tmpList.at(0);
                 newFile.fileSize = tmpList.at(1).toLong();
+                if(tmpList.count() > 2)// The digest too (needed to accept the file from a peer)
+                    newFile.fileDigest = tmpList.at(2);
                 remoteFileList.append(newFile);
             }
         }
@@ -451,8 +861,7 @@ FileUpdater::onProcessTextMessage(QString sMessage) {
                    sMyName +
                    QString(" Nessun file da trasferire"));
 #endif
-        returnCode = TRANSFER_DONE;
-        thread()->exit(returnCode);
+        done(TRANSFER_DONE);
     }
 }
 
@@ -464,6 +873,18 @@ FileUpdater::onProcessTextMessage(QString sMessage) {
 void
 FileUpdater::updateFiles() {
     bool bFound;
+    bOutOfSpace = false;
+    if(pCache) {// Bring back the cached files listed again by the Server
+        qint64 manifestSize = 0;
+        for(int i=0; i<remoteFileList.count(); i++) {
+            manifestSize += remoteFileList.at(i).fileSize;
+            if(!QFile::exists(destinationDir + remoteFileList.at(i).fileName))
+                pCache->restore(sMyName,
+                                remoteFileList.at(i).fileName,
+                                remoteFileList.at(i).fileSize);
+        }
+        pCache->setManifestSize(sMyName, manifestSize);
+    }
     QDir fileDir(destinationDir);
     QFileInfoList localFileInfoList = QFileInfoList();
     if(fileDir.exists()) {// Get the list of the spots already present
@@ -506,9 +927,18 @@ FileUpdater::updateFiles() {
                 bFound = true;
                 break;
             }
+            // Keep the old copy of a modified file as the delta base
+            if(bDeltaMode &&
+               remoteFileList.at(i).fileName == localFileInfoList.at(j).fileName()) {
+                bFound = true;
+                break;
+            }
         }
         if(!bFound) {
-            QFile::remove(localFileInfoList.at(j).absoluteFilePath());
+            // Keep the complete files in the cache: they could be listed again
+            if(!pCache || localFileInfoList.at(j).suffix() == QString("temp") ||
+               !pCache->retire(sMyName, localFileInfoList.at(j).fileName()))
+                QFile::remove(localFileInfoList.at(j).absoluteFilePath());
 #ifdef LOG_VERBOSE
             logMessage(logFile,
                        Q_FUNC_INFO,
@@ -516,6 +946,31 @@ FileUpdater::updateFiles() {
 #endif
         }
     }
+    bytesTotal = 0;
+    bytesCompleted = 0;
+    for(int i=0; i<queryList.count(); i++)
+        bytesTotal += queryList.at(i).fileSize;
+    reportProgress();
+    if(pScheduler) {
+        QStringList fileNames;
+        for(int i=0; i<remoteFileList.count(); i++)
+            fileNames.append(remoteFileList.at(i).fileName);
+        pScheduler->setManifest(sMyName, fileNames);
+    }
+    if(pPeers)
+        pPeers->setManifest(sMyName, remoteFileList);
+    if(pMulticast) {
+        pMulticast->setWanted(sMyName, queryList);
+        nackMap.clear();
+        multicastClock.start();
+    }
+    if(pCache && pCache->isBudgetTooSmall()) {
+        sLastError = QString("Disk budget too small for the manifest (%1 MB needed)")
+                     .arg(pCache->manifestSize()/(1024*1024));
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   sMyName + QString(" ") + sLastError);
+    }
     if(queryList.isEmpty()) {
 #ifdef LOG_VERBOSE
         logMessage(logFile,
@@ -523,25 +978,47 @@ FileUpdater::updateFiles() {
                    sMyName +
                    QString(" All files are up to date !"));
 #endif
-        returnCode = TRANSFER_DONE;
-        thread()->exit(returnCode);
+        done(TRANSFER_DONE);
         return;
     }
     else {
-        askFirstFile();
+        askNextFile();
     }
 }
 
 
 /*!
- * \brief FileUpdater::askFirstFile
- * Utility function for asking the Server to start updating the files
+ * \brief FileUpdater::askNextFile
+ * Utility function for asking the Server the next file to update
  */
 void
-FileUpdater::askFirstFile() {
+FileUpdater::askNextFile() {
     bytesReceived = 0;
-    QFile tempFile;
+    emptyRawChunks = 0;
+    sortQueryList();
     sCurrentFileName = queryList.last().fileName;
+    if(!reserveSpace()) {
+        skipCurrentFile();
+        return;
+    }
+    if(pMulticast && waitMulticast())// The file is (or will be) multicast
+        return;
+    if(pPeers && askPeer())// The file will be pulled from a peer
+        return;
+    pDataSocket = pUpdateSocket;
+    if(!QFile::exists(destinationDir + sCurrentFileName + QString(".temp")) && askDelta())
+        return;
+    startFileTransfer();
+}
+
+
+/*!
+ * \brief FileUpdater::startFileTransfer
+ * Start (or resume) the chunked transfer of the current file
+ */
+void
+FileUpdater::startFileTransfer() {
+    QFile tempFile;
     tempFile.setFileName(destinationDir + sCurrentFileName + QString(".temp"));
     if(tempFile.exists()) {
         bytesReceived = tempFile.size();
@@ -556,18 +1033,49 @@ FileUpdater::askFirstFile() {
             return;
         }
     }
+    if(pDataSocket && pDataSocket == pPeerSocket)
+        sPeerFile = sCurrentFileName;
+    requestNextChunk();
+}
+
+
+/*!
+ * \brief FileUpdater::requestNextChunk
+ * Ask the next chunk of the current file, as soon as the scheduler allows it
+ */
+void
+FileUpdater::requestNextChunk() {
+    int delay = 0;
+    if(pScheduler)
+        delay = pScheduler->delayBeforeRequest(sMyName);
+    if(delay > 0) {
+        pChunkTimer->start(delay);
+        return;
+    }
+    int chunkSize = CHUNK_SIZE;
+    if(pScheduler)
+        chunkSize = pScheduler->chunkSize(CHUNK_SIZE);
+    if(requestRawChunk(chunkSize))
+        return;
+    if(!pDataSocket) {// The connection has been replaced meanwhile
+        sLastError = QString("Connection lost");
+        done(ERROR_SOCKET);
+        return;
+    }
     QString sMessage = QString("<get>%1,%2,%3</get>")
                            .arg(sCurrentFileName)
                            .arg(bytesReceived)
-                           .arg(CHUNK_SIZE);
-    qint64 written = pUpdateSocket->sendTextMessage(sMessage);
+                           .arg(chunkSize);
+    qint64 written = pDataSocket->sendTextMessage(sMessage);
     if(written != sMessage.length()) {
         logMessage(logFile,
                    Q_FUNC_INFO,
                    sMyName +
                    QString(" Error writing %1").arg(sMessage));
-        returnCode = ERROR_SOCKET;
-        thread()->exit(returnCode);
+        if(pDataSocket == pPeerSocket)
+            peerFailed();
+        else
+            done(ERROR_SOCKET);
         return;
     }
 #ifdef LOG_VERBOSE
@@ -577,7 +1085,658 @@ FileUpdater::askFirstFile() {
                    sMyName +
                    QString(" Sent %1 to: %2")
                    .arg(sMessage)
-                   .arg(pUpdateSocket->peerAddress().toString()));
+                   .arg(pDataSocket->peerAddress().toString()));
+    }
+#endif
+}
+
+
+/*!
+ * \brief FileUpdater::onTimeToRequestChunk
+ * Invoked when the delay imposed by the scheduler is elapsed
+ */
+void
+FileUpdater::onTimeToRequestChunk() {
+    if(!bBusy)// The update has been ended meanwhile
+        return;
+    if(thread()->isInterruptionRequested()) {
+        done(TRANSFER_DONE);
+        return;
+    }
+    if(bRepairInProgress)
+        requestRepairChunk();
+    else
+        requestNextChunk();
+}
+
+
+/*!
+ * \brief FileUpdater::sortQueryList
+ * Move the most urgent file (as judged by the scheduler) at the end of the list
+ */
+void
+FileUpdater::sortQueryList() {
+    if((!pScheduler && !pPeers) || queryList.isEmpty())
+        return;
+    int iMostUrgent = queryList.count()-1;
+    quint64 minKey = transferKey(queryList.last());
+    for(int i=0; i<queryList.count()-1; i++) {
+        quint64 key = transferKey(queryList.at(i));
+        if(key < minKey) {
+            minKey = key;
+            iMostUrgent = i;
+        }
+    }
+    queryList.move(iMostUrgent, queryList.count()-1);
+    if(pScheduler)
+        pScheduler->setPendingKey(sMyName, minKey);
+}
+
+
+/*!
+ * \brief FileUpdater::transferKey
+ * \return The key of a file: the lower the key, the sooner it is transferred
+ *
+ * The files that will be shown soon come first (see TransferScheduler::priorityKey()).
+ * When sharing with the peers, the other files held by a peer are preferred;
+ * those held by nobody are taken in a different random order by each
+ * panel: each one pulls different files from the Server and then
+ * shares them, so that the Server sends each file about once.
+ */
+quint64
+FileUpdater::transferKey(const files &file) {
+    quint64 key = quint64(file.fileSize);
+    if(pScheduler)
+        key = pScheduler->priorityKey(sMyName, file.fileName, file.fileSize);
+    if(!pPeers || (key >> 48) < TransferScheduler::LOOKAHEAD)
+        return key;
+    quint64 spread = 0;
+    if(pPeers->holders(sMyName, file.fileName, file.fileSize).isEmpty())
+        spread = 1 + ((qHash(file.fileName) ^ pPeers->seed()) & 0x7fff);
+    quint64 size = quint64(qBound(qint64(0), file.fileSize, qint64(0xffffffff)));
+    return (key & (quint64(0xffff) << 48)) | (spread << 32) | size;
+}
+
+
+/*!
+ * \brief FileUpdater::askPeer
+ * Pull the current file from the nearest peer holding it (if any)
+ * \return true if a peer will send the file
+ */
+bool
+FileUpdater::askPeer() {
+    if(queryList.last().fileDigest.isEmpty())// We could not verify it
+        return false;
+    QList<QUrl> holders = pPeers->holders(sMyName,
+                                          sCurrentFileName,
+                                          queryList.last().fileSize);
+    if(holders.isEmpty())
+        return false;
+    if(pPeerSocket && peerUrl == holders.first() &&
+       pPeerSocket->state() == QAbstractSocket::ConnectedState)
+    {
+        pDataSocket = pPeerSocket;
+        startFileTransfer();
+        return true;
+    }
+    closePeerSocket();
+    peerUrl = holders.first();
+#ifdef LOG_VERBOSE
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               sMyName +
+               QString(" Asking %1 to %2")
+               .arg(sCurrentFileName)
+               .arg(peerUrl.toString()));
+#endif
+    pPeerSocket = new QWebSocket(QString(), QWebSocketProtocol::VersionLatest, this);
+    connect(pPeerSocket, SIGNAL(connected()),
+            this, SLOT(onPeerConnected()));
+    connect(pPeerSocket, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SLOT(onPeerError(QAbstractSocket::SocketError)));
+    connect(pPeerSocket, SIGNAL(binaryFrameReceived(QByteArray, bool)),
+            this,SLOT(onProcessBinaryFrame(QByteArray, bool)));
+    connect(pPeerSocket, SIGNAL(disconnected()),
+            this, SLOT(onPeerDisconnected()));
+    pPeerSocket->ignoreSslErrors();
+    peerClock.start();
+    pPeerSocket->open(peerUrl);
+    return true;
+}
+
+
+/*!
+ * \brief FileUpdater::onPeerConnected
+ * Invoked asynchronously when the peer accepts the connection
+ */
+void
+FileUpdater::onPeerConnected() {
+    if(!bBusy || sender() != pPeerSocket)
+        return;
+    pPeers->reportRtt(peerUrl, int(peerClock.elapsed()));
+    pDataSocket = pPeerSocket;
+    startFileTransfer();
+}
+
+
+/*!
+ * \brief FileUpdater::onPeerDisconnected
+ * The peer closed the connection (it can't serve the file anymore)
+ */
+void
+FileUpdater::onPeerDisconnected() {
+    if(sender() != pPeerSocket)
+        return;
+    if(!bBusy) {// An idle connection: simply drop it
+        closePeerSocket();
+        return;
+    }
+    peerFailed();
+}
+
+
+/*!
+ * \brief FileUpdater::onPeerError
+ * \param error The socket error
+ */
+void
+FileUpdater::onPeerError(QAbstractSocket::SocketError error) {
+    Q_UNUSED(error)
+    if(!bBusy || sender() != pPeerSocket)
+        return;
+    peerFailed();
+}
+
+
+/*!
+ * \brief FileUpdater::peerFailed
+ * Turn to another peer or to the Server, resuming the partial file
+ */
+void
+FileUpdater::peerFailed() {
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               sMyName +
+               QString(" Peer %1 failed sending %2: %3")
+               .arg(peerUrl.toString())
+               .arg(sCurrentFileName)
+               .arg(pPeerSocket ? pPeerSocket->errorString() : QString()));
+    pPeers->reportFailure(peerUrl);
+    if(file.isOpen())
+        file.close();
+    closePeerSocket();
+    pDataSocket = pUpdateSocket;
+    askNextFile();
+}
+
+
+/*!
+ * \brief FileUpdater::checkPeerData
+ * Verify a file received (even in part) from a peer against the manifest digest
+ * \return true if the file can be renamed, false if it has been asked again
+ *
+ * A mismatch is a failure of the peer: the file is discarded and asked
+ * to another peer (if any) or to the Server.
+ */
+bool
+FileUpdater::checkPeerData() {
+    if(sPeerFile != sCurrentFileName)
+        return true;
+    sPeerFile.clear();
+    QString sTempName = destinationDir + sCurrentFileName + QString(".temp");
+    if(fileMd5(sTempName) == queryList.last().fileDigest)
+        return true;
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               sMyName +
+               QString(" %1 received from %2 doesn't match its digest")
+               .arg(sCurrentFileName)
+               .arg(peerUrl.toString()));
+    pPeers->reportFailure(peerUrl);
+    QFile::remove(sTempName);
+    closePeerSocket();
+    pDataSocket = pUpdateSocket;
+    bytesReceived = 0;
+    reportProgress();
+    askNextFile();
+    return false;
+}
+
+
+/*!
+ * \brief FileUpdater::oversizedFile
+ * More data than the listed size have been received: the file is discarded.
+ * A peer is not used anymore, the Server file will be asked at the next update.
+ */
+void
+FileUpdater::oversizedFile() {
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               sMyName +
+               QString(" Received %1 bytes of %2 (%3 bytes long)")
+               .arg(bytesReceived)
+               .arg(sCurrentFileName)
+               .arg(queryList.last().fileSize));
+    if(pDataSocket && pDataSocket == pPeerSocket) {
+        QFile::remove(destinationDir + sCurrentFileName + QString(".temp"));
+        sPeerFile.clear();
+        bytesReceived = 0;
+        peerFailed();
+        return;
+    }
+    dropCurrentFile();
+}
+
+
+/*!
+ * \brief FileUpdater::closePeerSocket
+ */
+void
+FileUpdater::closePeerSocket() {
+    if(!pPeerSocket)
+        return;
+    if(pDataSocket == pPeerSocket)
+        pDataSocket = pUpdateSocket;
+    pPeerSocket->disconnect();
+    pPeerSocket->abort();
+    pPeerSocket->deleteLater();
+    pPeerSocket = Q_NULLPTR;
+}
+
+
+/*!
+ * \brief FileUpdater::waitMulticast
+ * Decide if the current file has to be received from the multicast stream
+ * \return true if the file is (or will be) received by multicast
+ *
+ * While the Server is multicasting, the unicast requests are suspended.
+ * When the stream stops the missing ranges of a partially received file
+ * are asked again to the Server: MCAST_MAX_NACKS times by multicast,
+ * then by unicast. Files never seen on the stream are asked as usual.
+ * The Server is given MCAST_START_WAIT to start streaming only if it
+ * has already been seen doing so.
+ */
+bool
+FileUpdater::waitMulticast() {
+    if(pMulticast->isActive(sMyName) ||
+       (pMulticast->hasStreamed(sMyName) && multicastClock.elapsed() < MCAST_START_WAIT))
+    {
+        pMulticastTimer->start();
+        return true;
+    }
+    if(!pMulticast->hasPartial(sMyName, sCurrentFileName))
+        return false;
+    int nacks = nackMap.value(sCurrentFileName, 0);
+    if(nacks < MCAST_MAX_NACKS && pMulticast->sendNack(sMyName, sCurrentFileName)) {
+        nackMap.insert(sCurrentFileName, nacks+1);
+        multicastClock.start();// Give the Server the time to answer
+        pMulticastTimer->start();
+        return true;
+    }
+#ifdef LOG_VERBOSE
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               sMyName +
+               QString(" Repairing %1 by unicast").arg(sCurrentFileName));
+#endif
+    bRepairInProgress = true;
+    pDataSocket = pUpdateSocket;
+    requestRepairChunk();
+    return true;
+}
+
+
+/*!
+ * \brief FileUpdater::onTimeToCheckMulticast
+ * Drop the files received meanwhile and go on with the others
+ */
+void
+FileUpdater::onTimeToCheckMulticast() {
+    if(!bBusy || bRepairInProgress)
+        return;
+    if(thread()->isInterruptionRequested()) {
+        done(TRANSFER_DONE);
+        return;
+    }
+    for(int i=queryList.count()-1; i>=0; i--) {
+        QFileInfo fileInfo(destinationDir + queryList.at(i).fileName);
+        if(fileInfo.exists() && fileInfo.size() == queryList.at(i).fileSize)
+            completeFile(i);
+    }
+    bytesReceived = pMulticast->bytesReceived(sMyName);
+    reportProgress();
+    if(queryList.isEmpty()) {
+        done(TRANSFER_DONE);
+        return;
+    }
+    askNextFile();
+}
+
+
+/*!
+ * \brief FileUpdater::requestRepairChunk
+ * Ask by unicast the next missing range of a file partially received by multicast
+ */
+void
+FileUpdater::requestRepairChunk() {
+    if(!pMulticast->hasPartial(sMyName, sCurrentFileName)) {
+        bRepairInProgress = false;
+        QFileInfo fileInfo(destinationDir + sCurrentFileName);
+        if(fileInfo.exists() && fileInfo.size() == queryList.last().fileSize)
+            completeCurrentFile();
+        else
+            startFileTransfer();
+        return;
+    }
+    int delay = 0;
+    if(pScheduler)
+        delay = pScheduler->delayBeforeRequest(sMyName);
+    if(delay > 0) {
+        pChunkTimer->start(delay);
+        return;
+    }
+    int chunkSize = CHUNK_SIZE;
+    if(pScheduler)
+        chunkSize = pScheduler->chunkSize(CHUNK_SIZE);
+    fileRange range = pMulticast->missingRanges(sMyName, sCurrentFileName).first();
+    repairOffset = range.first;
+    bRepairHeaderPending = (repairOffset == 0);// The Server sends the header with the first chunk
+    QString sMessage = QString("<get>%1,%2,%3</get>")
+                           .arg(sCurrentFileName)
+                           .arg(repairOffset)
+                           .arg(qMin(qint64(chunkSize), range.second));
+    qint64 written = pUpdateSocket->sendTextMessage(sMessage);
+    if(written != sMessage.length()) {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   sMyName +
+                   QString(" Error writing %1").arg(sMessage));
+        done(ERROR_SOCKET);
+    }
+}
+
+
+/*!
+ * \brief FileUpdater::processRepairFrame
+ * Store a missing range of a file partially received by multicast
+ * \param baMessage [in] the chunk of information
+ * \param isLastFrame [in] is this the last chunk ?
+ */
+void
+FileUpdater::processRepairFrame(QByteArray baMessage, bool isLastFrame) {
+    if(bRepairHeaderPending) {
+        baMessage = baMessage.mid(1024);
+        bRepairHeaderPending = false;
+    }
+    if(!pMulticast->writeRange(sMyName, sCurrentFileName, repairOffset, baMessage)) {
+        sLastError = QString("Error writing %1").arg(sCurrentFileName);
+        done(FILE_ERROR);
+        return;
+    }
+    repairOffset += baMessage.size();
+    bytesReceived += baMessage.size();
+    reportProgress();
+    if(isLastFrame)
+        requestRepairChunk();
+}
+
+
+/*!
+ * \brief FileUpdater::openRawChannel
+ * Connect (asynchronously) the plain TCP channel for the file data.
+ * Until it connects (or if it can't) the data travel on the WebSocket.
+ */
+void
+FileUpdater::openRawChannel() {
+    if(!pRaw) {
+        pRaw = new RawChannel(logFile, this);
+        connect(pRaw, SIGNAL(dataReceived(qint64,bool)),
+                this, SLOT(onRawData(qint64,bool)));
+        connect(pRaw, SIGNAL(failed(QString)),
+                this, SLOT(onRawFailed(QString)));
+    }
+    quint64 rawToken = QRandomGenerator::global()->generate64();
+    if(!pRaw->open(serverUrl.host(), quint16(serverUrl.port()+RAW_PORT_OFFSET), rawToken)) {
+#ifdef LOG_VERBOSE
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   sMyName +
+                   QString(" Raw channel not available: %1").arg(pRaw->errorString()));
+#endif
+        return;
+    }
+    // The Server pairs the raw connection with this WebSocket by the token
+    QString sMessage = QString("<raw_token>%1</raw_token>").arg(rawToken);
+    qint64 written = pUpdateSocket->sendTextMessage(sMessage);
+    if(written != sMessage.length()) {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   sMyName +
+                   QString(" Error writing %1").arg(sMessage));
+        pRaw->close();
+    }
+}
+
+
+/*!
+ * \brief FileUpdater::requestRawChunk
+ * Ask the next chunk of the current file on the raw channel (if connected)
+ * \param chunkSize The chunk size
+ * \return true if the chunk has been requested (or the update ended)
+ */
+bool
+FileUpdater::requestRawChunk(int chunkSize) {
+    if(!pRaw || !pRaw->isConnected() || pDataSocket != pUpdateSocket)
+        return false;
+    if(file.isOpen())// The raw channel writes the file by itself
+        file.close();
+    if(!pRaw->setTarget(destinationDir + sCurrentFileName + QString(".temp"),
+                        bytesReceived,
+                        qMin(qint64(chunkSize), queryList.last().fileSize-bytesReceived)))
+    {
+        file.setFileName(destinationDir + sCurrentFileName + QString(".temp"));
+        handleOpenFileError();
+        return true;
+    }
+    QString sMessage = QString("<get_raw>%1,%2,%3</get_raw>")
+                           .arg(sCurrentFileName)
+                           .arg(bytesReceived)
+                           .arg(chunkSize);
+    qint64 written = pUpdateSocket->sendTextMessage(sMessage);
+    if(written != sMessage.length()) {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   sMyName +
+                   QString(" Error writing %1").arg(sMessage));
+        done(ERROR_SOCKET);
+        return true;
+    }
+    bRawTransfer = true;
+    return true;
+}
+
+
+/*!
+ * \brief FileUpdater::onRawData
+ * Invoked when the raw channel has written data in the current file
+ * \param bytes The bytes written
+ * \param bFrameDone true if the requested chunk is complete
+ *
+ * An empty chunk before the end of the file means that the Server has
+ * nothing to send on the raw channel: after RAW_MAX_EMPTY_CHUNKS attempts
+ * the file is asked on the WebSocket (where the Server can tell why).
+ */
+void
+FileUpdater::onRawData(qint64 bytes, bool bFrameDone) {
+    if(!bBusy || !bRawTransfer)
+        return;
+    if(pScheduler)
+        pScheduler->consume(bytes);
+    bytesTransferred += bytes;
+    bytesReceived    += bytes;
+    reportProgress();
+    if(!bFrameDone)
+        return;
+    bRawTransfer = false;
+    if(thread()->isInterruptionRequested()) {
+        done(TRANSFER_DONE);
+        return;
+    }
+    if(bytesReceived < queryList.last().fileSize) {
+        if(bytes > 0) {
+            emptyRawChunks = 0;
+        }
+        else if(++emptyRawChunks > RAW_MAX_EMPTY_CHUNKS) {
+            logMessage(logFile,
+                       Q_FUNC_INFO,
+                       sMyName +
+                       QString(" No data for %1 at %2 on the raw channel: going on with the WebSocket")
+                       .arg(sCurrentFileName)
+                       .arg(bytesReceived));
+            emptyRawChunks = 0;
+            pRaw->close();
+            file.setFileName(destinationDir + sCurrentFileName + QString(".temp"));
+            if(!file.open(QIODevice::Append)) {
+                handleOpenFileError();
+                return;
+            }
+        }
+        requestNextChunk();
+        return;
+    }
+    pRaw->closeTarget();
+    if(bytesReceived > queryList.last().fileSize) {
+        oversizedFile();
+        return;
+    }
+    if(!checkPeerData())
+        return;
+    QString sFileName = destinationDir + sCurrentFileName;
+    QFile::remove(sFileName);
+    if(!QFile::rename(sFileName + QString(".temp"), sFileName)) {
+        file.setFileName(sFileName + QString(".temp"));
+        handleWriteFileError();
+        return;
+    }
+    completeCurrentFile();
+}
+
+
+/*!
+ * \brief FileUpdater::onRawFailed
+ * The raw channel failed: go on with the WebSocket
+ */
+void
+FileUpdater::onRawFailed(QString sError) {
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               sMyName +
+               QString(" Raw channel closed: %1").arg(sError));
+    if(!bBusy || !bRawTransfer)
+        return;
+    bRawTransfer = false;
+    file.setFileName(destinationDir + sCurrentFileName + QString(".temp"));
+    if(!file.open(QIODevice::Append)) {
+        handleOpenFileError();
+        return;
     }
+    bytesReceived = file.size();
+    requestNextChunk();
+}
+
+
+/*!
+ * \brief FileUpdater::askDelta
+ * Ask the Server only the blocks of the current file that changed
+ * \return true if a delta transfer has been requested
+ *
+ * Possible only if an old copy of the file is already present.
+ * The request is a binary message made of a 1024 bytes header:
+ * "delta,<file name>,<block size>,<number of blocks>" followed by
+ * the signature of the old copy (see DeltaPatcher::signature()).
+ * If the Server refuses the request, or doesn't answer within
+ * DELTA_TIMEOUT, the whole file is asked instead.
+ */
+bool
+FileUpdater::askDelta() {
+    if(!bDeltaMode || deltaFailedList.contains(sCurrentFileName))
+        return false;
+    QFileInfo baseInfo(destinationDir + sCurrentFileName);
+    if(!baseInfo.exists() || baseInfo.size() < DELTA_BLOCK_SIZE)
+        return false;
+    QByteArray baSignature = DeltaPatcher::signature(baseInfo.absoluteFilePath(),
+                                                     DELTA_BLOCK_SIZE);
+    if(baSignature.isEmpty())
+        return false;
+    QByteArray baMessage = QString("delta,%1,%2,%3")
+                           .arg(sCurrentFileName)
+                           .arg(DELTA_BLOCK_SIZE)
+                           .arg(baSignature.size()/DeltaPatcher::SIGNATURE_RECORD_SIZE)
+                           .toUtf8()
+                           .leftJustified(1024, '\0', true);
+    baMessage.append(baSignature);
+    qint64 written = pUpdateSocket->sendBinaryMessage(baMessage);
+    if(written != baMessage.size()) {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   sMyName +
+                   QString(" Error asking the delta of %1").arg(sCurrentFileName));
+        done(ERROR_SOCKET);
+        return true;
+    }
+#ifdef LOG_VERBOSE
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               sMyName +
+               QString(" Asked the delta of %1 (%2 blocks)")
+               .arg(sCurrentFileName)
+               .arg(baSignature.size()/DeltaPatcher::SIGNATURE_RECORD_SIZE));
 #endif
+    bDeltaInProgress     = true;
+    bDeltaHeaderReceived = false;
+    pDeltaTimer->start();
+    return true;
+}
+
+
+/*!
+ * \brief FileUpdater::reportProgress Notify the progress of the update
+ */
+void
+FileUpdater::reportProgress() {
+    emit progress(queryList.count(),
+                  bytesCompleted+bytesReceived,
+                  bytesTotal,
+                  bytesTransferred);
+}
+
+
+/*!
+ * \brief FileUpdater::done Ends the running update
+ * \param iReturnCode The update result (TRANSFER_DONE, ERROR_SOCKET, ...)
+ */
+void
+FileUpdater::done(int iReturnCode) {
+    if(!bBusy)
+        return;
+    bBusy = false;
+    returnCode = iReturnCode;
+    bRepairInProgress = false;
+    bRawTransfer = false;
+    if(pRaw)
+        pRaw->closeTarget();
+    if(returnCode == TRANSFER_DONE && bOutOfSpace)
+        returnCode = DISK_FULL;
+    if(file.isOpen())
+        file.close();
+    pDeltaTimer->stop();
+    pChunkTimer->stop();
+    pMulticastTimer->stop();
+    if(bDeltaInProgress) {
+        deltaPatcher.abort();
+        bDeltaInProgress = false;
+    }
+    if(pScheduler)
+        pScheduler->clearPending(sMyName);
+    emit transferDone(returnCode);
 }
@@ -25,9 +25,19 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <QWidget>
 #include <QFile>
 #include <QFileInfoList>
+#include <QElapsedTimer>
+#include <QMap>
+
+#include "deltapatcher.h"
 
 
 QT_FORWARD_DECLARE_CLASS(QWebSocket)
+QT_FORWARD_DECLARE_CLASS(QTimer)
+QT_FORWARD_DECLARE_CLASS(TransferScheduler)
+QT_FORWARD_DECLARE_CLASS(MediaCache)
+QT_FORWARD_DECLARE_CLASS(PeerServer)
+QT_FORWARD_DECLARE_CLASS(MulticastReceiver)
+QT_FORWARD_DECLARE_CLASS(RawChannel)
 
 
 /*!
@@ -36,6 +46,7 @@ QT_FORWARD_DECLARE_CLASS(QWebSocket)
 struct files {
     QString fileName;/*!< \brief  The file Name */
     qint64  fileSize;/*!< \brief its size (in bytes) */
+    QString fileDigest;/*!< \brief the MD5 of its content (in hex, empty if not listed) */
 };
 
 
@@ -45,15 +56,38 @@ class FileUpdater : public QObject
 public:
     explicit FileUpdater(QString sName, QUrl myServerUrl, QFile *myLogFile = Q_NULLPTR, QObject *parent = Q_NULLPTR);
     bool setDestination(QString myDstinationDir, QString sExtensions);
+    void setDeltaMode(bool bEnable);
+    void setScheduler(TransferScheduler *pTransferScheduler);
+    void setCache(MediaCache *pMediaCache);
+    void setPeerServer(PeerServer *pPeerServer);
+    void setMulticastReceiver(MulticastReceiver *pReceiver);
+    void setRawMode(bool bEnable);
+    void setServerUrl(QUrl myServerUrl);
+    bool isBusy();
+    QString errorString();
     void askFileList();
 
     static const int TRANSFER_DONE       =  0;
     static const int ERROR_SOCKET        = -1;
     static const int SERVER_DISCONNECTED = -2;
     static const int FILE_ERROR          = -3;
+    static const int DISK_FULL           = -4;
+
+signals:
+    void transferDone(int returnCode);/*!< \brief emitted at the end of each update */
+    void fileReady(QString sFileName);/*!< \brief emitted when a file has been completely transferred */
+    /*!
+     * \brief progress emitted while updating
+     * \param filesPending The files still to transfer (the current one included)
+     * \param bytesDone The bytes of these files already present
+     * \param bytesTotal The total bytes of these files
+     * \param bytesTransferred The bytes received from the network (ever)
+     */
+    void progress(int filesPending, qint64 bytesDone, qint64 bytesTotal, qint64 bytesTransferred);
 
 public slots:
     void startUpdate();
+    void stopUpdate();
 
 private slots:
     void onUpdateSocketError(QAbstractSocket::SocketError error);
@@ -61,13 +95,45 @@ private slots:
     void onServerDisconnected();
     void onProcessTextMessage(QString sMessage);
     void onProcessBinaryFrame(QByteArray baMessage, bool isLastFrame);
+    void onTimeToRequestChunk();
+    void onPeerConnected();
+    void onPeerDisconnected();
+    void onPeerError(QAbstractSocket::SocketError error);
+    void onTimeToCheckMulticast();
+    void onRawData(qint64 bytes, bool bFrameDone);
+    void onRawFailed(QString sError);
+    void onDeltaTimeout();
 
 private:
     void handleWriteFileError();
     void handleOpenFileError();
     bool isConnectedToNetwork();
     void updateFiles();
-    void askFirstFile();
+    void askNextFile();
+    void startFileTransfer();
+    bool askPeer();
+    void peerFailed();
+    bool checkPeerData();
+    void oversizedFile();
+    void closePeerSocket();
+    quint64 transferKey(const files &file);
+    bool waitMulticast();
+    void requestRepairChunk();
+    void processRepairFrame(QByteArray baMessage, bool isLastFrame);
+    void openRawChannel();
+    bool requestRawChunk(int chunkSize);
+    void requestNextChunk();
+    void sortQueryList();
+    bool askDelta();
+    void processDeltaFrame(QByteArray baMessage, bool isLastFrame);
+    void abandonDelta(QString sReason);
+    void completeCurrentFile();
+    void completeFile(int iFile);
+    bool reserveSpace();
+    void skipCurrentFile();
+    void dropCurrentFile();
+    void done(int iReturnCode);
+    void reportProgress();
 
 public:
     int returnCode;
@@ -82,6 +148,38 @@ private:
     QString      sFileExtensions;
     qint64       bytesReceived;
     QString      sCurrentFileName;
+    bool         bDeltaMode;
+    bool         bDeltaInProgress;
+    bool         bDeltaHeaderReceived;
+    DeltaPatcher deltaPatcher;
+    QStringList  deltaFailedList;
+    QTimer      *pDeltaTimer;
+    QTimer      *pChunkTimer;// Delays the chunk requests as asked by the scheduler
+    TransferScheduler *pScheduler;
+    MediaCache  *pCache;
+    PeerServer  *pPeers;
+    QWebSocket  *pPeerSocket;
+    QWebSocket  *pDataSocket;// Where the chunks are requested
+    QUrl         peerUrl;
+    QString      sPeerFile;// The file whose .temp holds data sent by a peer
+    QElapsedTimer peerClock;
+    MulticastReceiver *pMulticast;
+    QElapsedTimer multicastClock;
+    QTimer      *pMulticastTimer;// Polls the multicast stream
+    QMap<QString, int> nackMap;
+    bool         bRepairInProgress;
+    bool         bRepairHeaderPending;
+    qint64       repairOffset;
+    RawChannel  *pRaw;
+    bool         bRawMode;
+    bool         bRawTransfer;
+    int          emptyRawChunks;
+    bool         bOutOfSpace;
+    bool         bBusy;
+    qint64       bytesTotal;
+    qint64       bytesCompleted;
+    qint64       bytesTransferred;
+    QString      sLastError;
 
     QList<files> queryList;
     QList<files> remoteFileList;
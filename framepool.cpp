@@ -0,0 +1,129 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#include "framepool.h"
+
+
+/*!
+ * \brief FramePool::FramePool A pool of screen sized frame buffers
+ *
+ * A full screen frame is about 8 MB at 1080p: allocating and freeing
+ * one at every slide change, for a whole match, would fragment the
+ * (small) heap of the panel. The buffers are allocated only when the
+ * pool has no free one and are recycled across slides and transitions.
+ * When the resolution (or the pixel format) changes the free buffers
+ * are dropped and the pool starts again.
+ * The pool is not thread safe: it must be used by the GUI Thread only
+ * (the buffers themselves may be filled by other Threads).
+ */
+FramePool::FramePool()
+    : frameFormat(QImage::Format_Invalid)
+    , nAllocated(0)
+    , frameBytes(0)
+    , peakBytes(0)
+{
+}
+
+
+/*!
+ * \brief FramePool::acquire
+ * \param size The frame size
+ * \param format The frame pixel format
+ * \return A free buffer (content undefined) or a null image if out of memory
+ */
+QImage
+FramePool::acquire(QSize size, QImage::Format format) {
+    if(size != frameSize || format != frameFormat)
+        reset(size, format);
+    if(!freeList.isEmpty())
+        return freeList.takeLast();
+    QImage frame(frameSize, frameFormat);
+    if(frame.isNull())
+        return frame;
+    frameBytes = frame.sizeInBytes();
+    nAllocated++;
+    peakBytes = qMax(peakBytes, bytesAllocated());
+    return frame;
+}
+
+
+/*!
+ * \brief FramePool::recycle Give back a buffer obtained with acquire()
+ * \param frame The buffer (dropped if of a different size or format)
+ */
+void
+FramePool::recycle(const QImage &frame) {
+    if(frame.isNull())
+        return;
+    if(frame.size() != frameSize || frame.format() != frameFormat)
+        return;// From before a resolution change: already accounted for
+    freeList.append(frame);
+}
+
+
+/*!
+ * \brief FramePool::trim Free the buffers not in use
+ */
+void
+FramePool::trim() {
+    nAllocated -= freeList.count();
+    freeList.clear();
+}
+
+
+/*!
+ * \brief FramePool::reset Start again with a new frame size
+ */
+void
+FramePool::reset(QSize size, QImage::Format format) {
+    trim();
+    nAllocated  = 0;// The buffers still in use will not come back
+    frameSize   = size;
+    frameFormat = format;
+    frameBytes  = 0;
+}
+
+
+/*!
+ * \brief FramePool::frameCount
+ * \return The buffers allocated (free or in use) at the present size
+ */
+int
+FramePool::frameCount() {
+    return nAllocated;
+}
+
+
+/*!
+ * \brief FramePool::bytesAllocated
+ * \return The memory used by the buffers at the present size
+ */
+qint64
+FramePool::bytesAllocated() {
+    return qint64(nAllocated)*frameBytes;
+}
+
+
+/*!
+ * \brief FramePool::highWater
+ * \return The most memory the pool has ever used
+ */
+qint64
+FramePool::highWater() {
+    return peakBytes;
+}
@@ -0,0 +1,51 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <QImage>
+#include <QList>
+#include <QSize>
+
+
+class FramePool
+{
+public:
+    FramePool();
+
+    QImage acquire(QSize size, QImage::Format format);
+    void   recycle(const QImage &frame);
+    void   trim();
+    int    frameCount();
+    qint64 bytesAllocated();
+    qint64 highWater();
+
+private:
+    void   reset(QSize size, QImage::Format format);
+
+private:
+    QSize          frameSize;
+    QImage::Format frameFormat;
+    QList<QImage>  freeList;
+    int            nAllocated;
+    qint64         frameBytes;
+    qint64         peakBytes;
+};
+
+#endif // FRAMEPOOL_H
@@ -3,6 +3,11 @@
 int
 main(int argc, char *argv[]) {
     qputenv("QT_LOGGING_RULES","*.debug=false;qt.qpa.*=false"); // supress anoying messages
+    // The simulated Panels don't need a screen
+    for(int i=1; i<argc; i++) {
+        if(QString(argv[i]).startsWith(QString("--simulate")))
+            qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
     QString sVersion = QString("0.1");
     QApplication::setApplicationVersion(sVersion);
 
@@ -0,0 +1,345 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSettings>
+#include <QStorageInfo>
+#include <QDateTime>
+#include <QMutexLocker>
+
+#include "mediacache.h"
+#include "slidedecoder.h"
+#include "utility.h"
+
+
+#define DISK_RESERVE 64*1024*1024 // Never fill the disk completely
+
+
+/*!
+ * \brief MediaCache::MediaCache Keeps the local media within a disk budget
+ * \param sBaseDir The folder where to keep the last played times
+ * \param myLogFile The File for logging (if any).
+ * \param parent The parent object.
+ *
+ * The media no more listed by the Server are not deleted at once:
+ * they are moved in the CACHE_DIR subfolder of their category and
+ * brought back, without any transfer, if the Server lists them again.
+ * When a download needs room (because the disk is almost full or the
+ * configured budget has been reached) the cached media are evicted
+ * starting from the least recently played ones.
+ * The media needed by the current manifest are never evicted.
+ * The prepared slide frames (FRAME_DIR, about 8 MB each at 1080p) are
+ * part of the budget too: those of the retired slides are removed with
+ * them and, if needed, the others are evicted after the cached media
+ * (they can always be prepared again).
+ *
+ * All the public methods are thread safe.
+ */
+MediaCache::MediaCache(QString sBaseDir, QFile *myLogFile, QObject *parent)
+    : QObject(parent)
+    , logFile(myLogFile)
+    , budgetBytes(0)
+{
+    if(!sBaseDir.endsWith(QString("/"))) sBaseDir+= QString("/");
+    pLastPlayed = new QSettings(sBaseDir + QString(".lastplayed.ini"), QSettings::IniFormat);
+}
+
+
+/*!
+ * \brief MediaCache::~MediaCache
+ */
+MediaCache::~MediaCache() {
+    pLastPlayed->sync();
+    delete pLastPlayed;
+}
+
+
+/*!
+ * \brief MediaCache::setBudget
+ * \param bytes The disk space usable by the media (0 means all the free space)
+ */
+void
+MediaCache::setBudget(qint64 bytes) {
+    QMutexLocker locker(&mutex);
+    budgetBytes = qMax(qint64(0), bytes);
+}
+
+
+/*!
+ * \brief MediaCache::budget
+ * \return The disk space usable by the media (0 means all the free space)
+ */
+qint64
+MediaCache::budget() {
+    QMutexLocker locker(&mutex);
+    return budgetBytes;
+}
+
+
+/*!
+ * \brief MediaCache::addDirectory Put the folder of a category under control
+ */
+void
+MediaCache::addDirectory(QString sCategory, QString sDir) {
+    if(!sDir.endsWith(QString("/"))) sDir+= QString("/");
+    QMutexLocker locker(&mutex);
+    dirMap.insert(sCategory, sDir);
+}
+
+
+/*!
+ * \brief MediaCache::setManifestSize The total size of the files listed by the Server
+ */
+void
+MediaCache::setManifestSize(QString sCategory, qint64 bytes) {
+    QMutexLocker locker(&mutex);
+    manifestMap.insert(sCategory, bytes);
+}
+
+
+/*!
+ * \brief MediaCache::manifestSize
+ * \return The size of the media needed by all the categories
+ */
+qint64
+MediaCache::manifestSize() {
+    QMutexLocker locker(&mutex);
+    qint64 total = 0;
+    QMapIterator<QString, qint64> i(manifestMap);
+    while(i.hasNext()) {
+        i.next();
+        total += i.value();
+    }
+    return total;
+}
+
+
+/*!
+ * \brief MediaCache::isBudgetTooSmall
+ * \return true if the media listed by the Server can't be all kept on the panel
+ */
+bool
+MediaCache::isBudgetTooSmall() {
+    qint64 needed = manifestSize();
+    QMutexLocker locker(&mutex);
+    if(budgetBytes > 0 && needed > budgetBytes)
+        return true;
+    qint64 available = availableBytes();
+    return (available >= 0) && (needed > usedBytes()+available);
+}
+
+
+/*!
+ * \brief MediaCache::touch Record that a media has just been played
+ */
+void
+MediaCache::touch(QString sCategory, QString sFileName) {
+    QMutexLocker locker(&mutex);
+    pLastPlayed->setValue(sCategory + QString("/") + sFileName,
+                          QDateTime::currentSecsSinceEpoch());
+}
+
+
+/*!
+ * \brief MediaCache::restore Bring back a cached media listed again by the Server
+ * \return true if the cached copy was valid and has been moved back
+ */
+bool
+MediaCache::restore(QString sCategory, QString sFileName, qint64 fileSize) {
+    QMutexLocker locker(&mutex);
+    QString sDir = dirMap.value(sCategory);
+    if(sDir.isEmpty())
+        return false;
+    QFileInfo cachedFile(sDir + QString(CACHE_DIR) + sFileName);
+    if(!cachedFile.exists())
+        return false;
+    if(cachedFile.size() != fileSize) {// An old version: useless
+        QFile::remove(cachedFile.absoluteFilePath());
+        return false;
+    }
+    if(!QFile::rename(cachedFile.absoluteFilePath(), sDir + sFileName))
+        return false;
+#ifdef LOG_VERBOSE
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               QString("Restored %1 from the cache").arg(sDir + sFileName));
+#endif
+    return true;
+}
+
+
+/*!
+ * \brief MediaCache::retire Move a media no more listed by the Server into the cache
+ * \return true if the media has been moved
+ */
+bool
+MediaCache::retire(QString sCategory, QString sFileName) {
+    QMutexLocker locker(&mutex);
+    QString sDir = dirMap.value(sCategory);
+    if(sDir.isEmpty())
+        return false;
+    QDir cacheDir(sDir + QString(CACHE_DIR));
+    if(!cacheDir.exists() && !cacheDir.mkpath(cacheDir.absolutePath()))
+        return false;
+    QFile::remove(cacheDir.absoluteFilePath(sFileName));
+    if(!QFile::rename(sDir + sFileName, cacheDir.absoluteFilePath(sFileName)))
+        return false;
+    // A retired slide is not shown: its frame would only take space
+    SlideDecoder::removeFrame(sDir + sFileName);
+    return true;
+}
+
+
+/*!
+ * \brief MediaCache::makeRoom Evict the cached media until a new file fits
+ * \param bytesNeeded The size of the file to write
+ * \return false if there is not enough space even with an empty cache
+ */
+bool
+MediaCache::makeRoom(qint64 bytesNeeded) {
+    QMutexLocker locker(&mutex);
+    qint64 available = availableBytes();
+    qint64 used = usedBytes();
+    struct candidate {
+        QString sCategory;
+        QFileInfo fileInfo;
+        qint64  lastPlayed;
+        bool    bFrame;
+    };
+    QList<candidate> candidates;
+    QMapIterator<QString, QString> i(dirMap);
+    while(i.hasNext()) {
+        i.next();
+        QDir cacheDir(i.value() + QString(CACHE_DIR));
+        QFileInfoList cachedFiles = cacheDir.entryInfoList(QDir::Files);
+        for(int j=0; j<cachedFiles.count(); j++) {
+            candidate newCandidate;
+            newCandidate.sCategory  = i.key();
+            newCandidate.fileInfo   = cachedFiles.at(j);
+            newCandidate.lastPlayed = lastPlayed(i.key(), cachedFiles.at(j).fileName());
+            newCandidate.bFrame     = false;
+            // Least recently played first
+            int k = 0;
+            while(k < candidates.count() && candidates.at(k).lastPlayed <= newCandidate.lastPlayed)
+                k++;
+            candidates.insert(k, newCandidate);
+        }
+    }
+    // Then the prepared frames, least recently played slide first
+    int firstFrame = candidates.count();
+    i.toFront();
+    while(i.hasNext()) {
+        i.next();
+        QDir frameDir(i.value() + QString(FRAME_DIR));
+        QFileInfoList frameFiles = frameDir.entryInfoList(QStringList() << "*.frame", QDir::Files);
+        for(int j=0; j<frameFiles.count(); j++) {
+            candidate newCandidate;
+            newCandidate.sCategory  = i.key();
+            newCandidate.fileInfo   = frameFiles.at(j);
+            newCandidate.lastPlayed = lastPlayed(i.key(), frameFiles.at(j).completeBaseName());
+            newCandidate.bFrame     = true;
+            int k = firstFrame;
+            while(k < candidates.count() && candidates.at(k).lastPlayed <= newCandidate.lastPlayed)
+                k++;
+            candidates.insert(k, newCandidate);
+        }
+    }
+    for(int k=0; ; k++) {
+        bool bFits = (available < 0 || bytesNeeded <= available) &&
+                     (budgetBytes == 0 || used+bytesNeeded <= budgetBytes);
+        if(bFits)
+            return true;
+        if(k >= candidates.count())
+            return false;
+        qint64 size = candidates.at(k).fileInfo.size();
+        if(!QFile::remove(candidates.at(k).fileInfo.absoluteFilePath()))
+            continue;
+        if(!candidates.at(k).bFrame)// The slide of a frame is still there
+            pLastPlayed->remove(candidates.at(k).sCategory + QString("/") + candidates.at(k).fileInfo.fileName());
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Evicted %1 (%2 bytes)")
+                   .arg(candidates.at(k).fileInfo.absoluteFilePath())
+                   .arg(size));
+        used -= size;
+        if(available >= 0)
+            available += size;
+    }
+}
+
+
+/*!
+ * \brief MediaCache::usedBytes (mutex must be held)
+ * \return The disk space taken by all the media (cached ones and
+ * prepared frames included)
+ */
+qint64
+MediaCache::usedBytes() {
+    qint64 total = 0;
+    QMapIterator<QString, QString> i(dirMap);
+    while(i.hasNext()) {
+        i.next();
+        total += directorySize(i.value());
+        total += directorySize(i.value() + QString(CACHE_DIR));
+        total += directorySize(i.value() + QString(FRAME_DIR));
+    }
+    return total;
+}
+
+
+/*!
+ * \brief MediaCache::directorySize
+ * \return The size of the files in a folder (subfolders excluded)
+ */
+qint64
+MediaCache::directorySize(QString sDir) {
+    qint64 total = 0;
+    QFileInfoList fileList = QDir(sDir).entryInfoList(QDir::Files);
+    for(int i=0; i<fileList.count(); i++)
+        total += fileList.at(i).size();
+    return total;
+}
+
+
+/*!
+ * \brief MediaCache::availableBytes (mutex must be held)
+ * \return The free disk space (minus a reserve) or -1 if unknown
+ */
+qint64
+MediaCache::availableBytes() {
+    if(dirMap.isEmpty())
+        return -1;
+    QString sDir = dirMap.first();
+    QDir().mkpath(sDir);
+    QStorageInfo storage(sDir);
+    if(!storage.isValid() || !storage.isReady())
+        return -1;
+    return qMax(qint64(0), storage.bytesAvailable()-qint64(DISK_RESERVE));
+}
+
+
+/*!
+ * \brief MediaCache::lastPlayed (mutex must be held)
+ * \return When the media has been played (seconds since the epoch, 0 if never)
+ */
+qint64
+MediaCache::lastPlayed(QString sCategory, QString sFileName) {
+    return pLastPlayed->value(sCategory + QString("/") + sFileName, 0).toLongLong();
+}
@@ -0,0 +1,67 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#ifndef MEDIACACHE_H
+#define MEDIACACHE_H
+
+#include <QObject>
+#include <QMutex>
+#include <QMap>
+#include <QStringList>
+
+QT_FORWARD_DECLARE_CLASS(QFile)
+QT_FORWARD_DECLARE_CLASS(QSettings)
+
+
+#define CACHE_DIR ".cache/" // The subfolder with the media no more in the manifest
+
+
+class MediaCache : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MediaCache(QString sBaseDir, QFile *myLogFile = Q_NULLPTR, QObject *parent = Q_NULLPTR);
+    ~MediaCache();
+
+    void    setBudget(qint64 bytes);
+    qint64  budget();
+    void    addDirectory(QString sCategory, QString sDir);
+    void    setManifestSize(QString sCategory, qint64 bytes);
+    bool    isBudgetTooSmall();
+    qint64  manifestSize();
+    void    touch(QString sCategory, QString sFileName);
+    bool    restore(QString sCategory, QString sFileName, qint64 fileSize);
+    bool    retire(QString sCategory, QString sFileName);
+    bool    makeRoom(qint64 bytesNeeded);
+
+private:
+    qint64  usedBytes();
+    qint64  directorySize(QString sDir);
+    qint64  availableBytes();
+    qint64  lastPlayed(QString sCategory, QString sFileName);
+
+private:
+    QFile                  *logFile;
+    QMutex                  mutex;
+    QSettings              *pLastPlayed;
+    qint64                  budgetBytes;
+    QMap<QString, QString>  dirMap;
+    QMap<QString, qint64>   manifestMap;
+};
+
+#endif // MEDIACACHE_H
@@ -0,0 +1,525 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QUdpSocket>
+#include <QNetworkInterface>
+#include <QtEndian>
+
+#include "multicastreceiver.h"
+#include "mediacache.h"
+#include "utility.h"
+
+
+#define MCAST_GROUP       "239.255.45.58"
+#define MCAST_PORT        45458
+#define MCAST_NACK_PORT   45459
+#define MCAST_IDLE_TIME   2000 // In msec: no packets since then means "idle"
+#define MCAST_HEADER_SIZE 24
+#define MAX_NACK_RANGES   32   // Keep the NACK within a datagram
+#define MAX_MCAST_TRANSFERS 4  // Files received at the same time (each one preallocated)
+
+
+/*!
+ * \brief MulticastReceiver::MulticastReceiver Receives the files multicast by the Server
+ * \param myLogFile The File for logging (if any).
+ * \param parent The parent object.
+ *
+ * The Server streams each file once to the multicast group MCAST_GROUP.
+ * Each datagram carries a piece of a file:
+ * | "VPMC" | version (1) | category length (1) | name length (2) |
+ * | file size (8) | offset (8) | category | name | data |
+ * (integers are big endian).
+ * The wanted files are received in preallocated "<name>.mcast" files
+ * (at most MAX_MCAST_TRANSFERS at a time, within the MediaCache budget)
+ * keeping track of the ranges received. When the stream stops, the
+ * File Updaters ask the Server to send again the missing ranges:
+ * first with a NACK datagram to MCAST_NACK_PORT
+ * (<nack>category,name,offset-length;...</nack>, multicast again to
+ * all the panels), then, if still missing, by unicast <get> requests.
+ *
+ * It must live in the same Thread of the File Updaters.
+ */
+MulticastReceiver::MulticastReceiver(QFile *myLogFile, QObject *parent)
+    : QObject(parent)
+    , logFile(myLogFile)
+    , pDataSocket(Q_NULLPTR)
+    , pCache(Q_NULLPTR)
+{
+    clock.start();
+}
+
+
+/*!
+ * \brief MulticastReceiver::~MulticastReceiver
+ */
+MulticastReceiver::~MulticastReceiver() {
+    stop();
+    QStringList keys = transferMap.keys();
+    for(int i=0; i<keys.count(); i++)
+        closeTransfer(keys.at(i), false);
+}
+
+
+/*!
+ * \brief MulticastReceiver::addCategory Receive the files of a category
+ */
+void
+MulticastReceiver::addCategory(QString sCategory, QString sDir) {
+    if(!sDir.endsWith(QString("/"))) sDir+= QString("/");
+    category newCategory;
+    newCategory.sDir = sDir;
+    newCategory.lastActivity = -MCAST_IDLE_TIME;
+    categoryMap.insert(sCategory, newCategory);
+}
+
+
+/*!
+ * \brief MulticastReceiver::setServerAddress Where to send the NACKs
+ */
+void
+MulticastReceiver::setServerAddress(QString sAddress) {
+    serverAddress = QHostAddress(sAddress);
+}
+
+
+/*!
+ * \brief MulticastReceiver::setCache Make room for the partial files within a disk budget
+ */
+void
+MulticastReceiver::setCache(MediaCache *pMediaCache) {
+    pCache = pMediaCache;
+}
+
+
+/*!
+ * \brief MulticastReceiver::setWanted The files of a category still to receive
+ *
+ * The partial files no more wanted are discarded, as all the other
+ * ".mcast" files of the directory (e.g. the ones left by a previous run:
+ * their received ranges are unknown).
+ */
+void
+MulticastReceiver::setWanted(QString sCategory, QList<files> fileList) {
+    if(!categoryMap.contains(sCategory))
+        return;
+    category &cat = categoryMap[sCategory];
+    cat.wanted = fileList;
+    QStringList keys = transferMap.keys();
+    for(int i=0; i<keys.count(); i++) {
+        if(!keys.at(i).startsWith(sCategory + QString("/")))
+            continue;
+        QString sFileName = keys.at(i).mid(sCategory.length()+1);
+        bool bWanted = false;
+        for(int j=0; j<fileList.count(); j++) {
+            if(fileList.at(j).fileName == sFileName &&
+               fileList.at(j).fileSize == transferMap.value(keys.at(i)).fileSize)
+                bWanted = true;
+        }
+        if(!bWanted)
+            closeTransfer(keys.at(i), true);
+    }
+    QDir dir(cat.sDir);
+    QStringList partFiles = dir.entryList(QStringList() << QString("*.mcast"), QDir::Files);
+    for(int j=0; j<partFiles.count(); j++) {
+        QString sFileName = partFiles.at(j).left(partFiles.at(j).length()-6);
+        if(!transferMap.contains(sCategory + QString("/") + sFileName))
+            QFile::remove(dir.absoluteFilePath(partFiles.at(j)));
+    }
+}
+
+
+/*!
+ * \brief MulticastReceiver::isActive
+ * \return true if the Server is streaming the files of the category
+ */
+bool
+MulticastReceiver::isActive(QString sCategory) {
+    if(!categoryMap.contains(sCategory))
+        return false;
+    return clock.elapsed()-categoryMap.value(sCategory).lastActivity < MCAST_IDLE_TIME;
+}
+
+
+/*!
+ * \brief MulticastReceiver::hasStreamed
+ * \return true if the Server has ever streamed the files of the category
+ */
+bool
+MulticastReceiver::hasStreamed(QString sCategory) {
+    if(!categoryMap.contains(sCategory))
+        return false;
+    return categoryMap.value(sCategory).lastActivity >= 0;
+}
+
+
+/*!
+ * \brief MulticastReceiver::hasPartial
+ * \return true if a part of the file has been received
+ */
+bool
+MulticastReceiver::hasPartial(QString sCategory, QString sFileName) {
+    return transferMap.contains(sCategory + QString("/") + sFileName);
+}
+
+
+/*!
+ * \brief MulticastReceiver::bytesReceived
+ * \return The bytes of the partial files of the category
+ */
+qint64
+MulticastReceiver::bytesReceived(QString sCategory) {
+    qint64 total = 0;
+    QMapIterator<QString, transfer> i(transferMap);
+    while(i.hasNext()) {
+        i.next();
+        if(i.key().startsWith(sCategory + QString("/")))
+            total += i.value().bytesReceived;
+    }
+    return total;
+}
+
+
+/*!
+ * \brief MulticastReceiver::missingRanges
+ * \return The portions of the file not yet received
+ */
+QList<fileRange>
+MulticastReceiver::missingRanges(QString sCategory, QString sFileName) {
+    QList<fileRange> ranges;
+    transfer *pTransfer = findTransfer(sCategory, sFileName, false);
+    if(!pTransfer)
+        return ranges;
+    qint64 position = 0;
+    QMapIterator<qint64, qint64> i(pTransfer->received);
+    while(i.hasNext()) {
+        i.next();
+        if(i.key() > position)
+            ranges.append(fileRange(position, i.key()-position));
+        position = i.value();
+    }
+    if(position < pTransfer->fileSize)
+        ranges.append(fileRange(position, pTransfer->fileSize-position));
+    return ranges;
+}
+
+
+/*!
+ * \brief MulticastReceiver::writeRange Store a portion of a file
+ * (received by multicast or by a unicast repair)
+ * \return false on write errors
+ */
+bool
+MulticastReceiver::writeRange(QString sCategory, QString sFileName, qint64 offset, const QByteArray &baData) {
+    transfer *pTransfer = findTransfer(sCategory, sFileName, true);
+    if(!pTransfer)
+        return true;// Not wanted
+    qint64 end = qMin(offset+baData.size(), pTransfer->fileSize);
+    if(offset < 0 || offset >= end)
+        return true;
+    if(!pTransfer->pFile->seek(offset) ||
+       pTransfer->pFile->write(baData.constData(), end-offset) != end-offset)
+    {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Error writing %1: %2")
+                   .arg(pTransfer->pFile->fileName())
+                   .arg(pTransfer->pFile->errorString()));
+        return false;
+    }
+    addRange(pTransfer, offset, end);
+    checkCompleted(sCategory, sFileName);
+    return true;
+}
+
+
+/*!
+ * \brief MulticastReceiver::sendNack Ask the Server to multicast again the missing ranges
+ * \return true if the NACK has been sent
+ */
+bool
+MulticastReceiver::sendNack(QString sCategory, QString sFileName) {
+    if(!pDataSocket || serverAddress.isNull())
+        return false;
+    QList<fileRange> ranges = missingRanges(sCategory, sFileName);
+    if(ranges.isEmpty())
+        return false;
+    QStringList rangeList;
+    for(int i=0; i<ranges.count() && i<MAX_NACK_RANGES; i++)
+        rangeList.append(QString("%1-%2").arg(ranges.at(i).first).arg(ranges.at(i).second));
+    QByteArray datagram = QString("<nack>%1,%2,%3</nack>")
+                          .arg(sCategory)
+                          .arg(sFileName)
+                          .arg(rangeList.join(QString(";")))
+                          .toUtf8();
+    if(pDataSocket->writeDatagram(datagram, serverAddress, MCAST_NACK_PORT) != datagram.size())
+        return false;
+#ifdef LOG_VERBOSE
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               QString("NACK sent for %1 ranges of %2/%3")
+               .arg(rangeList.count())
+               .arg(sCategory)
+               .arg(sFileName));
+#endif
+    return true;
+}
+
+
+/*!
+ * \brief MulticastReceiver::start Join the multicast group
+ */
+void
+MulticastReceiver::start() {
+    if(pDataSocket)
+        return;
+    pDataSocket = new QUdpSocket(this);
+    if(!pDataSocket->bind(QHostAddress::AnyIPv4, MCAST_PORT,
+                          QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint))
+    {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Unable to bind the Multicast Socket"));
+        delete pDataSocket;
+        pDataSocket = Q_NULLPTR;
+        return;
+    }
+    // Join the group on every interface able to receive it
+    bool bJoined = false;
+    QList<QNetworkInterface> ifaces = QNetworkInterface::allInterfaces();
+    for(int i=0; i<ifaces.count(); i++) {
+        QNetworkInterface iface = ifaces.at(i);
+        if(iface.flags().testFlag(QNetworkInterface::IsUp) &&
+           iface.flags().testFlag(QNetworkInterface::IsRunning) &&
+           iface.flags().testFlag(QNetworkInterface::CanMulticast))
+        {
+            bJoined |= pDataSocket->joinMulticastGroup(QHostAddress(MCAST_GROUP), iface);
+        }
+    }
+    if(!bJoined)
+        bJoined = pDataSocket->joinMulticastGroup(QHostAddress(MCAST_GROUP));
+    if(!bJoined) {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Unable to join the Multicast Group"));
+    }
+    // Files are large: don't lose datagrams while writing to disk
+    pDataSocket->setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, 4*1024*1024);
+    connect(pDataSocket, SIGNAL(readyRead()),
+            this, SLOT(onDatagramsReady()));
+}
+
+
+/*!
+ * \brief MulticastReceiver::stop Leave the multicast group
+ */
+void
+MulticastReceiver::stop() {
+    if(!pDataSocket)
+        return;
+    pDataSocket->disconnect();
+    pDataSocket->close();
+    pDataSocket->deleteLater();
+    pDataSocket = Q_NULLPTR;
+}
+
+
+/*!
+ * \brief MulticastReceiver::onDatagramsReady
+ */
+void
+MulticastReceiver::onDatagramsReady() {
+    QByteArray datagram;
+    while(pDataSocket && pDataSocket->hasPendingDatagrams()) {
+        datagram.resize(int(pDataSocket->pendingDatagramSize()));
+        if(pDataSocket->readDatagram(datagram.data(), datagram.size()) < MCAST_HEADER_SIZE)
+            continue;
+        processPacket(datagram);
+    }
+}
+
+
+/*!
+ * \brief MulticastReceiver::processPacket Store the piece of file carried by a datagram
+ */
+void
+MulticastReceiver::processPacket(const QByteArray &datagram) {
+    const char *p = datagram.constData();
+    if(!datagram.startsWith("VPMC") || p[4] != 1)
+        return;
+    int categoryLength = quint8(p[5]);
+    int nameLength     = qFromBigEndian<quint16>(p+6);
+    qint64 fileSize    = qint64(qFromBigEndian<quint64>(p+8));
+    qint64 offset      = qint64(qFromBigEndian<quint64>(p+16));
+    if(datagram.size() < MCAST_HEADER_SIZE+categoryLength+nameLength)
+        return;
+    QString sCategory = QString::fromUtf8(p+MCAST_HEADER_SIZE, categoryLength);
+    QString sFileName = QString::fromUtf8(p+MCAST_HEADER_SIZE+categoryLength, nameLength);
+    if(!categoryMap.contains(sCategory))
+        return;
+    category &cat = categoryMap[sCategory];
+    cat.lastActivity = clock.elapsed();
+    bool bWanted = false;
+    for(int i=0; i<cat.wanted.count(); i++) {
+        if(cat.wanted.at(i).fileName == sFileName && cat.wanted.at(i).fileSize == fileSize)
+            bWanted = true;
+    }
+    if(!bWanted)
+        return;
+    writeRange(sCategory, sFileName, offset,
+               datagram.mid(MCAST_HEADER_SIZE+categoryLength+nameLength));
+}
+
+
+/*!
+ * \brief MulticastReceiver::findTransfer
+ * \param bCreate Create (and preallocate) the file if it is wanted
+ * \return The transfer of a file or Q_NULLPTR
+ */
+MulticastReceiver::transfer *
+MulticastReceiver::findTransfer(QString sCategory, QString sFileName, bool bCreate) {
+    QString sKey = sCategory + QString("/") + sFileName;
+    if(transferMap.contains(sKey))
+        return &transferMap[sKey];
+    if(!bCreate || !categoryMap.contains(sCategory))
+        return Q_NULLPTR;
+    qint64 fileSize = -1;
+    const QList<files> &wanted = categoryMap[sCategory].wanted;
+    for(int i=0; i<wanted.count(); i++) {
+        if(wanted.at(i).fileName == sFileName)
+            fileSize = wanted.at(i).fileSize;
+    }
+    if(fileSize <= 0 || transferMap.count() >= MAX_MCAST_TRANSFERS)
+        return Q_NULLPTR;// The file will be asked by unicast
+    if(pCache && !pCache->makeRoom(fileSize)) {
+#ifdef LOG_VERBOSE
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("No room for %1").arg(partName(sCategory, sFileName)));
+#endif
+        return Q_NULLPTR;
+    }
+    transfer newTransfer;
+    newTransfer.pFile = new QFile(partName(sCategory, sFileName));
+    newTransfer.fileSize = fileSize;
+    newTransfer.bytesReceived = 0;
+    if(!newTransfer.pFile->open(QIODevice::ReadWrite | QIODevice::Truncate) ||
+       !newTransfer.pFile->resize(fileSize))
+    {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Unable to preallocate %1").arg(newTransfer.pFile->fileName()));
+        newTransfer.pFile->remove();
+        delete newTransfer.pFile;
+        return Q_NULLPTR;
+    }
+    transferMap.insert(sKey, newTransfer);
+    return &transferMap[sKey];
+}
+
+
+/*!
+ * \brief MulticastReceiver::closeTransfer
+ * \param bRemoveFile true to discard the partial file
+ */
+void
+MulticastReceiver::closeTransfer(QString sKey, bool bRemoveFile) {
+    if(!transferMap.contains(sKey))
+        return;
+    transfer t = transferMap.take(sKey);
+    t.pFile->close();
+    if(bRemoveFile)
+        t.pFile->remove();
+    delete t.pFile;
+}
+
+
+/*!
+ * \brief MulticastReceiver::addRange Record a received range, merging the adjacent ones
+ */
+void
+MulticastReceiver::addRange(transfer *pTransfer, qint64 start, qint64 end) {
+    QMap<qint64, qint64> &received = pTransfer->received;
+    // The range starting before (or at) start could overlap
+    QMap<qint64, qint64>::iterator i = received.upperBound(start);
+    if(i != received.begin()) {
+        --i;
+        if(i.value() >= start) {
+            start = i.key();
+            end = qMax(end, i.value());
+            pTransfer->bytesReceived -= i.value()-i.key();
+            i = received.erase(i);
+        }
+        else
+            ++i;
+    }
+    // And the following ones
+    while(i != received.end() && i.key() <= end) {
+        end = qMax(end, i.value());
+        pTransfer->bytesReceived -= i.value()-i.key();
+        i = received.erase(i);
+    }
+    received.insert(start, end);
+    pTransfer->bytesReceived += end-start;
+}
+
+
+/*!
+ * \brief MulticastReceiver::checkCompleted Replace the old file with a completed one
+ */
+void
+MulticastReceiver::checkCompleted(QString sCategory, QString sFileName) {
+    QString sKey = sCategory + QString("/") + sFileName;
+    transfer *pTransfer = findTransfer(sCategory, sFileName, false);
+    if(!pTransfer || pTransfer->bytesReceived < pTransfer->fileSize)
+        return;
+    pTransfer->pFile->flush();
+    closeTransfer(sKey, false);
+    QString sFullName = categoryMap[sCategory].sDir + sFileName;
+    QFile::remove(sFullName);
+    if(!QFile::rename(partName(sCategory, sFileName), sFullName)) {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Unable to rename %1").arg(partName(sCategory, sFileName)));
+        QFile::remove(partName(sCategory, sFileName));
+        return;
+    }
+    QList<files> &wanted = categoryMap[sCategory].wanted;
+    for(int i=wanted.count()-1; i>=0; i--) {
+        if(wanted.at(i).fileName == sFileName)
+            wanted.removeAt(i);
+    }
+#ifdef LOG_VERBOSE
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               QString("%1 received by multicast").arg(sFullName));
+#endif
+    emit fileCompleted(sCategory, sFileName);
+}
+
+
+/*!
+ * \brief MulticastReceiver::partName
+ * \return The name of the partially received file
+ */
+QString
+MulticastReceiver::partName(QString sCategory, QString sFileName) {
+    return categoryMap.value(sCategory).sDir + sFileName + QString(".mcast");
+}
@@ -0,0 +1,97 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#ifndef MULTICASTRECEIVER_H
+#define MULTICASTRECEIVER_H
+
+#include <QObject>
+#include <QMap>
+#include <QList>
+#include <QPair>
+#include <QHostAddress>
+#include <QElapsedTimer>
+
+#include "fileupdater.h"
+
+QT_FORWARD_DECLARE_CLASS(QFile)
+QT_FORWARD_DECLARE_CLASS(QUdpSocket)
+QT_FORWARD_DECLARE_CLASS(MediaCache)
+
+
+typedef QPair<qint64, qint64> fileRange;/*!< \brief offset and length of a file portion */
+
+
+class MulticastReceiver : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MulticastReceiver(QFile *myLogFile = Q_NULLPTR, QObject *parent = Q_NULLPTR);
+    ~MulticastReceiver();
+
+    void    addCategory(QString sCategory, QString sDir);
+    void    setServerAddress(QString sAddress);
+    void    setCache(MediaCache *pMediaCache);
+    void    setWanted(QString sCategory, QList<files> fileList);
+    bool    isActive(QString sCategory);
+    bool    hasStreamed(QString sCategory);
+    bool    hasPartial(QString sCategory, QString sFileName);
+    qint64  bytesReceived(QString sCategory);
+    QList<fileRange> missingRanges(QString sCategory, QString sFileName);
+    bool    writeRange(QString sCategory, QString sFileName, qint64 offset, const QByteArray &baData);
+    bool    sendNack(QString sCategory, QString sFileName);
+
+public slots:
+    void start();
+    void stop();
+
+signals:
+    void fileCompleted(QString sCategory, QString sFileName);/*!< \brief emitted when a file has been completely received */
+
+private slots:
+    void onDatagramsReady();
+
+private:
+    struct transfer {
+        QFile  *pFile;
+        qint64  fileSize;
+        qint64  bytesReceived;
+        QMap<qint64, qint64> received;// start -> end of the received ranges
+    };
+    struct category {
+        QString      sDir;
+        QList<files> wanted;
+        qint64       lastActivity;
+    };
+    void     processPacket(const QByteArray &datagram);
+    transfer *findTransfer(QString sCategory, QString sFileName, bool bCreate);
+    void     closeTransfer(QString sKey, bool bRemoveFile);
+    void     addRange(transfer *pTransfer, qint64 start, qint64 end);
+    void     checkCompleted(QString sCategory, QString sFileName);
+    QString  partName(QString sCategory, QString sFileName);
+
+private:
+    QFile                    *logFile;
+    QUdpSocket               *pDataSocket;
+    QHostAddress              serverAddress;
+    MediaCache               *pCache;
+    QElapsedTimer             clock;
+    QMap<QString, category>   categoryMap;
+    QMap<QString, transfer>   transferMap;// "category/name" -> transfer
+};
+
+#endif // MULTICASTRECEIVER_H
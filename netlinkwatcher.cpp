@@ -0,0 +1,156 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#include <QtGlobal>
+#include <QFile>
+#include <QSocketNotifier>
+
+#if defined(Q_OS_LINUX)
+    #include <sys/socket.h>
+    #include <linux/netlink.h>
+    #include <linux/rtnetlink.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <errno.h>
+    #include <string.h>
+#endif
+
+#include "netlinkwatcher.h"
+#include "utility.h"
+
+
+#define NETLINK_SETTLE_TIME 100 // In msec: the changes come in bursts
+
+
+/*!
+ * \brief NetlinkWatcher::NetlinkWatcher Watches the network configuration
+ * \param myLogFile The File for logging (if any).
+ * \param parent The parent object.
+ *
+ * Listens to the kernel rtnetlink notifications and emits networkChanged()
+ * as soon as a link goes up or down or an address is added or removed,
+ * so that nobody has to poll the network interfaces.
+ * Available only on Linux: elsewhere isValid() returns false.
+ */
+NetlinkWatcher::NetlinkWatcher(QFile *myLogFile, QObject *parent)
+    : QObject(parent)
+    , logFile(myLogFile)
+    , netlinkFd(-1)
+    , pNotifier(Q_NULLPTR)
+{
+    settleTimer.setSingleShot(true);
+    connect(&settleTimer, SIGNAL(timeout()),
+            this, SIGNAL(networkChanged()));
+#if defined(Q_OS_LINUX)
+    netlinkFd = ::socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if(netlinkFd < 0) {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Unable to open the netlink socket: %1")
+                   .arg(strerror(errno)));
+        return;
+    }
+    struct sockaddr_nl address;
+    memset(&address, 0, sizeof(address));
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+    if(::bind(netlinkFd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0) {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Unable to bind the netlink socket: %1")
+                   .arg(strerror(errno)));
+        ::close(netlinkFd);
+        netlinkFd = -1;
+        return;
+    }
+    pNotifier = new QSocketNotifier(netlinkFd, QSocketNotifier::Read, this);
+    connect(pNotifier, SIGNAL(activated(int)),
+            this, SLOT(onReadable()));
+#endif
+}
+
+
+/*!
+ * \brief NetlinkWatcher::~NetlinkWatcher
+ */
+NetlinkWatcher::~NetlinkWatcher() {
+    if(pNotifier)
+        pNotifier->setEnabled(false);
+#if defined(Q_OS_LINUX)
+    if(netlinkFd >= 0)
+        ::close(netlinkFd);
+#endif
+}
+
+
+/*!
+ * \brief NetlinkWatcher::isValid
+ * \return true if the network changes will be notified
+ */
+bool
+NetlinkWatcher::isValid() {
+    return netlinkFd >= 0;
+}
+
+
+/*!
+ * \brief NetlinkWatcher::onReadable
+ * Invoked when the kernel sent some notifications
+ */
+void
+NetlinkWatcher::onReadable() {
+#if defined(Q_OS_LINUX)
+    char buffer[8192] __attribute__((aligned(__alignof__(struct nlmsghdr))));
+    bool bChanged = false;
+    for(;;) {
+        ssize_t received = ::recv(netlinkFd, buffer, sizeof(buffer), 0);
+        if(received < 0) {
+            if(errno == EINTR)
+                continue;
+            if(errno == ENOBUFS)// We lost some notifications: check anyway
+                bChanged = true;
+            break;
+        }
+        if(received == 0)
+            break;
+        int len = int(received);// NLMSG_OK() compares it with unsigned ints
+        const struct nlmsghdr *pHeader = reinterpret_cast<const struct nlmsghdr *>(buffer);
+        for(; NLMSG_OK(pHeader, len); pHeader = NLMSG_NEXT(pHeader, len)) {
+            switch(pHeader->nlmsg_type) {
+            case RTM_NEWLINK:
+            case RTM_DELLINK:
+            case RTM_NEWADDR:
+            case RTM_DELADDR:
+                bChanged = true;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    if(bChanged) {
+#ifdef LOG_VERBOSE
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Network configuration changed"));
+#endif
+        if(!settleTimer.isActive())
+            settleTimer.start(NETLINK_SETTLE_TIME);
+    }
+#endif
+}
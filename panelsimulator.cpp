@@ -0,0 +1,182 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#include <QDir>
+#include <QFile>
+#include <QTextStream>
+
+#include "panelsimulator.h"
+#include "serverdiscoverer.h"
+#include "scorepanel.h"
+#include "utility.h"
+
+
+#define REPORT_TIME 5000 // In msec
+
+
+/*!
+ * \brief PanelSimulator::PanelSimulator Many Panels in a single process
+ * \param nInstances The number of simulated Panels
+ * \param sBaseDir The folder where to put the Panel folders and the report
+ * \param myLogFile The File for logging (if any).
+ * \param parent The parent object.
+ *
+ * Every simulated Panel runs the real Server discovery, Score Panel and
+ * content synchronization code, with its own folder (for the Spots, the
+ * Slides and its log file), so that the Server can be tested with many
+ * more Panels than the available Raspberry.
+ * The simulated Panels don't start the external media players (ffplay
+ * and the camera), that would be one process per Panel.
+ * Every REPORT_TIME the connect time, the round trip time, the update
+ * latency and the transfer throughput of each Panel are appended to
+ * "simulation.csv" and summarized on the standard output.
+ */
+PanelSimulator::PanelSimulator(int nInstances, QString sBaseDir, QFile *myLogFile, QObject *parent)
+    : QObject(parent)
+    , logFile(myLogFile)
+{
+    if(!sBaseDir.endsWith(QString("/"))) sBaseDir+= QString("/");
+    sReportFileName = QString("%1simulation.csv").arg(sBaseDir);
+    QFile reportFile(sReportFileName);
+    if(reportFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        QTextStream report(&reportFile);
+        report << "time_s,panel,connections,connect_ms,rtt_ms,jitter_ms,latency_ms,sync_Bps\n";
+        reportFile.close();
+    }
+    else {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Unable to open %1").arg(sReportFileName));
+    }
+
+    for(int i=0; i<nInstances; i++) {
+        instance newInstance;
+        newInstance.sDir = QString("%1panel%2/").arg(sBaseDir).arg(i+1, 2, 10, QChar('0'));
+        QDir().mkpath(newInstance.sDir);
+        newInstance.pLogFile = Q_NULLPTR;
+#ifdef LOG_MESG
+        newInstance.pLogFile = new QFile(newInstance.sDir + QString("volley_panel.txt"));
+        if(!newInstance.pLogFile->open(QIODevice::WriteOnly)) {
+            delete newInstance.pLogFile;
+            newInstance.pLogFile = Q_NULLPTR;
+        }
+#endif
+        newInstance.pDiscoverer = new ServerDiscoverer(newInstance.pLogFile, this);
+        newInstance.pDiscoverer->setBaseDir(newInstance.sDir);
+        newInstance.pDiscoverer->setMediaEnabled(false);
+        instanceList.append(newInstance);
+    }
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               QString("Simulating %1 Panels in %2").arg(nInstances).arg(sBaseDir));
+
+    clock.start();
+    connect(&reportTimer, SIGNAL(timeout()),
+            this, SLOT(onTimeToReport()));
+    reportTimer.start(REPORT_TIME);
+}
+
+
+/*!
+ * \brief PanelSimulator::~PanelSimulator
+ */
+PanelSimulator::~PanelSimulator() {
+    reportTimer.stop();
+    for(int i=0; i<instanceList.count(); i++) {
+        delete instanceList.at(i).pDiscoverer;// It may still log
+        if(instanceList.at(i).pLogFile) {
+            instanceList.at(i).pLogFile->close();
+            delete instanceList.at(i).pLogFile;
+        }
+    }
+    instanceList.clear();
+}
+
+
+/*!
+ * \brief PanelSimulator::discoverers
+ * \return The Server Discoverers of the simulated Panels
+ */
+QList<ServerDiscoverer*>
+PanelSimulator::discoverers() {
+    QList<ServerDiscoverer*> discovererList;
+    for(int i=0; i<instanceList.count(); i++)
+        discovererList.append(instanceList.at(i).pDiscoverer);
+    return discovererList;
+}
+
+
+/*!
+ * \brief PanelSimulator::onTimeToReport
+ * Append the Panels statistics to the report and print a summary
+ */
+void
+PanelSimulator::onTimeToReport() {
+    QFile reportFile(sReportFileName);
+    bool bReport = reportFile.open(QIODevice::Append | QIODevice::Text);
+    QTextStream report(&reportFile);
+    qint64 seconds = clock.elapsed()/1000;
+
+    int    nConnected     = 0;
+    qint64 maxConnectTime = 0;
+    double sumLatency     = 0.0;
+    double maxLatency     = 0.0;
+    int    nLatencies     = 0;
+    qint64 totalThroughput = 0;
+    for(int i=0; i<instanceList.count(); i++) {
+        ServerDiscoverer *pDiscoverer = instanceList.at(i).pDiscoverer;
+        ScorePanel *pPanel = pDiscoverer->scorePanel();
+        double rtt      = pPanel ? pPanel->rttMean()       : -1.0;
+        double jitter   = pPanel ? pPanel->rttJitter()     : 0.0;
+        double latency  = pPanel ? pPanel->updateLatency() : -1.0;
+        qint64 throughput = pPanel ? pPanel->syncThroughput() : 0;
+        if(rtt >= 0.0)
+            nConnected++;
+        maxConnectTime = qMax(maxConnectTime, pDiscoverer->lastConnectTime());
+        if(latency >= 0.0) {
+            sumLatency += latency;
+            maxLatency  = qMax(maxLatency, latency);
+            nLatencies++;
+        }
+        totalThroughput += throughput;
+        if(bReport) {
+            report << QString("%1,%2,%3,%4,%5,%6,%7,%8\n")
+                      .arg(seconds)
+                      .arg(i+1)
+                      .arg(pDiscoverer->connectionCount())
+                      .arg(pDiscoverer->lastConnectTime())
+                      .arg(rtt, 0, 'f', 1)
+                      .arg(jitter, 0, 'f', 1)
+                      .arg(latency, 0, 'f', 1)
+                      .arg(throughput);
+        }
+    }
+    if(bReport)
+        reportFile.close();
+
+    QTextStream out(stdout);
+    out << QString("%1 s: %2/%3 Panels alive, max connect %4 ms, latency mean %5 max %6 ms, sync %7 kB/s\n")
+           .arg(seconds)
+           .arg(nConnected)
+           .arg(instanceList.count())
+           .arg(maxConnectTime)
+           .arg(nLatencies ? sumLatency/nLatencies : -1.0, 0, 'f', 1)
+           .arg(nLatencies ? maxLatency : -1.0, 0, 'f', 1)
+           .arg(totalThroughput/1024);
+    out.flush();
+}
@@ -0,0 +1,58 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#ifndef PANELSIMULATOR_H
+#define PANELSIMULATOR_H
+
+#include <QObject>
+#include <QList>
+#include <QTimer>
+#include <QElapsedTimer>
+
+QT_FORWARD_DECLARE_CLASS(QFile)
+QT_FORWARD_DECLARE_CLASS(ServerDiscoverer)
+
+
+class PanelSimulator : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PanelSimulator(int nInstances, QString sBaseDir,
+                            QFile *myLogFile=Q_NULLPTR, QObject *parent=Q_NULLPTR);
+    ~PanelSimulator();
+    QList<ServerDiscoverer*> discoverers();
+
+private slots:
+    void onTimeToReport();
+
+private:
+    struct instance {
+        ServerDiscoverer *pDiscoverer;
+        QFile            *pLogFile;
+        QString           sDir;
+    };
+
+private:
+    QFile                *logFile;
+    QList<instance>       instanceList;
+    QString               sReportFileName;
+    QTimer                reportTimer;
+    QElapsedTimer         clock;
+};
+
+#endif // PANELSIMULATOR_H
@@ -0,0 +1,606 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#include <algorithm>
+#include <climits>
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QUdpSocket>
+#include <QWebSocket>
+#include <QWebSocketServer>
+#include <QNetworkInterface>
+#include <QCryptographicHash>
+
+#include "peerserver.h"
+#include "utility.h"
+
+
+#define PEER_ANNOUNCE_PORT  45457
+#define PEER_GROUP          "239.255.45.57"
+#define PEER_ANNOUNCE_TIME  5000  // In msec
+#define PEER_CHANGE_DELAY   500   // In msec: announce soon a new file
+#define PEER_TIMEOUT        15000 // In msec: a silent peer is forgotten
+#define PEER_FAILURE_TIME   30000 // In msec: a failed peer is not used
+#define MAX_PEER_CLIENTS    8
+#define MAX_PEER_CHUNK      1024*1024
+
+
+/*!
+ * \brief PeerServer::PeerServer Shares the local media with the other panels
+ * \param port The port where to serve the files (0 = any free port)
+ * \param myLogFile The File for logging (if any).
+ * \param parent The parent object.
+ *
+ * Each panel serves its complete and verified media (i.e. the files
+ * listed by the Server, with the same size and MD5 digest) to the other panels,
+ * with the same chunk protocol used by the Server:
+ * ws://address:port/category then <send_file_list> and <get>.
+ * Every PEER_ANNOUNCE_TIME ms each panel multicasts:
+ * <peer>port;category,digest,bitmap;...</peer>
+ * where digest identifies the Server manifest and bitmap (in hex)
+ * tells which files of the manifest the panel holds.
+ * The File Updaters then pull the files from the nearest peer holding
+ * them and fall back to the Server when no peer can help.
+ *
+ * It must live in the same Thread of the File Updaters.
+ */
+PeerServer::PeerServer(quint16 port, QFile *myLogFile, QObject *parent)
+    : QObject(parent)
+    , logFile(myLogFile)
+    , listenPort(port)
+    , pWebServer(Q_NULLPTR)
+    , pAnnounceSocket(Q_NULLPTR)
+{
+    mySeed = quint32(rand());
+    clock.start();
+    connect(&announceTimer, SIGNAL(timeout()),
+            this, SLOT(onTimeToAnnounce()));
+}
+
+
+/*!
+ * \brief PeerServer::~PeerServer
+ */
+PeerServer::~PeerServer() {
+    stop();
+}
+
+
+/*!
+ * \brief PeerServer::addCategory Share the files of a category
+ */
+void
+PeerServer::addCategory(QString sCategory, QString sDir) {
+    if(!sDir.endsWith(QString("/"))) sDir+= QString("/");
+    category newCategory;
+    newCategory.sDir = sDir;
+    categoryMap.insert(sCategory, newCategory);
+}
+
+
+/*!
+ * \brief PeerServer::setManifest The files of a category, as listed by the Server
+ */
+void
+PeerServer::setManifest(QString sCategory, QList<files> fileList) {
+    if(!categoryMap.contains(sCategory))
+        return;
+    std::sort(fileList.begin(), fileList.end(),
+              [](const files &a, const files &b) { return a.fileName < b.fileName; });
+    QByteArray baList;
+    for(int i=0; i<fileList.count(); i++)
+        baList.append(QString("%1;%2;%3,")
+                      .arg(fileList.at(i).fileName)
+                      .arg(fileList.at(i).fileSize)
+                      .arg(fileList.at(i).fileDigest)
+                      .toUtf8());
+    category &cat = categoryMap[sCategory];
+    cat.manifest = fileList;
+    cat.sDigest  = QString(QCryptographicHash::hash(baList, QCryptographicHash::Md5).toHex().left(8));
+    contentChanged();
+}
+
+
+/*!
+ * \brief PeerServer::contentChanged To be called when a new file is available
+ */
+void
+PeerServer::contentChanged() {
+    if(announceTimer.isActive())
+        announceTimer.start(PEER_CHANGE_DELAY);
+}
+
+
+/*!
+ * \brief PeerServer::holders
+ * \return The urls of the peers holding a file, the nearest first
+ */
+QList<QUrl>
+PeerServer::holders(QString sCategory, QString sFileName, qint64 fileSize) {
+    QList<QUrl> urls;
+    if(!categoryMap.contains(sCategory))
+        return urls;
+    const category &cat = categoryMap[sCategory];
+    int iFile = manifestIndex(cat, sFileName, fileSize);
+    if(iFile < 0)
+        return urls;
+    qint64 now = clock.elapsed();
+    QList<peer> candidates;
+    QMapIterator<QString, peer> i(peerMap);
+    while(i.hasNext()) {
+        i.next();
+        const peer &p = i.value();
+        if(now-p.lastSeen > PEER_TIMEOUT || now < p.failedUntil)
+            continue;
+        if(p.digestMap.value(sCategory) != cat.sDigest)
+            continue;// A different manifest
+        QByteArray held = p.heldMap.value(sCategory);
+        if(iFile/8 >= held.size() || !(quint8(held.at(iFile/8)) & (1 << (iFile%8))))
+            continue;
+        candidates.append(p);
+    }
+    // The nearest: same subnet first, then the fastest to answer
+    std::sort(candidates.begin(), candidates.end(),
+              [this](const peer &a, const peer &b) {
+                  bool aNear = isNear(a.address);
+                  bool bNear = isNear(b.address);
+                  if(aNear != bNear)
+                      return aNear;
+                  int aRtt = a.rtt < 0 ? INT_MAX : a.rtt;
+                  int bRtt = b.rtt < 0 ? INT_MAX : b.rtt;
+                  return aRtt < bRtt;
+              });
+    for(int j=0; j<candidates.count(); j++)
+        urls.append(QUrl(QString("ws://%1:%2/%3")
+                         .arg(candidates.at(j).address.toString())
+                         .arg(candidates.at(j).port)
+                         .arg(sCategory)));
+    return urls;
+}
+
+
+/*!
+ * \brief PeerServer::reportRtt Record the time a peer took to accept a connection
+ */
+void
+PeerServer::reportRtt(QUrl peerUrl, int msec) {
+    QString sKey = peerKey(peerUrl);
+    if(!peerMap.contains(sKey))
+        return;
+    peer &p = peerMap[sKey];
+    p.rtt = (p.rtt < 0) ? msec : (3*p.rtt + msec)/4;
+}
+
+
+/*!
+ * \brief PeerServer::reportFailure Don't use a peer for a while
+ */
+void
+PeerServer::reportFailure(QUrl peerUrl) {
+    QString sKey = peerKey(peerUrl);
+    if(!peerMap.contains(sKey))
+        return;
+    peerMap[sKey].failedUntil = clock.elapsed() + PEER_FAILURE_TIME;
+}
+
+
+/*!
+ * \brief PeerServer::seed
+ * \return A random number, different for each panel
+ */
+quint32
+PeerServer::seed() {
+    return mySeed;
+}
+
+
+/*!
+ * \brief PeerServer::isListening
+ */
+bool
+PeerServer::isListening() {
+    return pWebServer && pWebServer->isListening();
+}
+
+
+/*!
+ * \brief PeerServer::start Start serving and announcing the local files
+ */
+void
+PeerServer::start() {
+    if(isListening())
+        return;
+    localEntries.clear();
+    QList<QNetworkInterface> ifaces = QNetworkInterface::allInterfaces();
+    for(int i=0; i<ifaces.count(); i++) {
+        if(ifaces.at(i).flags().testFlag(QNetworkInterface::IsUp))
+            localEntries.append(ifaces.at(i).addressEntries());
+    }
+    pWebServer = new QWebSocketServer(QString("Peer Server"),
+                                      QWebSocketServer::NonSecureMode,
+                                      this);
+    if(!pWebServer->listen(QHostAddress::AnyIPv4, listenPort)) {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Unable to listen on port %1: %2")
+                   .arg(listenPort)
+                   .arg(pWebServer->errorString()));
+        delete pWebServer;
+        pWebServer = Q_NULLPTR;
+        return;
+    }
+    connect(pWebServer, SIGNAL(newConnection()),
+            this, SLOT(onNewConnection()));
+
+    pAnnounceSocket = new QUdpSocket(this);
+    if(!pAnnounceSocket->bind(QHostAddress::AnyIPv4, PEER_ANNOUNCE_PORT,
+                              QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint))
+    {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Unable to bind the Peer Announce Socket"));
+    }
+    else {
+        pAnnounceSocket->joinMulticastGroup(QHostAddress(PEER_GROUP));
+        pAnnounceSocket->setSocketOption(QAbstractSocket::MulticastTtlOption, 1);
+        // Needed to see the panels running on the same host
+        pAnnounceSocket->setSocketOption(QAbstractSocket::MulticastLoopbackOption, 1);
+        connect(pAnnounceSocket, SIGNAL(readyRead()),
+                this, SLOT(onAnnouncementReceived()));
+    }
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               QString("Sharing the media on port %1")
+               .arg(pWebServer->serverPort()));
+    announceTimer.start(PEER_CHANGE_DELAY);
+}
+
+
+/*!
+ * \brief PeerServer::stop Stop serving the local files
+ */
+void
+PeerServer::stop() {
+    announceTimer.stop();
+    for(int i=0; i<clientList.count(); i++) {
+        clientList.at(i)->disconnect();
+        clientList.at(i)->abort();
+        clientList.at(i)->deleteLater();
+    }
+    clientList.clear();
+    if(pWebServer) {
+        pWebServer->close();
+        pWebServer->deleteLater();
+        pWebServer = Q_NULLPTR;
+    }
+    if(pAnnounceSocket) {
+        pAnnounceSocket->disconnect();
+        pAnnounceSocket->close();
+        pAnnounceSocket->deleteLater();
+        pAnnounceSocket = Q_NULLPTR;
+    }
+    peerMap.clear();
+}
+
+
+/*!
+ * \brief PeerServer::onNewConnection A panel wants our files
+ */
+void
+PeerServer::onNewConnection() {
+    while(pWebServer->hasPendingConnections()) {
+        QWebSocket *pClient = pWebServer->nextPendingConnection();
+        QString sCategory = pClient->requestUrl().path().mid(1);
+        if(!categoryMap.contains(sCategory) || clientList.count() >= MAX_PEER_CLIENTS) {
+            // The peer will turn to someone else
+            pClient->close(QWebSocketProtocol::CloseCodeGoingAway);
+            pClient->deleteLater();
+            continue;
+        }
+        pClient->setObjectName(sCategory);
+        connect(pClient, SIGNAL(textMessageReceived(QString)),
+                this, SLOT(onPeerRequest(QString)));
+        connect(pClient, SIGNAL(disconnected()),
+                this, SLOT(onClientDisconnected()));
+        clientList.append(pClient);
+#ifdef LOG_VERBOSE
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("%1 connected for %2")
+                   .arg(pClient->peerAddress().toString())
+                   .arg(sCategory));
+#endif
+    }
+}
+
+
+/*!
+ * \brief PeerServer::onPeerRequest Serve the requests of a peer
+ * \param sMessage <send_file_list> or <get>name,offset,length</get>
+ */
+void
+PeerServer::onPeerRequest(QString sMessage) {
+    QWebSocket *pClient = qobject_cast<QWebSocket *>(sender());
+    if(!pClient || !categoryMap.contains(pClient->objectName()))
+        return;
+    const category &cat = categoryMap[pClient->objectName()];
+    QString sNoData = QString("NoData");
+    QString sToken;
+
+    sToken = XML_Parse(sMessage, "send_file_list");
+    if(sToken != sNoData) {
+        QStringList heldFiles;
+        for(int i=0; i<cat.manifest.count(); i++) {
+            if(isHeld(cat, i))
+                heldFiles.append(QString("%1;%2;%3")
+                                 .arg(cat.manifest.at(i).fileName)
+                                 .arg(cat.manifest.at(i).fileSize)
+                                 .arg(cat.manifest.at(i).fileDigest));
+        }
+        pClient->sendTextMessage(QString("<file_list>%1</file_list>")
+                                 .arg(heldFiles.join(QString(","))));
+        return;
+    }
+
+    sToken = XML_Parse(sMessage, "get");
+    if(sToken != sNoData) {
+        QByteArray baChunk = fileChunk(cat, sToken);
+        if(baChunk.isEmpty()) {// We can't help: the peer will turn to someone else
+            logMessage(logFile,
+                       Q_FUNC_INFO,
+                       QString("Unable to serve %1 to %2")
+                       .arg(sToken)
+                       .arg(pClient->peerAddress().toString()));
+            pClient->close(QWebSocketProtocol::CloseCodeBadOperation);
+            return;
+        }
+        pClient->sendBinaryMessage(baChunk);
+    }
+}
+
+
+/*!
+ * \brief PeerServer::onClientDisconnected
+ */
+void
+PeerServer::onClientDisconnected() {
+    QWebSocket *pClient = qobject_cast<QWebSocket *>(sender());
+    if(!pClient)
+        return;
+    clientList.removeAll(pClient);
+    pClient->deleteLater();
+}
+
+
+/*!
+ * \brief PeerServer::onTimeToAnnounce Tell the other panels what we hold
+ */
+void
+PeerServer::onTimeToAnnounce() {
+    announceTimer.start(PEER_ANNOUNCE_TIME);
+    if(!pAnnounceSocket || !isListening())
+        return;
+    QStringList categoryList;
+    QMapIterator<QString, category> i(categoryMap);
+    while(i.hasNext()) {
+        i.next();
+        const category &cat = i.value();
+        if(cat.sDigest.isEmpty())
+            continue;// No manifest yet
+        QByteArray held((cat.manifest.count()+7)/8, '\0');
+        for(int j=0; j<cat.manifest.count(); j++) {
+            if(isHeld(cat, j))
+                held[j/8] = char(quint8(held.at(j/8)) | (1 << (j%8)));
+        }
+        categoryList.append(QString("%1,%2,%3")
+                            .arg(i.key())
+                            .arg(cat.sDigest)
+                            .arg(QString(held.toHex())));
+    }
+    if(categoryList.isEmpty())
+        return;
+    QByteArray datagram = QString("<peer>%1;%2</peer>")
+                          .arg(pWebServer->serverPort())
+                          .arg(categoryList.join(QString(";")))
+                          .toUtf8();
+    qint64 written = pAnnounceSocket->writeDatagram(datagram, QHostAddress(PEER_GROUP), PEER_ANNOUNCE_PORT);
+    if(written != datagram.size()) {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Unable to announce the local media"));
+    }
+}
+
+
+/*!
+ * \brief PeerServer::onAnnouncementReceived Learn what the other panels hold
+ */
+void
+PeerServer::onAnnouncementReceived() {
+    QByteArray datagram;
+    QHostAddress senderAddress;
+    while(pAnnounceSocket->hasPendingDatagrams()) {
+        datagram.resize(int(pAnnounceSocket->pendingDatagramSize()));
+        if(pAnnounceSocket->readDatagram(datagram.data(), datagram.size(), &senderAddress) == -1)
+            continue;
+        QString sToken = XML_Parse(QString::fromUtf8(datagram), "peer");
+        if(sToken == QString("NoData"))
+            continue;
+        QStringList fields = sToken.split(";", Qt::SkipEmptyParts);
+        if(fields.isEmpty())
+            continue;
+        bool bOk;
+        quint16 port = fields.at(0).toUShort(&bOk);
+        if(!bOk || port == 0)
+            continue;
+        // Ignore our own announcements
+        if(port == pWebServer->serverPort() &&
+           (senderAddress.isLoopback() || QNetworkInterface::allAddresses().contains(senderAddress)))
+            continue;
+        if(senderAddress.protocol() == QAbstractSocket::IPv6Protocol) {
+            bool bIsIPv4;
+            quint32 ipv4 = senderAddress.toIPv4Address(&bIsIPv4);
+            if(bIsIPv4) senderAddress = QHostAddress(ipv4);
+        }
+        QString sKey = QString("%1:%2").arg(senderAddress.toString()).arg(port);
+        if(!peerMap.contains(sKey)) {
+            peer newPeer;
+            newPeer.address     = senderAddress;
+            newPeer.port        = port;
+            newPeer.failedUntil = 0;
+            newPeer.rtt         = -1;
+            peerMap.insert(sKey, newPeer);
+#ifdef LOG_VERBOSE
+            logMessage(logFile,
+                       Q_FUNC_INFO,
+                       QString("New peer: %1").arg(sKey));
+#endif
+        }
+        peer &p = peerMap[sKey];
+        p.lastSeen = clock.elapsed();
+        p.digestMap.clear();
+        p.heldMap.clear();
+        for(int j=1; j<fields.count(); j++) {
+            QStringList items = fields.at(j).split(",");
+            if(items.count() != 3)
+                continue;
+            p.digestMap.insert(items.at(0), items.at(1));
+            p.heldMap.insert(items.at(0), QByteArray::fromHex(items.at(2).toLatin1()));
+        }
+    }
+    // Forget the silent peers
+    qint64 now = clock.elapsed();
+    QMutableMapIterator<QString, peer> i(peerMap);
+    while(i.hasNext()) {
+        i.next();
+        if(now-i.value().lastSeen > PEER_TIMEOUT)
+            i.remove();
+    }
+}
+
+
+/*!
+ * \brief PeerServer::isHeld
+ * \return true if the file of the manifest is on our disk with its digest
+ *
+ * The files listed without a digest can't be verified and are never shared.
+ */
+bool
+PeerServer::isHeld(const category &cat, int iFile) {
+    const files &listed = cat.manifest.at(iFile);
+    if(listed.fileDigest.isEmpty())
+        return false;
+    QString sFilePath = cat.sDir + listed.fileName;
+    QFileInfo fileInfo(sFilePath);
+    if(!fileInfo.exists() || (fileInfo.size() != listed.fileSize))
+        return false;
+    qint64 lastModified = fileInfo.lastModified().toMSecsSinceEpoch();
+    if(!checkedMap.contains(sFilePath) ||
+       checkedMap[sFilePath].fileSize != fileInfo.size() ||
+       checkedMap[sFilePath].lastModified != lastModified)
+    {
+        checkedFile checked;
+        checked.fileSize     = fileInfo.size();
+        checked.lastModified = lastModified;
+        checked.sDigest      = fileMd5(sFilePath);
+        checkedMap.insert(sFilePath, checked);
+    }
+    return checkedMap[sFilePath].sDigest == listed.fileDigest;
+}
+
+
+/*!
+ * \brief PeerServer::manifestIndex
+ * \return The index of a file in the manifest or -1
+ */
+int
+PeerServer::manifestIndex(const category &cat, QString sFileName, qint64 fileSize) {
+    for(int i=0; i<cat.manifest.count(); i++) {
+        if(cat.manifest.at(i).fileName == sFileName)
+            return (cat.manifest.at(i).fileSize == fileSize) ? i : -1;
+    }
+    return -1;
+}
+
+
+/*!
+ * \brief PeerServer::isNear
+ * \return true if the address is on one of our subnets
+ */
+bool
+PeerServer::isNear(const QHostAddress &address) {
+    for(int i=0; i<localEntries.count(); i++) {
+        if(address.isInSubnet(localEntries.at(i).ip(), localEntries.at(i).prefixLength()))
+            return true;
+    }
+    return false;
+}
+
+
+/*!
+ * \brief PeerServer::peerKey
+ * \return The key identifying the peer serving an url
+ */
+QString
+PeerServer::peerKey(QUrl peerUrl) {
+    return QString("%1:%2").arg(peerUrl.host()).arg(peerUrl.port());
+}
+
+
+/*!
+ * \brief PeerServer::fileChunk Read the chunk of a file requested by a peer
+ * \param sRequest name,offset,length
+ * \return The chunk (with the file header when offset is 0) or an empty array
+ */
+QByteArray
+PeerServer::fileChunk(const category &cat, QString sRequest) {
+    QStringList items = sRequest.split(",");
+    if(items.count() < 3)
+        return QByteArray();
+    qint64 length = items.takeLast().toLongLong();
+    qint64 offset = items.takeLast().toLongLong();
+    QString sFileName = items.join(QString(","));
+    int iFile = -1;
+    for(int i=0; i<cat.manifest.count(); i++) {
+        if(cat.manifest.at(i).fileName == sFileName)
+            iFile = i;
+    }
+    // Only the verified files are served
+    if(iFile < 0 || !isHeld(cat, iFile))
+        return QByteArray();
+    qint64 fileSize = cat.manifest.at(iFile).fileSize;
+    if(offset < 0 || offset >= fileSize || length <= 0)
+        return QByteArray();
+    QFile file(cat.sDir + sFileName);
+    if(!file.open(QIODevice::ReadOnly) || !file.seek(offset))
+        return QByteArray();
+    QByteArray baChunk;
+    if(offset == 0)
+        baChunk = QString("%1,%2")
+                  .arg(sFileName)
+                  .arg(fileSize)
+                  .toUtf8()
+                  .leftJustified(1024, '\0', true);
+    baChunk.append(file.read(qMin(length, qint64(MAX_PEER_CHUNK))));
+    file.close();
+    if(baChunk.size() <= (offset == 0 ? 1024 : 0))
+        return QByteArray();
+    return baChunk;
+}
@@ -0,0 +1,107 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#ifndef PEERSERVER_H
+#define PEERSERVER_H
+
+#include <QObject>
+#include <QMap>
+#include <QList>
+#include <QUrl>
+#include <QTimer>
+#include <QHostAddress>
+#include <QElapsedTimer>
+#include <QNetworkAddressEntry>
+
+#include "fileupdater.h"
+
+QT_FORWARD_DECLARE_CLASS(QFile)
+QT_FORWARD_DECLARE_CLASS(QUdpSocket)
+QT_FORWARD_DECLARE_CLASS(QWebSocket)
+QT_FORWARD_DECLARE_CLASS(QWebSocketServer)
+
+
+class PeerServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PeerServer(quint16 port, QFile *myLogFile = Q_NULLPTR, QObject *parent = Q_NULLPTR);
+    ~PeerServer();
+
+    void        addCategory(QString sCategory, QString sDir);
+    void        setManifest(QString sCategory, QList<files> fileList);
+    void        contentChanged();
+    QList<QUrl> holders(QString sCategory, QString sFileName, qint64 fileSize);
+    void        reportRtt(QUrl peerUrl, int msec);
+    void        reportFailure(QUrl peerUrl);
+    quint32     seed();
+    bool        isListening();
+
+public slots:
+    void start();
+    void stop();
+
+private slots:
+    void onNewConnection();
+    void onPeerRequest(QString sMessage);
+    void onClientDisconnected();
+    void onTimeToAnnounce();
+    void onAnnouncementReceived();
+
+private:
+    struct category {
+        QString      sDir;
+        QList<files> manifest;// Sorted by name
+        QString      sDigest; // Identifies the manifest
+    };
+    struct peer {
+        QHostAddress address;
+        quint16      port;
+        qint64       lastSeen;
+        qint64       failedUntil;
+        int          rtt;     // In msec (-1 if unknown)
+        QMap<QString, QString>    digestMap;
+        QMap<QString, QByteArray> heldMap;
+    };
+    struct checkedFile {
+        qint64       fileSize;
+        qint64       lastModified;
+        QString      sDigest; // Of the content
+    };
+    bool       isHeld(const category &cat, int iFile);
+    int        manifestIndex(const category &cat, QString sFileName, qint64 fileSize);
+    bool       isNear(const QHostAddress &address);
+    QString    peerKey(QUrl peerUrl);
+    QByteArray fileChunk(const category &cat, QString sRequest);
+
+private:
+    QFile                    *logFile;
+    quint16                   listenPort;
+    quint32                   mySeed;
+    QWebSocketServer         *pWebServer;
+    QList<QWebSocket *>       clientList;
+    QUdpSocket               *pAnnounceSocket;
+    QTimer                    announceTimer;
+    QElapsedTimer             clock;
+    QList<QNetworkAddressEntry> localEntries;
+    QMap<QString, category>   categoryMap;
+    QMap<QString, peer>       peerMap;
+    QMap<QString, checkedFile> checkedMap;// By path: digests are computed once per file version
+};
+
+#endif // PEERSERVER_H
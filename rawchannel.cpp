@@ -0,0 +1,416 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#include <QtGlobal>
+#include <QFile>
+#include <QHostAddress>
+#include <QSocketNotifier>
+#include <QtEndian>
+
+#if defined(Q_OS_UNIX)
+    #include <sys/types.h>
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <arpa/inet.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <errno.h>
+    #include <stdlib.h>
+    #include <string.h>
+#endif
+
+#include "rawchannel.h"
+#include "utility.h"
+
+
+#define RAW_BUFFER_SIZE  256*1024
+#define RAW_SOCKET_BUFFER 4*1024*1024
+
+#if defined(Q_OS_UNIX) && !defined(MSG_NOSIGNAL)
+    #define MSG_NOSIGNAL 0
+#endif
+
+
+/*!
+ * \brief RawChannel::RawChannel A plain TCP channel for the bulk file data
+ * \param myLogFile The File for logging (if any).
+ * \param parent The parent object.
+ *
+ * The requests still travel on the File Server WebSocket
+ * (<get_raw>name,offset,length</get_raw>): the Server answers on this
+ * TCP connection with a RAW_HEADER_SIZE bytes header (the offset and the
+ * length of the data) followed by the data.
+ * Just connected, the channel sends the RAW_TOKEN_SIZE bytes token that
+ * the Panel announced on the WebSocket (<raw_token>token</raw_token>):
+ * this is how the Server pairs the two connections.
+ * The data are moved from the socket to the destination file without
+ * any per-frame allocation: with splice() (through a pipe, without
+ * ever reaching user space) where available, otherwise with recv()
+ * into a single page aligned buffer and pwrite().
+ * Available only on Unix systems.
+ */
+RawChannel::RawChannel(QFile *myLogFile, QObject *parent)
+    : QObject(parent)
+    , logFile(myLogFile)
+    , sockFd(-1)
+    , fileFd(-1)
+    , pReadNotifier(Q_NULLPTR)
+    , pWriteNotifier(Q_NULLPTR)
+    , pBuffer(Q_NULLPTR)
+    , headerBytes(0)
+    , fileOffset(0)
+    , payloadLeft(0)
+    , maxPayload(0)
+    , bConnected(false)
+    , bSplice(false)
+    , token(0)
+{
+    pipeFds[0] = pipeFds[1] = -1;
+#if defined(Q_OS_UNIX)
+    void *pMemory = Q_NULLPTR;
+    if(posix_memalign(&pMemory, size_t(sysconf(_SC_PAGESIZE)), RAW_BUFFER_SIZE) == 0)
+        pBuffer = static_cast<char *>(pMemory);
+#endif
+#if defined(Q_OS_LINUX)
+    if(pipe2(pipeFds, O_CLOEXEC | O_NONBLOCK) == 0) {
+        fcntl(pipeFds[1], F_SETPIPE_SZ, RAW_BUFFER_SIZE);
+        bSplice = true;
+    }
+#endif
+}
+
+
+/*!
+ * \brief RawChannel::~RawChannel
+ */
+RawChannel::~RawChannel() {
+    close();
+#if defined(Q_OS_UNIX)
+    if(pipeFds[0] >= 0) ::close(pipeFds[0]);
+    if(pipeFds[1] >= 0) ::close(pipeFds[1]);
+    free(pBuffer);
+#endif
+}
+
+
+/*!
+ * \brief RawChannel::open Connect (asynchronously) to the Server
+ * \param sHost The Server IPv4 address
+ * \param port The Server raw transfer port
+ * \param myToken The token that identifies the connection to the Server
+ * \return false if the connection can't even be attempted
+ */
+bool
+RawChannel::open(QString sHost, quint16 port, quint64 myToken) {
+    close();
+    token = myToken;
+#if defined(Q_OS_UNIX)
+    QHostAddress address(sHost);
+    if(!pBuffer || address.protocol() != QAbstractSocket::IPv4Protocol)
+        return false;
+    sockFd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if(sockFd < 0)
+        return false;
+    fcntl(sockFd, F_SETFD, FD_CLOEXEC);
+    fcntl(sockFd, F_SETFL, fcntl(sockFd, F_GETFL) | O_NONBLOCK);
+    int bufferSize = RAW_SOCKET_BUFFER;
+    setsockopt(sockFd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+    struct sockaddr_in serverAddress;
+    memset(&serverAddress, 0, sizeof(serverAddress));
+    serverAddress.sin_family      = AF_INET;
+    serverAddress.sin_port        = htons(port);
+    serverAddress.sin_addr.s_addr = htonl(address.toIPv4Address());
+    if(::connect(sockFd, reinterpret_cast<struct sockaddr *>(&serverAddress), sizeof(serverAddress)) < 0 &&
+       errno != EINPROGRESS)
+    {
+        sErrorString = QString(strerror(errno));
+        ::close(sockFd);
+        sockFd = -1;
+        return false;
+    }
+    pWriteNotifier = new QSocketNotifier(sockFd, QSocketNotifier::Write, this);
+    connect(pWriteNotifier, SIGNAL(activated(int)),
+            this, SLOT(onWritable()));
+    return true;
+#else
+    Q_UNUSED(sHost)
+    Q_UNUSED(port)
+    Q_UNUSED(myToken)
+    sErrorString = QString("Not available on this system");
+    return false;
+#endif
+}
+
+
+/*!
+ * \brief RawChannel::close Close the connection (and the target file)
+ */
+void
+RawChannel::close() {
+    closeTarget();
+    if(pWriteNotifier) {
+        pWriteNotifier->setEnabled(false);
+        pWriteNotifier->deleteLater();
+        pWriteNotifier = Q_NULLPTR;
+    }
+    if(pReadNotifier) {
+        pReadNotifier->setEnabled(false);
+        pReadNotifier->deleteLater();
+        pReadNotifier = Q_NULLPTR;
+    }
+#if defined(Q_OS_UNIX)
+    if(sockFd >= 0)
+        ::close(sockFd);
+    // Discard what an interrupted splice() left in the pipe
+    if(pipeFds[0] >= 0 && pBuffer)
+        while(::read(pipeFds[0], pBuffer, RAW_BUFFER_SIZE) > 0) {}
+#endif
+    sockFd      = -1;
+    bConnected  = false;
+    headerBytes = 0;
+    payloadLeft = 0;
+}
+
+
+/*!
+ * \brief RawChannel::isConnected
+ */
+bool
+RawChannel::isConnected() {
+    return bConnected;
+}
+
+
+/*!
+ * \brief RawChannel::setTarget Where to write the data that will be received
+ * \param sFileName The destination file (truncated if offset is 0)
+ * \param offset The file position of the data requested
+ * \param maxLength The length of the data requested (a longer chunk is an error)
+ * \return false if the file can't be opened
+ */
+bool
+RawChannel::setTarget(QString sFileName, qint64 offset, qint64 maxLength) {
+    closeTarget();
+#if defined(Q_OS_UNIX)
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+    if(offset == 0)
+        flags |= O_TRUNC;
+    fileFd = ::open(QFile::encodeName(sFileName).constData(), flags, 0644);
+    if(fileFd < 0) {
+        sErrorString = QString(strerror(errno));
+        return false;
+    }
+    fileOffset = offset;
+    maxPayload = maxLength;
+    return true;
+#else
+    Q_UNUSED(sFileName)
+    Q_UNUSED(offset)
+    Q_UNUSED(maxLength)
+    return false;
+#endif
+}
+
+
+/*!
+ * \brief RawChannel::closeTarget
+ */
+void
+RawChannel::closeTarget() {
+#if defined(Q_OS_UNIX)
+    if(fileFd >= 0)
+        ::close(fileFd);
+#endif
+    fileFd = -1;
+}
+
+
+/*!
+ * \brief RawChannel::errorString
+ * \return The reason of the last failure
+ */
+QString
+RawChannel::errorString() {
+    return sErrorString;
+}
+
+
+/*!
+ * \brief RawChannel::onWritable The connection attempt has ended
+ *
+ * The token is the first thing sent: the socket buffer is empty, so
+ * it is either sent at once or the channel is unusable.
+ */
+void
+RawChannel::onWritable() {
+#if defined(Q_OS_UNIX)
+    pWriteNotifier->setEnabled(false);
+    pWriteNotifier->deleteLater();
+    pWriteNotifier = Q_NULLPTR;
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if(getsockopt(sockFd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+        fail(QString("Unable to connect: %1").arg(strerror(error ? error : errno)));
+        return;
+    }
+    uchar hello[RAW_TOKEN_SIZE];
+    qToBigEndian<quint64>(token, hello);
+    if(::send(sockFd, hello, RAW_TOKEN_SIZE, MSG_NOSIGNAL) != RAW_TOKEN_SIZE) {
+        fail(QString("Unable to send the token: %1").arg(strerror(errno)));
+        return;
+    }
+    bConnected = true;
+    pReadNotifier = new QSocketNotifier(sockFd, QSocketNotifier::Read, this);
+    connect(pReadNotifier, SIGNAL(activated(int)),
+            this, SLOT(onReadable()));
+    emit connected();
+#endif
+}
+
+
+/*!
+ * \brief RawChannel::onReadable Move the available data to the target file
+ */
+void
+RawChannel::onReadable() {
+    while(sockFd >= 0) {
+        if(payloadLeft == 0) {
+            if(!readHeader())
+                return;
+            continue;
+        }
+        qint64 received = receivePayload(payloadLeft);
+        if(received < 0)// Nothing more for now (or failed)
+            return;
+        if(received == 0) {
+            fail(QString("Connection closed by the Server"));
+            return;
+        }
+        fileOffset  += received;
+        payloadLeft -= received;
+        emit dataReceived(received, payloadLeft == 0);
+    }
+}
+
+
+/*!
+ * \brief RawChannel::readHeader Read (a part of) the header of the next chunk
+ * \return true if a whole header has been read
+ */
+bool
+RawChannel::readHeader() {
+#if defined(Q_OS_UNIX)
+    ssize_t received = ::recv(sockFd, header+headerBytes, size_t(RAW_HEADER_SIZE-headerBytes), 0);
+    if(received < 0) {
+        if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            fail(QString("Receive error: %1").arg(strerror(errno)));
+        return false;
+    }
+    if(received == 0) {
+        fail(QString("Connection closed by the Server"));
+        return false;
+    }
+    headerBytes += int(received);
+    if(headerBytes < RAW_HEADER_SIZE)
+        return false;
+    headerBytes = 0;
+    qint64 offset = qint64(qFromBigEndian<quint64>(header));
+    qint64 length = qint64(qFromBigEndian<quint64>(header+8));
+    if(fileFd < 0 || offset != fileOffset || length < 0 || length > maxPayload) {
+        fail(QString("Unexpected chunk at %1 (%2 bytes)").arg(offset).arg(length));
+        return false;
+    }
+    payloadLeft = length;
+    if(length == 0)// Nothing more to send (end of file)
+        emit dataReceived(0, true);
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+/*!
+ * \brief RawChannel::receivePayload Move data from the socket to the file
+ * \return The bytes moved, 0 if the connection closed, -1 if nothing is available or on error
+ */
+qint64
+RawChannel::receivePayload(qint64 maxBytes) {
+#if defined(Q_OS_UNIX)
+    size_t len = size_t(qMin(maxBytes, qint64(RAW_BUFFER_SIZE)));
+#if defined(Q_OS_LINUX)
+    if(bSplice) {
+        ssize_t moved = splice(sockFd, Q_NULLPTR, pipeFds[1], Q_NULLPTR, len,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(moved > 0) {
+            loff_t offset = fileOffset;
+            ssize_t left = moved;
+            while(left > 0) {
+                ssize_t written = splice(pipeFds[0], Q_NULLPTR, fileFd, &offset, size_t(left),
+                                         SPLICE_F_MOVE);
+                if(written <= 0) {
+                    fail(QString("Error writing the file: %1").arg(strerror(errno)));
+                    return -1;
+                }
+                left -= written;
+            }
+            return moved;
+        }
+        if(moved == 0)
+            return 0;
+        if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return -1;
+        if(errno != EINVAL && errno != ENOSYS) {
+            fail(QString("Receive error: %1").arg(strerror(errno)));
+            return -1;
+        }
+        bSplice = false;// Not supported here: go on with recv()
+    }
+#endif
+    ssize_t received = ::recv(sockFd, pBuffer, len, 0);
+    if(received < 0) {
+        if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            fail(QString("Receive error: %1").arg(strerror(errno)));
+        return -1;
+    }
+    ssize_t done = 0;
+    while(done < received) {
+        ssize_t written = pwrite(fileFd, pBuffer+done, size_t(received-done), off_t(fileOffset+done));
+        if(written <= 0) {
+            fail(QString("Error writing the file: %1").arg(strerror(errno)));
+            return -1;
+        }
+        done += written;
+    }
+    return received;
+#else
+    Q_UNUSED(maxBytes)
+    return -1;
+#endif
+}
+
+
+/*!
+ * \brief RawChannel::fail Close the channel and report the error
+ */
+void
+RawChannel::fail(QString sError) {
+    sErrorString = sError;
+    close();
+    emit failed(sError);
+}
@@ -0,0 +1,84 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#ifndef RAWCHANNEL_H
+#define RAWCHANNEL_H
+
+#include <QObject>
+
+QT_FORWARD_DECLARE_CLASS(QFile)
+QT_FORWARD_DECLARE_CLASS(QSocketNotifier)
+
+
+#define RAW_HEADER_SIZE 16 // offset (8) and length (8), big endian
+#define RAW_TOKEN_SIZE  8  // The token sent to the Server at connection, big endian
+
+
+class RawChannel : public QObject
+{
+    Q_OBJECT
+public:
+    explicit RawChannel(QFile *myLogFile = Q_NULLPTR, QObject *parent = Q_NULLPTR);
+    ~RawChannel();
+
+    bool    open(QString sHost, quint16 port, quint64 myToken);
+    void    close();
+    bool    isConnected();
+    bool    setTarget(QString sFileName, qint64 offset, qint64 maxLength);
+    void    closeTarget();
+    QString errorString();
+
+signals:
+    void connected();/*!< \brief emitted when the connection is established */
+    void failed(QString sError);/*!< \brief emitted on errors (the channel is closed) */
+    /*!
+     * \brief dataReceived emitted when data have been written to the target
+     * \param bytes The bytes written
+     * \param bFrameDone true if the requested chunk has been completely received
+     */
+    void dataReceived(qint64 bytes, bool bFrameDone);
+
+private slots:
+    void onWritable();
+    void onReadable();
+
+private:
+    bool    readHeader();
+    qint64  receivePayload(qint64 maxBytes);
+    void    fail(QString sError);
+
+private:
+    QFile           *logFile;
+    int              sockFd;
+    int              fileFd;
+    int              pipeFds[2];
+    QSocketNotifier *pReadNotifier;
+    QSocketNotifier *pWriteNotifier;
+    char            *pBuffer;// Page aligned
+    char             header[RAW_HEADER_SIZE];
+    int              headerBytes;
+    qint64           fileOffset;
+    qint64           payloadLeft;
+    qint64           maxPayload;// The length of the data requested
+    bool             bConnected;
+    bool             bSplice;
+    quint64          token;
+    QString          sErrorString;
+};
+
+#endif // RAWCHANNEL_H
@@ -33,22 +33,24 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //#endif
 
 #include "slidewindow.h"
-#include "fileupdater.h"
+#include "contentsync.h"
+#include "transferscheduler.h"
+#include "mediacache.h"
 #include "scorepanel.h"
 #include "utility.h"
 #include "panelorientation.h"
 #include "volleyapplication.h"
 
 
-/*! \todo Do we have to send the port numbers to use with
- * the message sent by the Server upon a connection ?
- */
-#define SPOT_UPDATE_PORT      45455
-#define SLIDE_UPDATE_PORT     45456
-
 #define PAN_PIN  14 // GPIO Numbers are Broadcom (BCM) numbers
 #define TILT_PIN 26 // GPIO Numbers are Broadcom (BCM) numbers
 
+#define SYNC_REPORT_TIME 1000 // In msec
+
+#define HEARTBEAT_TIME       1000 // In msec: Server liveness check
+#define HEARTBEAT_MAX_MISSES    3 // Unanswered heartbeats before dropping the connection
+#define RTT_WINDOW             16 // Round trip times kept for the statistics
+
 //==============================================================
 // Informations for connecting two servos for camera Pan & Tilt:
 //
@@ -64,7 +66,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 // 3) +5V
 //==============================================================
 
-ScorePanel::ScorePanel(const QString &serverUrl, QFile *myLogFile, QWidget *parent)
+ScorePanel::ScorePanel(const QString &serverUrl, QFile *myLogFile, const QString &sMyBaseDir, QWidget *parent)
     : QMainWindow(parent)
     , isMirrored(false)
     , isScoreOnly(false)
@@ -79,6 +81,10 @@ ScorePanel::ScorePanel(const QString &serverUrl, QFile *myLogFile, QWidget *pare
 
     iCurrentSpot  = 0;
     iCurrentSlide = 0;
+    missedHeartbeats = 0;
+    lastSequence = -1;
+    bConnectionLost = false;
+    bMediaEnabled = true;
 
     pMySlideWindow = Q_NULLPTR;
 
@@ -92,52 +98,54 @@ ScorePanel::ScorePanel(const QString &serverUrl, QFile *myLogFile, QWidget *pare
     isScoreOnly = pSettings->value("panel/scoreOnly",  false).toBool();
     isMirrored  = pSettings->value("panel/orientation",  false).toBool();
 
-    QString sBaseDir;
-    sBaseDir = QDir::homePath();
+    sBaseDir = sMyBaseDir.isEmpty() ? QDir::homePath() : sMyBaseDir;
     if(!sBaseDir.endsWith(QString("/"))) sBaseDir+= QString("/");
 
-    // Spot management
-    pSpotUpdaterThread = Q_NULLPTR;
-    pSpotUpdater       = Q_NULLPTR;
-    spotUpdatePort     = SPOT_UPDATE_PORT;
-    spotUpdaterRestartTimer.setSingleShot(true);
-    connect(&spotUpdaterRestartTimer, SIGNAL(timeout()),
-            this, SLOT(onCreateSpotUpdaterThread()));
+    // Spot and Slide synchronization
+    pSyncThread  = Q_NULLPTR;
+    pContentSync = Q_NULLPTR;
     sSpotDir = QString("%1spots/").arg(sBaseDir);
-
-    // Slide management
-    pSlideUpdaterThread = Q_NULLPTR;
-    pSlideUpdater       = Q_NULLPTR;
-    slideUpdatePort     = SLIDE_UPDATE_PORT;
-    slideUpdaterRestartTimer.setSingleShot(true);
-    connect(&slideUpdaterRestartTimer, SIGNAL(timeout()),
-            this, SLOT(onCreateSlideUpdaterThread()));
     sSlideDir= QString("%1slides/").arg(sBaseDir);
 
+    // The background transfers must not disturb the show
+    pTransferScheduler = new TransferScheduler(this);
+    pTransferScheduler->setBandwidthLimit(1024*pSettings->value("sync/bandwidthLimit", 0).toLongLong(),
+                                          1024*pSettings->value("sync/busyBandwidthLimit", 2048).toLongLong());
+    // The local media must stay within their disk budget (in MB, 0 = all the free space)
+    pMediaCache = new MediaCache(sBaseDir, logFile, this);
+    pMediaCache->setBudget(1024*1024*pSettings->value("sync/cacheBudget", 0).toLongLong());
+
     // Camera management
     initCamera();
 
     // Slide Window
     pMySlideWindow = new SlideWindow();
+    // RGB16 slide frames: half the memory of the default ARGB32 ones
+    pMySlideWindow->setLowMemoryMode(pSettings->value("slides/lowMemory", false).toBool());
+    // The decoded slides memory (in MB, 0 = adapt to the available memory)
+    pMySlideWindow->setCacheBudget(1024*1024*pSettings->value("slides/frameCache", 0).toLongLong());
+    // The precomposed transition frames memory (in MB, 0 = blend the transitions live)
+    pMySlideWindow->setPrecomposeBudget(1024*1024*pSettings->value("slides/precompose", 0).toLongLong());
+    connect(pMySlideWindow, SIGNAL(transitionStarted()),
+            this, SLOT(onSlideTransitionStarted()));
+    connect(pMySlideWindow, SIGNAL(transitionDone()),
+            this, SLOT(onSlideTransitionDone()));
 
     // We are ready to connect to the remote Panel Server
     pPanelServerSocket = new QWebSocket();
-
-    connect(pPanelServerSocket, SIGNAL(connected()),
-            this, SLOT(onPanelServerConnected()));
-    connect(pPanelServerSocket, SIGNAL(disconnected()),
-            this, SLOT(onPanelServerDisconnected()));
-    connect(pPanelServerSocket, SIGNAL(error(QAbstractSocket::SocketError)),
-            this, SLOT(onPanelServerSocketError(QAbstractSocket::SocketError)));
+    connectServerSocket();
 
     // To silent some warnings
     pPanelServerSocket->ignoreSslErrors();
     // Open the Server socket to talk to
     pPanelServerSocket->open(QUrl(serverUrl));
 
-    // Connect the refreshTimer timeout with its SLOT
-    connect(&refreshTimer, SIGNAL(timeout()),
-            this, SLOT(onTimeToRefreshStatus()));
+    // Connect the heartbeatTimer timeout with its SLOT
+    connect(&heartbeatTimer, SIGNAL(timeout()),
+            this, SLOT(onTimeToSendHeartbeat()));
+    // The sync progress is reported, at most, once per SYNC_REPORT_TIME
+    connect(&syncReportTimer, SIGNAL(timeout()),
+            this, SLOT(onTimeToReportSync()));
 
     QList<QScreen*> screens = QApplication::screens();
     if(screens.count() > 1) {
@@ -153,8 +161,8 @@ ScorePanel::ScorePanel(const QString &serverUrl, QFile *myLogFile, QWidget *pare
  * \brief ScorePanel::~ScorePanel The Score Panel destructor
  */
 ScorePanel::~ScorePanel() {
-    refreshTimer.disconnect();
-    refreshTimer.stop();
+    heartbeatTimer.disconnect();
+    heartbeatTimer.stop();
     if(pPanelServerSocket)
         pPanelServerSocket->disconnect();
 //#if defined(Q_PROCESSOR_ARM) && !defined(Q_OS_ANDROID)
@@ -190,230 +198,193 @@ ScorePanel::buildLayout() {
 }
 
 
-//========================================
-// Spot Updater Thread Management routines
-//========================================
+//====================================
+// Content Sync Management routines
+//====================================
 /*!
- * \brief ScorePanel::onCreateSpotUpdaterThread
- * Create a "Spot Updater" client to be run on a separated Thread
+ * \brief ScorePanel::createContentSync
+ * Create the Spot and Slide synchronization engine, to be run on a separated Thread
  */
 void
-ScorePanel::onCreateSpotUpdaterThread() {
-#ifdef LOG_VERBOSE
-    logMessage(logFile,
-               Q_FUNC_INFO,
-               QString("Creating a Spot Update Thread"));
-#endif
-    // Create the Spot Updater Thread
-    pSpotUpdaterThread = new QThread();
-    connect(pSpotUpdaterThread, SIGNAL(finished()),
-            this, SLOT(onSpotUpdaterThreadDone()));
-    // And the Spot Update Server
-    QString spotUpdateServer;
-    spotUpdateServer= QString("ws://%1:%2").arg(pPanelServerSocket->peerAddress().toString()).arg(spotUpdatePort);
-    pSpotUpdater = new FileUpdater(QString("SpotUpdater"), spotUpdateServer, logFile);
-    pSpotUpdater->moveToThread(pSpotUpdaterThread);
-    connect(this, SIGNAL(updateSpots()),
-            pSpotUpdater, SLOT(startUpdate()));
-    pSpotUpdaterThread->start();
-    pSpotUpdater->setDestination(sSpotDir, QString("*.mp4 *.MP4"));
+ScorePanel::createContentSync() {
+    if(pContentSync)
+        return;
 #ifdef LOG_VERBOSE
     logMessage(logFile,
                Q_FUNC_INFO,
-               QString("Spot Update thread started"));
+               QString("Creating the Content Sync Thread"));
 #endif
-    emit updateSpots();
+    pSyncThread = new QThread();
+    pContentSync = new ContentSync(sBaseDir, logFile);
+    pContentSync->setScheduler(pTransferScheduler);
+    pContentSync->setDeltaMode(pSettings->value("sync/deltaTransfer", false).toBool());
+    pContentSync->setCache(pMediaCache);
+    pContentSync->setPeerMode(pSettings->value("sync/peerTransfer", false).toBool(),
+                              quint16(pSettings->value("sync/peerPort", 0).toUInt()));
+    pContentSync->setMulticastMode(pSettings->value("sync/multicast", false).toBool());
+    pContentSync->setRawMode(pSettings->value("sync/rawTransfer", false).toBool());
+    pContentSync->moveToThread(pSyncThread);
+    connect(pSyncThread, SIGNAL(finished()),
+            pContentSync, SLOT(deleteLater()));
+    connect(this, SIGNAL(startContentSync(QString)),
+            pContentSync, SLOT(startSync(QString)));
+    connect(pContentSync, SIGNAL(statusChanged(QString)),
+            this, SLOT(onSyncStatusChanged(QString)));
+    connect(pContentSync, SIGNAL(fileReady(QString,QString)),
+            this, SLOT(onSyncFileReady(QString,QString)));
+    pSyncThread->start();
+    sLastSyncReport = QString();
+    syncReportTimer.start(SYNC_REPORT_TIME);
 }
 
 
 /*!
- * \brief ScorePanel::closeSpotUpdaterThread
- * Closes the "Spot Updater" Thread.
+ * \brief ScorePanel::closeContentSync
+ * Closes the synchronization Thread (the engine is deleted with it).
  */
 void
-ScorePanel::closeSpotUpdaterThread() {
-    if(pSpotUpdaterThread) {
-        pSpotUpdaterThread->disconnect();
-        if(pSpotUpdaterThread->isRunning()) {
-            pSpotUpdaterThread->requestInterruption();
-            if(pSpotUpdaterThread->wait(5000)) {
-                logMessage(logFile,
-                           Q_FUNC_INFO,
-                           QString("Spot Update Thread regularly closed"));
-            }
-            else {
-                logMessage(logFile,
-                           Q_FUNC_INFO,
-                           QString("Spot Update Thread forced to close"));
-            }
+ScorePanel::closeContentSync() {
+    syncReportTimer.stop();
+    if(pSyncThread) {
+        pContentSync->disconnect(this);
+        disconnect(pContentSync);
+        pSyncThread->requestInterruption();
+        pSyncThread->quit();
+        if(pSyncThread->wait(5000)) {
+            logMessage(logFile,
+                       Q_FUNC_INFO,
+                       QString("Content Sync Thread regularly closed"));
+        }
+        else {
+            logMessage(logFile,
+                       Q_FUNC_INFO,
+                       QString("Content Sync Thread forced to close"));
         }
-        delete pSpotUpdaterThread;
+        delete pSyncThread;
     }
-    pSpotUpdaterThread = Q_NULLPTR;
+    pSyncThread  = Q_NULLPTR;
+    pContentSync = Q_NULLPTR;
 }
 
 
 /*!
- * \brief ScorePanel::onSpotUpdaterThreadDone
- * Invoked Asynchronously when the "Spot Updater" Thread is done.
+ * \brief ScorePanel::onSyncStatusChanged
+ * Invoked Asynchronously when a content category changes its state.
+ * \param sCategory The category name
  */
 void
-ScorePanel::onSpotUpdaterThreadDone() {
-    if(pSpotUpdaterThread)
-        pSpotUpdaterThread->disconnect();
+ScorePanel::onSyncStatusChanged(QString sCategory) {
+    if(!pContentSync)
+        return;
+    syncStatus status = pContentSync->status(sCategory);
 #ifdef LOG_VERBOSE
     logMessage(logFile,
                Q_FUNC_INFO,
-               QString("Spot Updater Thread regularly closed"));
-#endif
-    closeSpotUpdaterThread();
-    if(pSpotUpdater->returnCode == FileUpdater::TRANSFER_DONE) {
-#ifdef LOG_VERBOSE
-        logMessage(logFile,
-                   Q_FUNC_INFO,
-                   QString("Spot Updater closed without errors"));
+               QString("%1: state %2 (return code %3, retries %4)")
+               .arg(sCategory)
+               .arg(status.state)
+               .arg(status.returnCode)
+               .arg(status.retries));
+#else
+    Q_UNUSED(status)
 #endif
-    }
-    else if(pSpotUpdater->returnCode == FileUpdater::ERROR_SOCKET) {
-        logMessage(logFile,
-                   Q_FUNC_INFO,
-                   QString("Spot Updater closed with errors"));
-        spotUpdaterRestartTimer.start(rand()%5000+5000);
-    }
-    else if(pSpotUpdater->returnCode == FileUpdater::FILE_ERROR) {
-        logMessage(logFile,
-                   Q_FUNC_INFO,
-                   QString("Spot Updater got a File Error"));
-    }
-    else if(pSpotUpdater->returnCode == FileUpdater::SERVER_DISCONNECTED) {
-        logMessage(logFile,
-                   Q_FUNC_INFO,
-                   QString("Spot Updater Server Unexpectedly Closed the Connection"));
-        spotUpdaterRestartTimer.start(rand()%5000+5000);
-    }
-    else {
-        logMessage(logFile,
-                   Q_FUNC_INFO,
-                   QString("Spot Updater Closed for Unknown Reason: %1")
-                   .arg(pSpotUpdater->returnCode));
-    }
 }
-//========================================
-// End of Spot Server Management routines
-//========================================
 
 
-//=========================================
-// Slide Updater Thread Management routines
-//=========================================
 /*!
- * \brief ScorePanel::onCreateSlideUpdaterThread
- * Create a "Slide Updater" client to be run on a separated Thread
+ * \brief ScorePanel::onSyncFileReady
+ * Invoked Asynchronously when a file has been downloaded
+ * \param sCategory The category name
+ * \param sFileName The file (full path)
  */
 void
-ScorePanel::onCreateSlideUpdaterThread() {
-#ifdef LOG_VERBOSE
-    logMessage(logFile,
-               Q_FUNC_INFO,
-               QString("Creating a Slide Update Thread"));
-#endif
-    // Create the Slide Updater Thread
-    pSlideUpdaterThread = new QThread();
-    connect(pSlideUpdaterThread, SIGNAL(finished()),
-            this, SLOT(onSlideUpdaterThreadDone()));
-    // And the Slide Update Server
-    QString slideUpdateServer;
-    slideUpdateServer= QString("ws://%1:%2").arg(pPanelServerSocket->peerAddress().toString()).arg(slideUpdatePort);
-    pSlideUpdater = new FileUpdater(QString("SlideUpdater"), slideUpdateServer, logFile);
-    pSlideUpdater->moveToThread(pSlideUpdaterThread);
-    connect(this, SIGNAL(updateSlides()),
-            pSlideUpdater, SLOT(startUpdate()));
-    pSlideUpdaterThread->start();
-    pSlideUpdater->setDestination(sSlideDir, QString("*.jpg *.jpeg *.png *.JPG *.JPEG *.PNG"));
-#ifdef LOG_VERBOSE
-    logMessage(logFile,
-               Q_FUNC_INFO,
-               QString("Slide Update thread started"));
-#endif
-    emit updateSlides();
+ScorePanel::onSyncFileReady(QString sCategory, QString sFileName) {
+    if(sCategory == QString("slides") && pMySlideWindow)
+        pMySlideWindow->prepareSlide(sFileName);
 }
 
 
 /*!
- * \brief ScorePanel::closeSlideUpdaterThread
- * Closes the "Slide Updater" Thread.
+ * \brief ScorePanel::onTimeToReportSync
+ * Send the Server the progress of the content synchronization.
+ *
+ * The message is:
+ * <sync_status>category,state,filesPending,bytesDone,bytesTotal,bytesPerSecond,eta,lastError;...</sync_status>
+ * and it is sent only when something has changed.
  */
 void
-ScorePanel::closeSlideUpdaterThread() {
-    if(pSlideUpdaterThread) {
-        pSlideUpdaterThread->disconnect();
-        if(pSlideUpdaterThread->isRunning()) {
-            pSlideUpdaterThread->requestInterruption();
-            if(pSlideUpdaterThread->wait(1000)) {
-                logMessage(logFile,
-                           Q_FUNC_INFO,
-                           QString("Slide Update Thread regularly closed"));
-            }
-            else {
-                logMessage(logFile,
-                           Q_FUNC_INFO,
-                           QString("Slide Update Thread forced to close"));
-            }
-        }
-        delete pSlideUpdaterThread;
+ScorePanel::onTimeToReportSync() {
+    if(!pContentSync || !pPanelServerSocket)
+        return;
+    QStringList categoryReports;
+    QStringList categories = pContentSync->categories();
+    for(int i=0; i<categories.count(); i++) {
+        syncStatus status = pContentSync->status(categories.at(i));
+        QString sError = status.sLastError;
+        sError.remove(QChar(',')).remove(QChar(';')).remove(QChar('<')).remove(QChar('>'));
+        categoryReports.append(QString("%1,%2,%3,%4,%5,%6,%7,%8")
+                               .arg(categories.at(i))
+                               .arg(status.state)
+                               .arg(status.filesPending)
+                               .arg(status.bytesDone)
+                               .arg(status.bytesTotal)
+                               .arg(status.throughput)
+                               .arg(status.eta)
+                               .arg(sError));
+    }
+    QString sMessage = QString("<sync_status>%1</sync_status>")
+                       .arg(categoryReports.join(QString(";")));
+    if(sMessage == sLastSyncReport)
+        return;
+    qint64 bytesSent = pPanelServerSocket->sendTextMessage(sMessage);
+    if(bytesSent != sMessage.length()) {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Unable to send the sync status"));
+        return;
     }
-    pSlideUpdaterThread = Q_NULLPTR;
+    sLastSyncReport = sMessage;
 }
+//===========================================
+// End of Content Sync Management routines
+//===========================================
 
 
 /*!
- * \brief ScorePanel::onSlideUpdaterThreadDone
- * Invoked Asynchronously when the "Slide Updater" thread is done.
+ * \brief ScorePanel::onSlideTransitionStarted
+ * Pause the background transfers while the slides are moving
  */
 void
-ScorePanel::onSlideUpdaterThreadDone() {
-    if(pSlideUpdaterThread)
-        pSlideUpdaterThread->disconnect();
-#ifdef LOG_VERBOSE
-    logMessage(logFile,
-               Q_FUNC_INFO,
-               QString("Slide Update Thread regularly closed"));
-#endif
-    closeSlideUpdaterThread();
-    if(pSlideUpdater->returnCode == FileUpdater::TRANSFER_DONE) {
+ScorePanel::onSlideTransitionStarted() {
+    pTransferScheduler->setTransitionRunning(true);
+}
+
+
+/*!
+ * \brief ScorePanel::onSlideTransitionDone
+ * Resume the background transfers, starting from the next slide to show
+ */
+void
+ScorePanel::onSlideTransitionDone() {
+    pTransferScheduler->setTransitionRunning(false);
+    if(pMySlideWindow) {
 #ifdef LOG_VERBOSE
         logMessage(logFile,
                    Q_FUNC_INFO,
-                   QString("Slide Updater closed without errors"));
+                   QString("Transition drawn at %1 fps (frame buffers peak: %2 MB)")
+                   .arg(pMySlideWindow->frameRate(), 0, 'f', 1)
+                   .arg(pMySlideWindow->bufferHighWater()/(1024*1024)));
 #endif
-    }
-    else if(pSlideUpdater->returnCode == FileUpdater::ERROR_SOCKET) {
-        logMessage(logFile,
-                   Q_FUNC_INFO,
-                   QString("Slide Updater closed with errors"));
-        slideUpdaterRestartTimer.start(rand()%5000+5000);
-    }
-    else if(pSlideUpdater->returnCode == FileUpdater::FILE_ERROR) {
-        logMessage(logFile,
-                   Q_FUNC_INFO,
-                   QString("Slide Updater got a File Error"));
-    }
-    else if(pSlideUpdater->returnCode == FileUpdater::SERVER_DISCONNECTED) {
-        logMessage(logFile,
-                   Q_FUNC_INFO,
-                   QString("Slide Updater Server Suddenly Closed the Connection"));
-        slideUpdaterRestartTimer.start(rand()%5000+5000);
-    }
-    else {
-        logMessage(logFile,
-                   Q_FUNC_INFO,
-                   QString("Slide Updater Closed for Unknown Reason %1")
-                   .arg(pSlideUpdater->returnCode));
+        pTransferScheduler->setPlayPosition(QString("slides"),
+                                            pMySlideWindow->nextSlideName());
+        // An interrupted transition leaves the same slide on show
+        QString sPresentSlide = pMySlideWindow->presentSlideName();
+        if(!sPresentSlide.isEmpty() && sPresentSlide != sShownSlide) {
+            pMediaCache->touch(QString("slides"), sPresentSlide);
+            sShownSlide = sPresentSlide;
+        }
     }
 }
-//=========================================
-// End of Slide Server Management routines
-//=========================================
 
 
 //==================
@@ -442,6 +413,7 @@ ScorePanel::setScoreOnly(bool bScoreOnly) {
             videoPlayer->waitForFinished(3000);
             videoPlayer->deleteLater();
             videoPlayer = Q_NULLPTR;
+            pTransferScheduler->setVideoPlaying(false);
         }
         if(cameraPlayer) {
             cameraPlayer->close();
@@ -463,6 +435,17 @@ ScorePanel::getScoreOnly() {
 }
 
 
+/*!
+ * \brief ScorePanel::setMediaEnabled Enable or disable the external media players
+ * \param bEnabled false to never start the Spot (ffplay) and Camera players
+ * (e.g. for the Panels simulated in a single process)
+ */
+void
+ScorePanel::setMediaEnabled(bool bEnabled) {
+    bMediaEnabled = bEnabled;
+}
+
+
 /*!
  * \brief ScorePanel::onPanelServerConnected Invoked asynchronously upon the Server connection
  */
@@ -473,54 +456,143 @@ ScorePanel::onPanelServerConnected() {
                Q_FUNC_INFO,
                QString("Started"));
 #endif
-    QString sMessage;
-    sMessage = QString("<getStatus>%1</getStatus>").arg(QHostInfo::localHostName());
-    qint64 bytesSent = pPanelServerSocket->sendTextMessage(sMessage);
-    if(bytesSent != sMessage.length()) {
-        logMessage(logFile,
-                   Q_FUNC_INFO,
-                   QString("Unable to ask the initial status"));
-    }
-    onCreateSpotUpdaterThread();
-    onCreateSlideUpdaterThread();
-    bStillConnected = false;
-    refreshTimer.start(rand()%2000+3000);
+    askStatus();
+    // After a reconnection the running synchronization resumes
+    if(!pSyncThread)
+        createContentSync();
+    sLastSyncReport = QString();
+    syncReportTimer.start(SYNC_REPORT_TIME);
+    emit startContentSync(pPanelServerSocket->peerAddress().toString());
+    // From now on the Server liveness is checked with the WebSocket ping
+    missedHeartbeats = 0;
+    lastSequence = -1;
+    rttWindow.clear();
+    latencyWindow.clear();
+    heartbeatTimer.start(HEARTBEAT_TIME);
+    emit connectionRestored();
 }
 
 
+/*!
+ * \brief ScorePanel::onTimeToSendHeartbeat
+ * The connection is dropped only after HEARTBEAT_MAX_MISSES consecutive
+ * heartbeats without any answer (or any other message) from the Server
+ */
 void
-ScorePanel::onTimeToRefreshStatus() {
-    if(!bStillConnected) {
+ScorePanel::onTimeToSendHeartbeat() {
+    if(missedHeartbeats >= HEARTBEAT_MAX_MISSES) {
 #ifdef LOG_VERBOSE
         logMessage(logFile,
                    Q_FUNC_INFO,
                    QString("Panel Server Disconnected"));
 #endif
-        if(pPanelServerSocket)
-            pPanelServerSocket->deleteLater();
-        pPanelServerSocket =Q_NULLPTR;
-        doProcessCleanup();
-        close();
-        emit panelClosed();
+        dropServerConnection();
         return;
     }
+    missedHeartbeats++;
+    pPanelServerSocket->ping();
+}
+
+
+/*!
+ * \brief ScorePanel::onPanelServerPong Invoked when the Server answers the heartbeat
+ * \param elapsedTime The round trip time (in ms)
+ */
+void
+ScorePanel::onPanelServerPong(quint64 elapsedTime, QByteArray payload) {
+    Q_UNUSED(payload)
+    missedHeartbeats = 0;
+    rttWindow.append(qint64(elapsedTime));
+    if(rttWindow.count() > RTT_WINDOW)
+        rttWindow.removeFirst();
+#ifdef LOG_VERBOSE_VERBOSE
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               QString("RTT %1 ms (mean %2 jitter %3)")
+               .arg(elapsedTime)
+               .arg(rttMean())
+               .arg(rttJitter()));
+#endif
+}
+
+
+/*!
+ * \brief ScorePanel::rttMean
+ * \return The mean round trip time (in ms) with the Server
+ * over the last RTT_WINDOW heartbeats (-1 if unknown)
+ */
+double
+ScorePanel::rttMean() {
+    if(rttWindow.isEmpty())
+        return -1.0;
+    qint64 sum = 0;
+    for(int i=0; i<rttWindow.count(); i++)
+        sum += rttWindow.at(i);
+    return double(sum)/rttWindow.count();
+}
+
+
+/*!
+ * \brief ScorePanel::rttJitter
+ * \return The mean variation (in ms) between consecutive round trip times
+ */
+double
+ScorePanel::rttJitter() {
+    if(rttWindow.count() < 2)
+        return 0.0;
+    qint64 sum = 0;
+    for(int i=1; i<rttWindow.count(); i++)
+        sum += qAbs(rttWindow.at(i) - rttWindow.at(i-1));
+    return double(sum)/(rttWindow.count()-1);
+}
+
+
+/*!
+ * \brief ScorePanel::updateLatency
+ * \return The mean time (in ms) from the Server sending a message
+ * to the Panel having processed it (-1 if the Server does not send
+ * its timestamps)
+ */
+double
+ScorePanel::updateLatency() {
+    if(latencyWindow.isEmpty())
+        return -1.0;
+    qint64 sum = 0;
+    for(int i=0; i<latencyWindow.count(); i++)
+        sum += latencyWindow.at(i);
+    return double(sum)/latencyWindow.count();
+}
+
+
+/*!
+ * \brief ScorePanel::syncThroughput
+ * \return The current download rate (bytes/s) of all the content categories
+ */
+qint64
+ScorePanel::syncThroughput() {
+    if(!pContentSync)
+        return 0;
+    qint64 throughput = 0;
+    QStringList categories = pContentSync->categories();
+    for(int i=0; i<categories.count(); i++)
+        throughput += pContentSync->status(categories.at(i)).throughput;
+    return throughput;
+}
+
+
+/*!
+ * \brief ScorePanel::askStatus Ask the Server to send the whole Panel status
+ */
+void
+ScorePanel::askStatus() {
     QString sMessage;
     sMessage = QString("<getStatus>%1</getStatus>").arg(QHostInfo::localHostName());
     qint64 bytesSent = pPanelServerSocket->sendTextMessage(sMessage);
     if(bytesSent != sMessage.length()) {
-#ifdef LOG_VERBOSE
         logMessage(logFile,
                    Q_FUNC_INFO,
-                   QString("Unable to refresh the Panel status"));
-#endif
-        if(pPanelServerSocket)
-            pPanelServerSocket->deleteLater();
-        pPanelServerSocket =Q_NULLPTR;
-        doProcessCleanup();
-        close();
-        emit panelClosed();
+                   QString("Unable to ask the Panel status"));
     }
-    bStillConnected = false;
 }
 
 
@@ -530,16 +602,92 @@ ScorePanel::onTimeToRefreshStatus() {
  */
 void
 ScorePanel::onPanelServerDisconnected() {
-    doProcessCleanup();
+    dropServerConnection();
+}
+
+
+/*!
+ * \brief ScorePanel::dropServerConnection
+ * Close the Server connection but keep showing the last status.
+ * Slides, Spots and the content synchronization go on while
+ * the Server Discoverer looks for the Server again.
+ */
+void
+ScorePanel::dropServerConnection() {
+    if(bConnectionLost)
+        return;
+    bConnectionLost = true;
+    heartbeatTimer.stop();
+    syncReportTimer.stop();
+    // abort() would call us again (through disconnected())
+    pPanelServerSocket->blockSignals(true);
+    pPanelServerSocket->abort();
+    pPanelServerSocket->blockSignals(false);
 #ifdef LOG_VERBOSE
     logMessage(logFile,
                Q_FUNC_INFO,
-               QString("emitting panelClosed()"));
+               QString("emitting connectionLost()"));
 #endif
-    if(pPanelServerSocket)
-        pPanelServerSocket->deleteLater();
-    pPanelServerSocket =Q_NULLPTR;
-    emit panelClosed();
+    emit connectionLost();
+}
+
+
+/*!
+ * \brief ScorePanel::connectServerSocket
+ * Connect the Server socket signals with our slots
+ */
+void
+ScorePanel::connectServerSocket() {
+    connect(pPanelServerSocket, SIGNAL(connected()),
+            this, SLOT(onPanelServerConnected()));
+    connect(pPanelServerSocket, SIGNAL(disconnected()),
+            this, SLOT(onPanelServerDisconnected()));
+    connect(pPanelServerSocket, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SLOT(onPanelServerSocketError(QAbstractSocket::SocketError)));
+    connect(pPanelServerSocket, SIGNAL(textMessageReceived(QString)),
+            this, SLOT(onTextMessageReceived(QString)));
+    connect(pPanelServerSocket, SIGNAL(binaryMessageReceived(QByteArray)),
+            this, SLOT(onBinaryMessageReceived(QByteArray)));
+    connect(pPanelServerSocket, SIGNAL(pong(quint64,QByteArray)),
+            this, SLOT(onPanelServerPong(quint64,QByteArray)));
+}
+
+
+/*!
+ * \brief ScorePanel::switchSocket Continue on an already connected socket
+ * (e.g. the warm standby connection with a backup Server)
+ * \param pSocket The connected socket: the Panel takes its ownership
+ */
+void
+ScorePanel::switchSocket(QWebSocket *pSocket) {
+#ifdef LOG_VERBOSE
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               QString("Switching to %1").arg(pSocket->requestUrl().toString()));
+#endif
+    pPanelServerSocket->disconnect();
+    pPanelServerSocket->abort();
+    pPanelServerSocket->deleteLater();
+    pPanelServerSocket = pSocket;
+    connectServerSocket();
+    bConnectionLost = false;
+    onPanelServerConnected();
+}
+
+
+/*!
+ * \brief ScorePanel::reconnect Reopen the connection with the (same or another) Server
+ * \param serverUrl The Panel Server URL
+ */
+void
+ScorePanel::reconnect(const QString &serverUrl) {
+#ifdef LOG_VERBOSE
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               QString("Reconnecting to %1").arg(serverUrl));
+#endif
+    bConnectionLost = false;
+    pPanelServerSocket->open(QUrl(serverUrl));
 }
 
 
@@ -554,14 +702,9 @@ ScorePanel::doProcessCleanup() {
                Q_FUNC_INFO,
                QString("Cleaning all processes"));
 #endif
-    refreshTimer.disconnect();
-    spotUpdaterRestartTimer.disconnect();
-    slideUpdaterRestartTimer.disconnect();
-    refreshTimer.stop();
-    spotUpdaterRestartTimer.stop();
-    slideUpdaterRestartTimer.stop();
-    closeSpotUpdaterThread();
-    closeSlideUpdaterThread();
+    heartbeatTimer.disconnect();
+    heartbeatTimer.stop();
+    closeContentSync();
 
     if(pMySlideWindow) {
         pMySlideWindow->close();
@@ -575,6 +718,7 @@ ScorePanel::doProcessCleanup() {
         videoPlayer->waitForFinished(3000);
         videoPlayer->deleteLater();
         videoPlayer = Q_NULLPTR;
+        pTransferScheduler->setVideoPlaying(false);
     }
     if(cameraPlayer) {
         cameraPlayer->close();
@@ -593,7 +737,6 @@ ScorePanel::doProcessCleanup() {
 void
 ScorePanel::onPanelServerSocketError(QAbstractSocket::SocketError error) {
     Q_UNUSED(error)
-    doProcessCleanup();
 #ifdef LOG_VERBOSE
     logMessage(logFile,
                Q_FUNC_INFO,
@@ -602,15 +745,7 @@ ScorePanel::onPanelServerSocketError(QAbstractSocket::SocketError error) {
                .arg(pPanelServerSocket->errorString())
                .arg(error));
 #endif
-    if(pPanelServerSocket) {
-        pPanelServerSocket->disconnect();
-        if(pPanelServerSocket->isValid())
-            pPanelServerSocket->close();
-        pPanelServerSocket->deleteLater();
-    }
-    pPanelServerSocket = Q_NULLPTR;
-    close();// Closes the Widget
-    emit panelClosed();
+    dropServerConnection();
 }
 
 
@@ -724,6 +859,7 @@ ScorePanel::onSpotClosed(int exitCode, QProcess::ExitStatus exitStatus) {
         videoPlayer->close();// Closes all communication with the process and kills it.
         delete videoPlayer;
         videoPlayer = Q_NULLPTR;
+        pTransferScheduler->setVideoPlaying(false);
         QString sMessage = "<closed_spot>1</closed_spot>";
         qint64 bytesSent = pPanelServerSocket->sendTextMessage(sMessage);
         if(bytesSent != sMessage.length()) {
@@ -807,6 +943,7 @@ ScorePanel::onStartNextSpot(int exitCode, QProcess::ExitStatus exitStatus) {
             videoPlayer->disconnect();
             delete videoPlayer;
             videoPlayer = Q_NULLPTR;
+            pTransferScheduler->setVideoPlaying(false);
             QString sMessage = "<closed_spot>1</closed_spot>";
             qint64 bytesSent = pPanelServerSocket->sendTextMessage(sMessage);
             if(bytesSent != sMessage.length()) {
@@ -854,7 +991,10 @@ ScorePanel::onStartNextSpot(int exitCode, QProcess::ExitStatus exitStatus) {
                QString("Now playing: %1")
                .arg(spotList.at(iCurrentSpot).absoluteFilePath()));
 #endif
+    pMediaCache->touch(QString("spots"), spotList.at(iCurrentSpot).fileName());
     iCurrentSpot = (iCurrentSpot+1) % spotList.count();// Prepare Next Spot
+    pTransferScheduler->setPlayPosition(QString("spots"),
+                                        spotList.at(iCurrentSpot).fileName());
     if(!videoPlayer->waitForStarted(3000)) {
         videoPlayer->close();
         logMessage(logFile,
@@ -863,8 +1003,10 @@ ScorePanel::onStartNextSpot(int exitCode, QProcess::ExitStatus exitStatus) {
         videoPlayer->disconnect();
         delete videoPlayer;
         videoPlayer = Q_NULLPTR;
+        pTransferScheduler->setVideoPlaying(false);
         return;
     }
+    pTransferScheduler->setVideoPlaying(true);
     hide();
 }
 
@@ -889,13 +1031,41 @@ ScorePanel::onBinaryMessageReceived(QByteArray baMessage) {
  */
 void
 ScorePanel::onTextMessageReceived(QString sMessage) {
-    refreshTimer.start(rand()%2000+3000);
-    bStillConnected = true;
+    // Any message from the Server proves that it is alive
+    missedHeartbeats = 0;
     QString sToken;
     bool ok;
     int iVal;
     QString sNoData = QString("NoData");
 
+    // A message lost: we need the whole status
+    sToken = XML_Parse(sMessage, "seq");
+    if(sToken != sNoData) {
+        iVal = sToken.toInt(&ok);
+        if(ok) {
+            if(lastSequence >= 0 && iVal != lastSequence+1) {
+                logMessage(logFile,
+                           Q_FUNC_INFO,
+                           QString("Sequence gap: %1 after %2")
+                           .arg(iVal)
+                           .arg(lastSequence));
+                askStatus();
+            }
+            lastSequence = iVal;
+        }
+    }// seq
+
+    // The Server timestamp (if any): the derived Panel has already shown the update
+    sToken = XML_Parse(sMessage, "ts");
+    if(sToken != sNoData) {
+        qint64 sentTime = sToken.toLongLong(&ok);
+        if(ok) {
+            latencyWindow.append(QDateTime::currentMSecsSinceEpoch() - sentTime);
+            if(latencyWindow.count() > RTT_WINDOW)
+                latencyWindow.removeFirst();
+        }
+    }// ts
+
     sToken = XML_Parse(sMessage, "kill");
     if(sToken != sNoData) {
         iVal = sToken.toInt(&ok);
@@ -1091,6 +1261,14 @@ ScorePanel::onTextMessageReceived(QString sMessage) {
  */
 void
 ScorePanel::startLiveCamera() {
+    if(!bMediaEnabled) {
+#ifdef LOG_VERBOSE
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Media players disabled: Live Camera not started"));
+#endif
+        return;
+    }
 #ifdef Q_PROCESSOR_ARM
     if(!cameraPlayer) {
         cameraPlayer = new QProcess(this);
@@ -1213,6 +1391,14 @@ ScorePanel::getPanelScoreOnly() {
  */
 void
 ScorePanel::startSpotLoop() {
+    if(!bMediaEnabled) {
+#ifdef LOG_VERBOSE
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Media players disabled: Spot Loop not started"));
+#endif
+        return;
+    }
     QDir spotDir(sSpotDir);
     spotList = QFileInfoList();
     if(spotDir.exists()) {
@@ -1261,7 +1447,10 @@ ScorePanel::startSpotLoop() {
                        QString("Now playing: %1")
                        .arg(spotList.at(iCurrentSpot).absoluteFilePath()));
 #endif
+            pMediaCache->touch(QString("spots"), spotList.at(iCurrentSpot).fileName());
             iCurrentSpot = (iCurrentSpot+1) % spotList.count();// Prepare Next Spot
+            pTransferScheduler->setPlayPosition(QString("spots"),
+                                                spotList.at(iCurrentSpot).fileName());
             if(!videoPlayer->waitForStarted(3000)) {
                 videoPlayer->close();
                 logMessage(logFile,
@@ -1272,6 +1461,7 @@ ScorePanel::startSpotLoop() {
                 videoPlayer = Q_NULLPTR;
                 return;
             }
+            pTransferScheduler->setVideoPlaying(true);
             hide(); // Hide the Score Panel
         } // if(!videoPlayer)
     }
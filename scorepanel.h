@@ -43,8 +43,10 @@ QT_FORWARD_DECLARE_CLASS(QUdpSocket)
 QT_FORWARD_DECLARE_CLASS(QWebSocket)
 QT_FORWARD_DECLARE_CLASS(SlideWindow)
 QT_FORWARD_DECLARE_CLASS(QGridLayout)
-QT_FORWARD_DECLARE_CLASS(UpdaterThread)
-QT_FORWARD_DECLARE_CLASS(FileUpdater)
+QT_FORWARD_DECLARE_CLASS(QThread)
+QT_FORWARD_DECLARE_CLASS(ContentSync)
+QT_FORWARD_DECLARE_CLASS(TransferScheduler)
+QT_FORWARD_DECLARE_CLASS(MediaCache)
 QT_END_NAMESPACE
 
 
@@ -53,44 +55,55 @@ class ScorePanel : public QMainWindow
     Q_OBJECT
 
 public:
-    ScorePanel(const QString &serverUrl, QFile *myLogFile, QWidget *parent = Q_NULLPTR);
+    ScorePanel(const QString &serverUrl, QFile *myLogFile, const QString &sMyBaseDir = QString(), QWidget *parent = Q_NULLPTR);
     ~ScorePanel();
     void keyPressEvent(QKeyEvent *event);
     void closeEvent(QCloseEvent *event);
     void setScoreOnly(bool bScoreOnly);
     bool getScoreOnly();
+    void setMediaEnabled(bool bEnabled);
+    void reconnect(const QString &serverUrl);
+    double rttMean();
+    double rttJitter();
+    double updateLatency();
+    qint64 syncThroughput();
+    void switchSocket(QWebSocket *pSocket);
 
 signals:
-    void updateSpots(); /*!< \brief emitted to start the Spot update process */
-    void updateSlides();/*!< \brief emitted to start the Slide update process */
-    void panelClosed(); /*!< \brief emitted to signal that the Panel has been closed */
+    void startContentSync(QString sServerAddress);/*!< \brief emitted to start the Spot and Slide update process */
+    void connectionLost(); /*!< \brief emitted to signal that the Server connection has been lost */
+    void connectionRestored(); /*!< \brief emitted when the Server connection is (again) working */
 
 protected slots:
-    void onTextMessageReceived(QString sMessage);
-    void onBinaryMessageReceived(QByteArray baMessage);
+    virtual void onTextMessageReceived(QString sMessage);
+    virtual void onBinaryMessageReceived(QByteArray baMessage);
 
 
 private slots:
     void onPanelServerConnected();
     void onPanelServerDisconnected();
     void onPanelServerSocketError(QAbstractSocket::SocketError error);
-    void onTimeToRefreshStatus();
+    void onTimeToSendHeartbeat();
+    void onPanelServerPong(quint64 elapsedTime, QByteArray payload);
     void onSpotClosed(int exitCode, QProcess::ExitStatus exitStatus);
     void onLiveClosed(int exitCode, QProcess::ExitStatus exitStatus);
     void onStartNextSpot(int exitCode, QProcess::ExitStatus exitStatus);
-    void onCreateSpotUpdaterThread();
-    void onCreateSlideUpdaterThread();
-
-    void onSpotUpdaterThreadDone();
-    void onSlideUpdaterThreadDone();
+    void onSyncStatusChanged(QString sCategory);
+    void onSyncFileReady(QString sCategory, QString sFileName);
+    void onTimeToReportSync();
+    void onSlideTransitionStarted();
+    void onSlideTransitionDone();
 
 protected:
     virtual QGridLayout* createPanel();
 
     void buildLayout();
     void doProcessCleanup();
-    void closeSpotUpdaterThread();
-    void closeSlideUpdaterThread();
+    void createContentSync();
+    void closeContentSync();
+    void dropServerConnection();
+    void connectServerSocket();
+    void askStatus();
 
 protected:
     /*!
@@ -113,17 +126,26 @@ protected:
     QTranslator        Translator;
 
 private:
-    bool               bStillConnected;
-    QTimer             refreshTimer;
+    int                missedHeartbeats;
+    int                lastSequence;
+    QList<qint64>      rttWindow;
+    QList<qint64>      latencyWindow;
+    bool               bConnectionLost;
+    bool               bMediaEnabled;// false: no external Spot or Camera players
+    QTimer             heartbeatTimer;
     QProcess          *videoPlayer;
     QProcess          *cameraPlayer;
     QString            sProcess;
     QString            sProcessArguments;
 
+    // Spots and Slides synchronization
+    QString            sBaseDir;
+    QThread           *pSyncThread;
+    ContentSync       *pContentSync;
+    QTimer             syncReportTimer;
+    QString            sLastSyncReport;
+
     // Spots management
-    quint16            spotUpdatePort;
-    QThread           *pSpotUpdaterThread;
-    FileUpdater       *pSpotUpdater;
     QString            sSpotDir;
     QFileInfoList      spotList;
     struct spot {
@@ -132,12 +154,8 @@ private:
     };
     QList<spot>        availabeSpotList;
     int                iCurrentSpot;
-    QTimer             spotUpdaterRestartTimer;
 
     // Slides management
-    quint16            slideUpdatePort;
-    QThread           *pSlideUpdaterThread;
-    FileUpdater       *pSlideUpdater;
     QString            sSlideDir;
     QFileInfoList      slideList;
     struct slide {
@@ -146,10 +164,13 @@ private:
     };
     QList<slide>       availabeSlideList;
     int                iCurrentSlide;
-    QTimer             slideUpdaterRestartTimer;
+    QString            sShownSlide;// The last slide recorded as played
 
     QString            logFileName;
 
+    TransferScheduler *pTransferScheduler;
+    MediaCache        *pMediaCache;
+
     SlideWindow       *pMySlideWindow;
 
     unsigned           panPin;
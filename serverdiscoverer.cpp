@@ -25,6 +25,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <QWebSocket>
 #include <QHostInfo>
 #include <QSettings>
+#include <QRandomGenerator>
 
 #include "serverdiscoverer.h"
 #include "messagewindow.h"
@@ -37,6 +38,15 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #define SERVER_CONNECTION_TIMEOUT 3000
 
+#define RETRY_MIN_DELAY   100  // First delay (ms) before retrying the last known Server
+#define DISCOVERY_MIN_TIMEOUT 500 // First wait (ms) for a discovery answer
+#define RETRY_JITTER      25   // Random spread (%) of each delay
+
+#define PANEL_KEEP_TIME   30000 // The Score Panel stays on screen while reconnecting
+
+#define STANDBY_PING_TIME  1000 // In msec: liveness check of the standby Server
+#define STANDBY_MAX_MISSES    3 // Unanswered pings before dropping the standby
+
 /*!
  * \brief ServerDiscoverer::ServerDiscoverer
  * \param myLogFile
@@ -45,17 +55,63 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
  * This class manage the "Server Discovery" process.
  * It send a multicast message and listen for a correct answer
  * The it try to connect to the server and if it succeed create and
- * show the rigth Score Panel
+ * show the rigth Score Panel.
+ * The last Server that accepted our connection is tried at once,
+ * in parallel with the discovery, so that a network hiccup or a
+ * Server restart are recovered without waiting for the discovery.
+ * Failed attempts are retried with a bounded exponential backoff
+ * (with some jitter to avoid all the panels retrying together).
  */
 ServerDiscoverer::ServerDiscoverer(QFile *myLogFile, QObject *parent)
     : QObject(parent)
     , logFile(myLogFile)
+    , bDiscovering(false)
     , discoveryPort(DISCOVERY_PORT)
     , serverPort(SERVER_PORT)
     , discoveryAddress(QHostAddress("224.0.0.1"))
+    , retryDelay(RETRY_MIN_DELAY)
+    , discoveryTimeout(DISCOVERY_MIN_TIMEOUT)
     , pNoServerWindow(Q_NULLPTR)
     , pScorePanel(Q_NULLPTR)
+    , scorePanelType(0)
+    , bMediaEnabled(true)
+    , connectTime(-1)
+    , connections(0)
 {
+    QSettings settings("Gabriele Salvato", "Volley Panel");
+    sLastServerUrl = settings.value("server/lastUrl", QString()).toString();
+    lastPanelType  = settings.value("server/lastPanelType", 0).toInt();
+    bStandbyMode   = settings.value("server/warmStandby", false).toBool();
+
+    pStandbySocket = Q_NULLPTR;
+    standbyMissedPongs = 0;
+    connect(&standbyPingTimer, SIGNAL(timeout()),
+            this, SLOT(onTimeToPingStandby()));
+
+    retryTimer.setSingleShot(true);
+    connect(&retryTimer, SIGNAL(timeout()),
+            this, SLOT(onTimeToRetry()));
+    panelKeepTimer.setSingleShot(true);
+    connect(&panelKeepTimer, SIGNAL(timeout()),
+            this, SLOT(onTimeToClosePanel()));
+
+    // Listen also to the beacons periodically sent by the Server:
+    // they are processed exactly as the answers to our requests
+    pBeaconSocket = new QUdpSocket(this);
+    if(pBeaconSocket->bind(QHostAddress::AnyIPv4, discoveryPort,
+                           QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint))
+    {
+        joinBeaconGroup();
+        connect(pBeaconSocket, SIGNAL(readyRead()),
+                this, SLOT(onProcessDiscoveryPendingDatagrams()));
+    }
+    else {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Unable to bind the Beacon Socket: %1")
+                   .arg(pBeaconSocket->errorString()));
+    }
+
     // Create a message window
     pNoServerWindow = new MessageWindow(Q_NULLPTR);
     pNoServerWindow->setDisplayedText(tr("In Attesa della Connessione con il Server"));
@@ -63,8 +119,59 @@ ServerDiscoverer::ServerDiscoverer(QFile *myLogFile, QObject *parent)
 }
 
 
+/*!
+ * \brief ServerDiscoverer::setBaseDir
+ * \param sMyBaseDir The folder for the Spots and Slides of the Score Panel
+ * (empty means the home directory)
+ */
+void
+ServerDiscoverer::setBaseDir(QString sMyBaseDir) {
+    sBaseDir = sMyBaseDir;
+}
 
 
+/*!
+ * \brief ServerDiscoverer::setMediaEnabled
+ * \param bEnabled false if the Score Panel must not start the external
+ * media players (Spots and Live Camera)
+ */
+void
+ServerDiscoverer::setMediaEnabled(bool bEnabled) {
+    bMediaEnabled = bEnabled;
+    if(pScorePanel)
+        pScorePanel->setMediaEnabled(bMediaEnabled);
+}
+
+
+/*!
+ * \brief ServerDiscoverer::scorePanel
+ * \return The Score Panel shown (if any)
+ */
+ScorePanel*
+ServerDiscoverer::scorePanel() {
+    return pScorePanel;
+}
+
+
+/*!
+ * \brief ServerDiscoverer::lastConnectTime
+ * \return The time (ms) needed by the last (re)connection to the Server or -1
+ */
+qint64
+ServerDiscoverer::lastConnectTime() {
+    return connectTime;
+}
+
+
+/*!
+ * \brief ServerDiscoverer::connectionCount
+ * \return How many times we (re)connected to a Server
+ */
+int
+ServerDiscoverer::connectionCount() {
+    return connections;
+}
+
 
 /*!
 * \brief ServerDiscoverer::Discover
@@ -81,13 +188,13 @@ ServerDiscoverer::Discover() {
     QString sMessage = "<getServer>"+ QHostInfo::localHostName() + "</getServer>";
     QByteArray datagram = sMessage.toUtf8();
 
-    if(pNoServerWindow == Q_NULLPTR) {
-        pNoServerWindow = new MessageWindow(Q_NULLPTR);
-        pNoServerWindow->setDisplayedText(tr("In Attesa della Connessione con il Server"));
-    }
-    // No other window should obscure this one
-    if(!pNoServerWindow->isVisible())
-        pNoServerWindow->showFullScreen();
+    if(!connectClock.isValid())
+        connectClock.start();
+    showNoServerWindow();
+    // Don't wait for the discovery to try the last known Server
+    tryLastServer();
+    joinBeaconGroup();
+    QList<int> usedInterfaces;
     QList<QNetworkInterface> ifaces = QNetworkInterface::allInterfaces();
     for(int i=0; i<ifaces.count(); i++) {
         QNetworkInterface iface = ifaces.at(i);
@@ -96,20 +203,25 @@ ServerDiscoverer::Discover() {
            iface.flags().testFlag(QNetworkInterface::CanMulticast) &&
           !iface.flags().testFlag(QNetworkInterface::IsLoopBack))
         {
-            QUdpSocket* pDiscoverySocket = new QUdpSocket(this);
-            // We need to save all the created sockets...
-            discoverySocketArray.append(pDiscoverySocket);
-            // To manage the messages from the socket
-            connect(pDiscoverySocket, SIGNAL(readyRead()),
-                    this, SLOT(onProcessDiscoveryPendingDatagrams()));
-            if(!pDiscoverySocket->bind()) {
-                logMessage(logFile,
-                           Q_FUNC_INFO,
-                           QString("Unable to bind the Discovery Socket"));
-                continue;
+            // The socket of each interface is reused at each discovery
+            QUdpSocket* pDiscoverySocket = discoverySocketMap.value(iface.index(), Q_NULLPTR);
+            if(!pDiscoverySocket) {
+                pDiscoverySocket = new QUdpSocket(this);
+                if(!pDiscoverySocket->bind()) {
+                    logMessage(logFile,
+                               Q_FUNC_INFO,
+                               QString("Unable to bind the Discovery Socket"));
+                    delete pDiscoverySocket;
+                    continue;
+                }
+                pDiscoverySocket->setMulticastInterface(iface);
+                pDiscoverySocket->setSocketOption(QAbstractSocket::MulticastTtlOption, 1);
+                // To manage the messages from the socket
+                connect(pDiscoverySocket, SIGNAL(readyRead()),
+                        this, SLOT(onProcessDiscoveryPendingDatagrams()));
+                discoverySocketMap.insert(iface.index(), pDiscoverySocket);
             }
-            pDiscoverySocket->setMulticastInterface(iface);
-            pDiscoverySocket->setSocketOption(QAbstractSocket::MulticastTtlOption, 1);
+            usedInterfaces.append(iface.index());
             written = pDiscoverySocket->writeDatagram(datagram.data(), datagram.size(),
                                                       discoveryAddress, discoveryPort);
 #ifdef LOG_VERBOSE_VERBOSE
@@ -132,19 +244,90 @@ ServerDiscoverer::Discover() {
             }
         }
     }
+    // Close the sockets of the interfaces gone away
+    QList<int> oldInterfaces = discoverySocketMap.keys();
+    for(int i=0; i<oldInterfaces.count(); i++) {
+        if(!usedInterfaces.contains(oldInterfaces.at(i))) {
+            QUdpSocket *pDiscovery = discoverySocketMap.take(oldInterfaces.at(i));
+            pDiscovery->disconnect();
+            pDiscovery->abort();
+            pDiscovery->deleteLater();
+        }
+    }
+    bDiscovering = bStarted;
     if(bStarted) {
         connect(&serverConnectionTimeoutTimer, SIGNAL(timeout()),
                 this, SLOT(onServerConnectionTimeout()));
-        serverConnectionTimeoutTimer.start(SERVER_CONNECTION_TIMEOUT);
+        // The wait grows at each unanswered discovery
+        serverConnectionTimeoutTimer.start(jittered(discoveryTimeout));
+        discoveryTimeout = qMin(2*discoveryTimeout, SERVER_CONNECTION_TIMEOUT);
     }
     return bStarted;
 }
 
 
+/*!
+ * \brief ServerDiscoverer::jittered
+ * \param delay A delay (ms)
+ * \return The delay randomly spread by RETRY_JITTER % to avoid
+ * all the panels retrying at the same time
+ */
+int
+ServerDiscoverer::jittered(int delay) {
+    int jitter = delay*RETRY_JITTER/100;
+    return delay - jitter + QRandomGenerator::global()->bounded(2*jitter+1);
+}
+
+
+/*!
+ * \brief ServerDiscoverer::tryLastServer
+ * Open a connection to the last Server we were connected to (if any)
+ */
+void
+ServerDiscoverer::tryLastServer() {
+    if(sLastServerUrl.isEmpty())
+        return;
+#ifdef LOG_VERBOSE
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               QString("Trying last Server URL: %1")
+               .arg(sLastServerUrl));
+#endif
+    openServerSocket(sLastServerUrl, lastPanelType);
+}
+
+
+/*!
+ * \brief ServerDiscoverer::openServerSocket Start a connection attempt
+ * \param sUrl The Panel Server URL
+ * \param iPanelType The Panel Type announced for that Server
+ */
+void
+ServerDiscoverer::openServerSocket(QString sUrl, int iPanelType) {
+    for(int i=0; i<serverSocketArray.count(); i++) {
+        if(serverSocketArray.at(i)->requestUrl() == QUrl(sUrl))
+            return;// Already trying
+    }
+    pPanelServerSocket = new QWebSocket();
+    pPanelServerSocket->setProperty("panelType", iPanelType);
+    serverSocketArray.append(pPanelServerSocket);
+    connect(pPanelServerSocket, SIGNAL(connected()),
+            this, SLOT(onPanelServerConnected()));
+    connect(pPanelServerSocket, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SLOT(onPanelServerSocketError(QAbstractSocket::SocketError)));
+    pPanelServerSocket->ignoreSslErrors();
+    pPanelServerSocket->open(QUrl(sUrl));
+}
+
+
 /*!
  * \brief ServerDiscoverer::onProcessDiscoveryPendingDatagrams
  *
- * A Panel Server sent back an answer...
+ * A Panel Server sent back an answer (or a beacon)...
+ * The Beacon Socket receives also the requests of all the panels:
+ * they carry no "serverIP" and are discarded.
+ * The first well formed message stops the discovery: the copies
+ * of the same beacon heard on the other interfaces are ignored.
  */
 void
 ServerDiscoverer::onProcessDiscoveryPendingDatagrams() {
@@ -163,6 +346,11 @@ ServerDiscoverer::onProcessDiscoveryPendingDatagrams() {
         }
         answer.append(datagram);
     }
+    if(!bDiscovering) {// A late answer or a beacon: we are not looking for a Server
+        if(bStandbyMode)// ...but it could be a backup one
+            checkStandby(XML_Parse(answer.data(), "serverIP"));
+        return;
+    }
 #ifdef LOG_VERBOSE
     logMessage(logFile,
                Q_FUNC_INFO,
@@ -183,8 +371,8 @@ ServerDiscoverer::onProcessDiscoveryPendingDatagrams() {
         // A well formed answer has been received.
         serverConnectionTimeoutTimer.stop();
         serverConnectionTimeoutTimer.disconnect();
-        // Remove all the "discovery sockets" to avoid overlapping
-        cleanDiscoverySockets();
+        // Ignore any further answer to avoid overlapping
+        stopDiscovery();
         checkServerAddresses();
     }
 }
@@ -212,14 +400,7 @@ ServerDiscoverer::checkServerAddresses() {
                        QString("Trying Server URL: %1")
                        .arg(serverUrl));
 #endif
-            pPanelServerSocket = new QWebSocket();
-            serverSocketArray.append(pPanelServerSocket);
-            connect(pPanelServerSocket, SIGNAL(connected()),
-                    this, SLOT(onPanelServerConnected()));
-            connect(pPanelServerSocket, SIGNAL(error(QAbstractSocket::SocketError)),
-                    this, SLOT(onPanelServerSocketError(QAbstractSocket::SocketError)));
-            pPanelServerSocket->ignoreSslErrors();
-            pPanelServerSocket->open(QUrl(serverUrl));
+            openServerSocket(serverUrl, panelType);
         }
     }
 }
@@ -238,24 +419,72 @@ ServerDiscoverer::onPanelServerConnected() {
 #endif
     serverConnectionTimeoutTimer.stop();
     serverConnectionTimeoutTimer.disconnect();
+    retryTimer.stop();
+    // panelKeepTimer stops only when the Panel itself is connected again
     QWebSocket* pSocket = qobject_cast<QWebSocket*>(sender());
     serverUrl = pSocket->requestUrl().toString();
+    panelType = pSocket->property("panelType").toInt();
     cleanServerSockets();
+    stopDiscovery();
+    retryDelay = RETRY_MIN_DELAY;
+    discoveryTimeout = DISCOVERY_MIN_TIMEOUT;
+    rememberServer();
+    if(pStandbySocket && pStandbySocket->requestUrl() == QUrl(serverUrl))
+        closeStandby();// It is now the primary Server
+    if(connectClock.isValid())
+        connectTime = connectClock.elapsed();
+    connectClock.invalidate();
+    connections++;
+
+    // A Server with a different Panel Type needs a new Panel
+    if(pScorePanel && scorePanelType != panelType) {
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Panel Type changed from %1 to %2: rebuilding the Panel")
+                   .arg(scorePanelType)
+                   .arg(panelType));
+        closeScorePanel();
+    }
+    // The Panel still on screen just needs a new connection
+    if(pScorePanel)
+        pScorePanel->reconnect(serverUrl);
+    else
+        createScorePanel();
+    delete pNoServerWindow;
+    pNoServerWindow = Q_NULLPTR;
+}
 
-    // Delete old Panel instance to prevent memory leaks
+
+/*!
+ * \brief ServerDiscoverer::createScorePanel
+ * Build and show the Score Panel for the current Server and Panel Type
+ */
+void
+ServerDiscoverer::createScorePanel() {
+    pScorePanel = new VolleyPanel(serverUrl, logFile, sBaseDir);
+    scorePanelType = panelType;
+    pScorePanel->setMediaEnabled(bMediaEnabled);
+
+    connect(pScorePanel, SIGNAL(connectionLost()),
+            this, SLOT(onPanelConnectionLost()));
+    connect(pScorePanel, SIGNAL(connectionRestored()),
+            this, SLOT(onPanelConnectionRestored()));
+
+    pScorePanel->showFullScreen();
+}
+
+
+/*!
+ * \brief ServerDiscoverer::closeScorePanel
+ */
+void
+ServerDiscoverer::closeScorePanel() {
     if(pScorePanel) {
         pScorePanel->disconnect();
-        delete pScorePanel;
+        pScorePanel->close();
+        pScorePanel->deleteLater();
         pScorePanel = Q_NULLPTR;
     }
-    pScorePanel = new VolleyPanel(serverUrl, logFile);
-
-    connect(pScorePanel, SIGNAL(panelClosed()),
-            this, SLOT(onPanelClosed()));
-
-    delete pNoServerWindow;
-    pNoServerWindow = Q_NULLPTR;
-    pScorePanel->showFullScreen();
 }
 
 
@@ -265,35 +494,297 @@ ServerDiscoverer::onPanelServerConnected() {
  */
 void
 ServerDiscoverer::onPanelServerSocketError(QAbstractSocket::SocketError error) {
+    QWebSocket* pSocket = qobject_cast<QWebSocket*>(sender());
     logMessage(logFile,
                Q_FUNC_INFO,
                QString("%1 %2 Error %3")
-               .arg(pPanelServerSocket->requestUrl().toString())
-               .arg(pPanelServerSocket->errorString())
+               .arg(pSocket->requestUrl().toString())
+               .arg(pSocket->errorString())
                .arg(error));
+    // The last known Server is retried without waiting for the discovery
+    if(pSocket->requestUrl() == QUrl(sLastServerUrl)) {
+        serverSocketArray.removeOne(pSocket);
+        pSocket->disconnect();
+        pSocket->deleteLater();
+        scheduleRetry();
+    }
 }
 
 
 /*!
  * \brief ServerDiscoverer::onServerConnectionTimeout
  * Called when no messages or connections are received within the
- * SERVER_CONNECTION_TIMEOUT time
+ * discovery timeout
  */
 void
 ServerDiscoverer::onServerConnectionTimeout() {
     serverConnectionTimeoutTimer.stop();
     serverConnectionTimeoutTimer.disconnect();
-    if(pNoServerWindow == Q_NULLPTR) {
-        pNoServerWindow = new MessageWindow(Q_NULLPTR);
-        pNoServerWindow->setDisplayedText(tr("In Attesa della Connessione con il Server"));
+    // Restart the discovery process
+    restartDiscovery();
+}
+
+
+/*!
+ * \brief ServerDiscoverer::scheduleRetry
+ * Wait before retrying the last known Server: the delay doubles
+ * at each failure, up to SERVER_CONNECTION_TIMEOUT
+ */
+void
+ServerDiscoverer::scheduleRetry() {
+    if(retryTimer.isActive())
+        return;
+    int delay = jittered(retryDelay);
+    retryDelay = qMin(2*retryDelay, SERVER_CONNECTION_TIMEOUT);
+#ifdef LOG_VERBOSE
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               QString("Retrying %1 in %2 ms")
+               .arg(sLastServerUrl)
+               .arg(delay));
+#endif
+    retryTimer.start(delay);
+}
+
+
+/*!
+ * \brief ServerDiscoverer::onTimeToRetry
+ */
+void
+ServerDiscoverer::onTimeToRetry() {
+    tryLastServer();
+}
+
+
+/*!
+ * \brief ServerDiscoverer::onPanelConnectionLost Invoked from the Score Panel
+ * when its Server connection has been lost.
+ *
+ * The Panel keeps showing the last status for up to PANEL_KEEP_TIME
+ * while we look for the Server again. The deadline starts at the first
+ * loss: the failed reconnections (that are reported here again) don't
+ * move it forward.
+ */
+void
+ServerDiscoverer::onPanelConnectionLost() {
+    serverConnectionTimeoutTimer.stop();
+    serverConnectionTimeoutTimer.disconnect();
+    retryTimer.stop();
+    retryDelay = RETRY_MIN_DELAY;
+    discoveryTimeout = DISCOVERY_MIN_TIMEOUT;
+    connectClock.start();
+    // Switch at once to the backup Server, if it is alive
+    if(pStandbySocket &&
+       pStandbySocket->state() == QAbstractSocket::ConnectedState &&
+       standbyMissedPongs < STANDBY_MAX_MISSES)
+    {
+        QWebSocket *pSocket = pStandbySocket;
+        standbyPingTimer.stop();
+        pSocket->disconnect();
+        pStandbySocket = Q_NULLPTR;
+        serverUrl = pSocket->requestUrl().toString();
+        panelType = pSocket->property("panelType").toInt();
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Failing over to %1").arg(serverUrl));
+        rememberServer();
+        if(scorePanelType != panelType) {
+            // The new Panel will open its own connection
+            pSocket->abort();
+            pSocket->deleteLater();
+            closeScorePanel();
+            createScorePanel();
+        }
+        else
+            pScorePanel->switchSocket(pSocket);
+        connectTime = connectClock.elapsed();
+        connectClock.invalidate();
+        connections++;
+        return;
     }
-    // No other window should obscure this one
-    if(!pNoServerWindow->isVisible())
-        pNoServerWindow->showFullScreen();
-    cleanDiscoverySockets();
+    closeStandby();
+    if(!panelKeepTimer.isActive())
+        panelKeepTimer.start(PANEL_KEEP_TIME);
+    restartDiscovery();
+}
+
+
+/*!
+ * \brief ServerDiscoverer::onPanelConnectionRestored Invoked from the Score Panel
+ * when its Server connection is working again
+ */
+void
+ServerDiscoverer::onPanelConnectionRestored() {
+    panelKeepTimer.stop();
+}
+
+
+/*!
+ * \brief ServerDiscoverer::rememberServer
+ * Save the current Server for a fast reconnection
+ */
+void
+ServerDiscoverer::rememberServer() {
+    if(serverUrl != sLastServerUrl || panelType != lastPanelType) {
+        sLastServerUrl = serverUrl;
+        lastPanelType  = panelType;
+        QSettings settings("Gabriele Salvato", "Volley Panel");
+        settings.setValue("server/lastUrl", sLastServerUrl);
+        settings.setValue("server/lastPanelType", lastPanelType);
+    }
+}
+
+
+/*!
+ * \brief ServerDiscoverer::checkStandby
+ * Open the warm standby connection with a backup Server (if needed)
+ * \param sServers The "serverIP" content of an answer or a beacon
+ * (address,panelType;...)
+ *
+ * A message listing the address of the current Server comes from
+ * the current Server itself (maybe through another interface).
+ */
+void
+ServerDiscoverer::checkStandby(QString sServers) {
+    if(sServers == QString("NoData") || pStandbySocket)
+        return;
+    if(!pScorePanel || panelKeepTimer.isActive())
+        return;// Not connected
+    QString sPrimaryHost = QUrl(serverUrl).host();
+    QString sStandbyUrl;
+    int standbyPanelType = 0;
+    QStringList servers = sServers.split(";", Qt::SkipEmptyParts);
+    for(int i=0; i<servers.count(); i++) {
+        QStringList arguments = servers.at(i).split(",", Qt::SkipEmptyParts);
+        if(arguments.count() < 2)
+            continue;
+        if(arguments.at(0) == sPrimaryHost)
+            return;
+        if(sStandbyUrl.isEmpty()) {
+            sStandbyUrl = QString("ws://%1:%2").arg(arguments.at(0)).arg(serverPort);
+            standbyPanelType = arguments.at(1).toInt();
+        }
+    }
+    if(sStandbyUrl.isEmpty())
+        return;
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               QString("Opening a standby connection with %1").arg(sStandbyUrl));
+    pStandbySocket = new QWebSocket();
+    pStandbySocket->setProperty("panelType", standbyPanelType);
+    connect(pStandbySocket, SIGNAL(connected()),
+            this, SLOT(onStandbyConnected()));
+    connect(pStandbySocket, SIGNAL(disconnected()),
+            this, SLOT(onStandbyLost()));
+    connect(pStandbySocket, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SLOT(onStandbyLost()));
+    connect(pStandbySocket, SIGNAL(pong(quint64,QByteArray)),
+            this, SLOT(onStandbyPong()));
+    pStandbySocket->ignoreSslErrors();
+    pStandbySocket->open(QUrl(sStandbyUrl));
+}
+
+
+/*!
+ * \brief ServerDiscoverer::onStandbyConnected
+ * The backup Server accepted the connection: keep it alive
+ */
+void
+ServerDiscoverer::onStandbyConnected() {
+    standbyMissedPongs = 0;
+    standbyPingTimer.start(STANDBY_PING_TIME);
+}
+
+
+/*!
+ * \brief ServerDiscoverer::onTimeToPingStandby
+ */
+void
+ServerDiscoverer::onTimeToPingStandby() {
+    if(!pStandbySocket)
+        return;
+    if(standbyMissedPongs >= STANDBY_MAX_MISSES) {
+        onStandbyLost();
+        return;
+    }
+    standbyMissedPongs++;
+    pStandbySocket->ping();
+}
+
+
+/*!
+ * \brief ServerDiscoverer::onStandbyPong
+ */
+void
+ServerDiscoverer::onStandbyPong() {
+    standbyMissedPongs = 0;
+}
+
+
+/*!
+ * \brief ServerDiscoverer::onStandbyLost
+ * The backup Server is not available: a new one will be taken
+ * from the next answer or beacon
+ */
+void
+ServerDiscoverer::onStandbyLost() {
+    if(pStandbySocket)
+        logMessage(logFile,
+                   Q_FUNC_INFO,
+                   QString("Standby Server lost: %1")
+                   .arg(pStandbySocket->requestUrl().toString()));
+    closeStandby();
+}
+
+
+/*!
+ * \brief ServerDiscoverer::closeStandby
+ */
+void
+ServerDiscoverer::closeStandby() {
+    standbyPingTimer.stop();
+    if(pStandbySocket) {
+        pStandbySocket->disconnect();
+        pStandbySocket->abort();
+        pStandbySocket->deleteLater();
+    }
+    pStandbySocket = Q_NULLPTR;
+}
+
+
+/*!
+ * \brief ServerDiscoverer::onTimeToClosePanel
+ * The Server is still missing: close the Score Panel
+ */
+void
+ServerDiscoverer::onTimeToClosePanel() {
+    logMessage(logFile,
+               Q_FUNC_INFO,
+               QString("Server not found: closing the Panel"));
+    closeStandby();
+    closeScorePanel();
+    serverConnectionTimeoutTimer.stop();
+    serverConnectionTimeoutTimer.disconnect();
+    restartDiscovery();
+}
+
+
+/*!
+ * \brief ServerDiscoverer::restartDiscovery
+ * Drop the pending attempts and start a new discovery
+ */
+void
+ServerDiscoverer::restartDiscovery() {
+    showNoServerWindow();
+    stopDiscovery();
     cleanServerSockets();
-    // Restart the discovery process
     if(!Discover()) {
+        if(pScorePanel) {// The network could come back in a while
+            connect(&serverConnectionTimeoutTimer, SIGNAL(timeout()),
+                    this, SLOT(onServerConnectionTimeout()));
+            serverConnectionTimeoutTimer.start(SERVER_CONNECTION_TIMEOUT);
+            return;
+        }
         delete pNoServerWindow;
         pNoServerWindow = Q_NULLPTR;
         emit checkNetwork();
@@ -302,10 +793,13 @@ ServerDiscoverer::onServerConnectionTimeout() {
 
 
 /*!
- * \brief ServerDiscoverer::onPanelClosed Invoked from the Score Panel when it closes
+ * \brief ServerDiscoverer::showNoServerWindow
+ * Show the "waiting" message unless a Score Panel is still on screen
  */
 void
-ServerDiscoverer::onPanelClosed() {
+ServerDiscoverer::showNoServerWindow() {
+    if(pScorePanel)
+        return;
     if(pNoServerWindow == Q_NULLPTR) {
         pNoServerWindow = new MessageWindow(Q_NULLPTR);
         pNoServerWindow->setDisplayedText(tr("In Attesa della Connessione con il Server"));
@@ -313,41 +807,88 @@ ServerDiscoverer::onPanelClosed() {
     // No other window should obscure this one
     if(!pNoServerWindow->isVisible())
         pNoServerWindow->showFullScreen();
-    cleanDiscoverySockets();
-    cleanServerSockets();
-    if(!Discover()) {
-        delete pNoServerWindow;
-        pNoServerWindow = Q_NULLPTR;
-        emit checkNetwork();
-    }
 }
 
 
 /*!
- * \brief ServerDiscoverer::cleanDiscoverySockets
+ * \brief ServerDiscoverer::stopDiscovery
+ * Stop accepting answers (the discovery sockets are kept for the next time)
  */
 void
-ServerDiscoverer::cleanDiscoverySockets() {
+ServerDiscoverer::stopDiscovery() {
 #ifdef LOG_VERBOSE
     logMessage(logFile,
                Q_FUNC_INFO,
-               QString("Cleaning Discovery Sockets"));
+               QString("Stopping the Discovery"));
 #endif
-    for(int i=0; i<discoverySocketArray.count(); i++) {
-        QUdpSocket *pDiscovery = qobject_cast<QUdpSocket *>(discoverySocketArray.at(i));
-        pDiscovery->disconnect();
-        pDiscovery->abort();
-        // deleteLater() to Allow for the processing of
-        // already queued events.
-        // Don't change in: delete pDiscovery;
-        pDiscovery->deleteLater();//
-    }
-    discoverySocketArray.clear();
+    bDiscovering = false;
+}
+
+
+/*!
+ * \brief ServerDiscoverer::onNetworkChanged
+ * Invoked when a link or an address has changed:
+ * if we are still looking for the Server, look again at once.
+ */
+void
+ServerDiscoverer::onNetworkChanged() {
+    // The beacons are needed also while connected (for the standby Server)
+    joinBeaconGroup();
+    if(pScorePanel && !panelKeepTimer.isActive())
+        return;// Connected
 #ifdef LOG_VERBOSE
     logMessage(logFile,
                Q_FUNC_INFO,
-               QString("Done Cleaning Discovery Sockets"));
+               QString("Network changed: restarting the Discovery"));
 #endif
+    serverConnectionTimeoutTimer.stop();
+    serverConnectionTimeoutTimer.disconnect();
+    retryDelay = RETRY_MIN_DELAY;
+    discoveryTimeout = DISCOVERY_MIN_TIMEOUT;
+    restartDiscovery();
+}
+
+
+/*!
+ * \brief ServerDiscoverer::joinBeaconGroup
+ * Join the discovery group on every usable interface not yet joined
+ * (the group joined without an interface is heard only on the
+ * interface of the default route) and forget the interfaces gone away.
+ */
+void
+ServerDiscoverer::joinBeaconGroup() {
+    if(pBeaconSocket->state() != QAbstractSocket::BoundState)
+        return;
+    QList<int> usedInterfaces;
+    QList<QNetworkInterface> ifaces = QNetworkInterface::allInterfaces();
+    for(int i=0; i<ifaces.count(); i++) {
+        QNetworkInterface iface = ifaces.at(i);
+        if(iface.flags().testFlag(QNetworkInterface::IsUp) &&
+           iface.flags().testFlag(QNetworkInterface::IsRunning) &&
+           iface.flags().testFlag(QNetworkInterface::CanMulticast) &&
+          !iface.flags().testFlag(QNetworkInterface::IsLoopBack))
+        {
+            usedInterfaces.append(iface.index());
+            if(beaconInterfaces.contains(iface.index()))
+                continue;
+            if(pBeaconSocket->joinMulticastGroup(discoveryAddress, iface)) {
+                beaconInterfaces.append(iface.index());
+            }
+            else {
+                logMessage(logFile,
+                           Q_FUNC_INFO,
+                           QString("Unable to join %1 on %2: %3")
+                           .arg(discoveryAddress.toString())
+                           .arg(iface.humanReadableName())
+                           .arg(pBeaconSocket->errorString()));
+            }
+        }
+    }
+    // A membership is dropped with its interface: join again when it is back
+    for(int i=beaconInterfaces.count()-1; i>=0; i--) {
+        if(!usedInterfaces.contains(beaconInterfaces.at(i)))
+            beaconInterfaces.removeAt(i);
+    }
 }
 
 
@@ -22,10 +22,12 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <QObject>
 #include <QList>
 #include <QVector>
+#include <QMap>
 #include <QHostAddress>
 #include <QSslError>
 #include <QTimer>
 #include <QSslError>
+#include <QElapsedTimer>
 
 QT_FORWARD_DECLARE_CLASS(QUdpSocket)
 QT_FORWARD_DECLARE_CLASS(QWebSocket)
@@ -38,6 +40,14 @@ class ServerDiscoverer : public QObject
     Q_OBJECT
 public:
     explicit ServerDiscoverer(QFile *myLogFile=Q_NULLPTR, QObject *parent=Q_NULLPTR);
+    void        setBaseDir(QString sMyBaseDir);
+    void        setMediaEnabled(bool bEnabled);
+    ScorePanel *scorePanel();
+    qint64      lastConnectTime();
+    int         connectionCount();
+
+public slots:
+    void onNetworkChanged();
 
 signals:
     void serverFound(QString serverUrl, int panelType);/*!< Emitted when a Server sent an correct answer */
@@ -48,22 +58,44 @@ private slots:
     void onPanelServerConnected();
     void onPanelServerSocketError(QAbstractSocket::SocketError error);
     void onServerConnectionTimeout();
-    void onPanelClosed();
+    void onPanelConnectionLost();
+    void onPanelConnectionRestored();
+    void onTimeToClosePanel();
+    void onTimeToRetry();
+    void onStandbyConnected();
+    void onStandbyLost();
+    void onStandbyPong();
+    void onTimeToPingStandby();
 
 public:
     bool Discover();
 
 protected:
     void checkServerAddresses();
+    void tryLastServer();
+    void openServerSocket(QString sUrl, int iPanelType);
+    void scheduleRetry();
+    int  jittered(int delay);
+    void rememberServer();
+    void checkStandby(QString sServers);
+    void closeStandby();
 
 private:
-    void cleanDiscoverySockets();
+    void stopDiscovery();
     void cleanServerSockets();
+    void showNoServerWindow();
+    void restartDiscovery();
+    void joinBeaconGroup();
+    void createScorePanel();
+    void closeScorePanel();
 
 private:
     QFile               *logFile;
     QList<QHostAddress>  broadcastAddress;
-    QVector<QUdpSocket*> discoverySocketArray;
+    QMap<int, QUdpSocket*> discoverySocketMap;
+    bool                 bDiscovering;
+    QUdpSocket          *pBeaconSocket;
+    QList<int>           beaconInterfaces;// The interfaces where the Beacon Socket joined the group
     QVector<QWebSocket*> serverSocketArray;
     quint16              discoveryPort;
     quint16              serverPort;
@@ -73,8 +105,24 @@ private:
     QWebSocket          *pPanelServerSocket;
     QString              serverUrl;
     QTimer               serverConnectionTimeoutTimer;
+    QTimer               retryTimer;
+    QTimer               panelKeepTimer;
+    int                  retryDelay;
+    int                  discoveryTimeout;
+    QString              sLastServerUrl;
+    int                  lastPanelType;
+    bool                 bStandbyMode;
+    QWebSocket          *pStandbySocket;
+    QTimer               standbyPingTimer;
+    int                  standbyMissedPongs;
     MessageWindow       *pNoServerWindow;
     ScorePanel          *pScorePanel;
+    int                  scorePanelType;// The Panel Type pScorePanel has been built for
+    QString              sBaseDir;
+    bool                 bMediaEnabled;
+    QElapsedTimer        connectClock;
+    qint64               connectTime;
+    int                  connections;
 };
 
 #endif // SERVERDISCOVERER_H
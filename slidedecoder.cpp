@@ -0,0 +1,569 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#include <QImageReader>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QFile>
+#include <QSaveFile>
+#include <QDir>
+#include <cstring>
+#include <QPainter>
+#include <QRunnable>
+#include <QThread>
+
+#include "slidedecoder.h"
+
+
+#define DECODE_THREADS 2 // At most: the GUI and the transfers need a core too
+
+#define CACHE_RAM_FRACTION 4       // The frames may use 1/4 of the available memory
+#define CACHE_MIN_BUDGET   (32*1024*1024)
+#define CACHE_MAX_BUDGET   (512*1024*1024)
+
+#define FRAME_MAGIC  "VPFRAME1"
+
+
+/*!
+ * \brief The header of a prepared frame file (followed by the pixels)
+ */
+struct frameHeader {
+    char    magic[8];    /*!< \brief FRAME_MAGIC */
+    quint32 width;       /*!< \brief The frame width */
+    quint32 height;      /*!< \brief The frame height */
+    quint32 bytesPerLine;/*!< \brief The bytes of each scan line */
+    quint32 format;      /*!< \brief The QImage::Format of the pixels */
+    qint64  sourceTime;  /*!< \brief The modification time (ms) of the slide */
+};
+
+
+/*!
+ * \brief The SlideDecodeTask class Decodes a slide on a pool Thread
+ */
+class SlideDecodeTask : public QRunnable
+{
+public:
+    SlideDecodeTask(SlideDecoder *pMyDecoder, QString sMyFileName, QString sMyKey,
+                    QSize mySize, QImage::Format myFormat, int myGeneration)
+        : pDecoder(pMyDecoder)
+        , sFileName(sMyFileName)
+        , sKey(sMyKey)
+        , size(mySize)
+        , format(myFormat)
+        , generation(myGeneration)
+    {
+    }
+
+    void run() {
+        QImage image = SlideDecoder::decode(sFileName, size, format);
+        QMetaObject::invokeMethod(pDecoder, "onFrameDecoded", Qt::QueuedConnection,
+                                  Q_ARG(QString, sFileName),
+                                  Q_ARG(QString, sKey),
+                                  Q_ARG(QImage, image),
+                                  Q_ARG(int, generation));
+    }
+
+private:
+    SlideDecoder *pDecoder;
+    QString       sFileName;
+    QString       sKey;
+    QSize         size;
+    QImage::Format format;
+    int           generation;
+};
+
+
+/*!
+ * \brief The SlidePrepareTask class Prepares the frame file of a new slide
+ */
+class SlidePrepareTask : public QRunnable
+{
+public:
+    SlidePrepareTask(QString sMyFileName, QSize mySize, QImage::Format myFormat)
+        : sFileName(sMyFileName)
+        , size(mySize)
+        , format(myFormat)
+    {
+    }
+
+    void run() {
+        SlideDecoder::decode(sFileName, size, format);
+    }
+
+private:
+    QString        sFileName;
+    QSize          size;
+    QImage::Format format;
+};
+
+
+/*!
+ * \brief unmapFrame Release a mapped frame file when its QImage is destroyed
+ */
+static void
+unmapFrame(void *pInfo) {
+    QFile *pFile = static_cast<QFile *>(pInfo);
+    pFile->close();// Unmaps the memory too
+    delete pFile;
+}
+
+
+/*!
+ * \brief SlideDecoder::SlideDecoder Decodes the slides ahead of time
+ * \param parent The parent object.
+ *
+ * The slides are decoded, scaled and centered on a frame as large as
+ * the Slide Window by a pool of worker Threads, so that the GUI Thread
+ * (that handles the score messages too) never waits for a large JPEG.
+ * The frames are kept in a LRU cache, keyed by file and modification
+ * time, so that the following rounds of the slide show need no decode
+ * at all. Unless a budget is set, the cache adapts its size to the
+ * available memory.
+ * The frames are ARGB32_Premultiplied or, to halve their memory, RGB16.
+ * Every decoded frame is also saved, as raw pixels, in the
+ * FRAME_DIR of the slide folder: from then on the slide is simply
+ * memory mapped, with no decode and no scale (even after a restart).
+ * New slides are prepared as soon as they have been downloaded and
+ * those that can't be decoded are marked as broken, so that they are
+ * never selected for the show.
+ */
+SlideDecoder::SlideDecoder(QObject *parent)
+    : QObject(parent)
+    , pixelFormat(QImage::Format_ARGB32_Premultiplied)
+    , generation(0)
+    , cacheBudget(0)
+{
+    pool.setMaxThreadCount(qBound(1, QThread::idealThreadCount()-1, DECODE_THREADS));
+    updateBudget();
+}
+
+
+/*!
+ * \brief SlideDecoder::~SlideDecoder Wait for the running decodes
+ */
+SlideDecoder::~SlideDecoder() {
+    pool.clear();
+    pool.waitForDone();
+}
+
+
+/*!
+ * \brief SlideDecoder::setTargetSize
+ * \param size The size of the frames (i.e. of the Slide Window)
+ *
+ * The frames already decoded at a different size are discarded.
+ */
+void
+SlideDecoder::setTargetSize(QSize size) {
+    if(size == frameSize)
+        return;
+    frameSize = size;
+    generation++;// The running decodes are now useless
+    pool.clear();
+    pendingSet.clear();
+    frameCache.clear();
+    prefetch(wantedList);
+}
+
+
+/*!
+ * \brief SlideDecoder::targetSize
+ * \return The size of the frames
+ */
+QSize
+SlideDecoder::targetSize() {
+    return frameSize;
+}
+
+
+/*!
+ * \brief SlideDecoder::setFrameFormat
+ * \param newFormat QImage::Format_ARGB32_Premultiplied or QImage::Format_RGB16
+ *
+ * As for a new size, the frames already decoded are discarded.
+ */
+void
+SlideDecoder::setFrameFormat(QImage::Format newFormat) {
+    if(newFormat == pixelFormat)
+        return;
+    pixelFormat = newFormat;
+    generation++;
+    pool.clear();
+    pendingSet.clear();
+    frameCache.clear();
+    updateBudget();
+    prefetch(wantedList);
+}
+
+
+/*!
+ * \brief SlideDecoder::frameFormat
+ * \return The pixel format of the frames
+ */
+QImage::Format
+SlideDecoder::frameFormat() {
+    return pixelFormat;
+}
+
+
+/*!
+ * \brief SlideDecoder::setCacheBudget
+ * \param bytes The memory for the decoded frames (0 = adapt to the available memory)
+ */
+void
+SlideDecoder::setCacheBudget(qint64 bytes) {
+    cacheBudget = qMax(qint64(0), bytes);
+    updateBudget();
+}
+
+
+/*!
+ * \brief SlideDecoder::updateBudget Resize the cache (costs are in kB)
+ *
+ * With no fixed budget the cache may use a fraction of the memory
+ * available to it (i.e. the free memory plus what it already uses).
+ */
+void
+SlideDecoder::updateBudget() {
+    qint64 budget = cacheBudget;
+    if(budget == 0) {
+        budget = CACHE_MIN_BUDGET;
+        qint64 available = availableMemory();
+        if(available >= 0) {
+            available += qint64(frameCache.totalCost())*1024;
+            budget = qBound(qint64(CACHE_MIN_BUDGET), available/CACHE_RAM_FRACTION, qint64(CACHE_MAX_BUDGET));
+        }
+        // As many frames, not more, with less bits per pixel
+        budget = budget*QImage::toPixelFormat(pixelFormat).bitsPerPixel()/32;
+    }
+    frameCache.setMaxCost(int(budget/1024));
+}
+
+
+/*!
+ * \brief SlideDecoder::availableMemory
+ * \return The memory (bytes) available without swapping or -1 if unknown
+ */
+qint64
+SlideDecoder::availableMemory() {
+    qint64 available = -1;
+    QFile memInfo(QString("/proc/meminfo"));
+    if(memInfo.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        QString sLine;
+        while(!(sLine = QString::fromLatin1(memInfo.readLine())).isEmpty()) {
+            if(sLine.startsWith(QString("MemAvailable:"))) {
+                available = sLine.section(QChar(' '), 1, 1, QString::SectionSkipEmpty).toLongLong()*1024;
+                break;
+            }
+        }
+        memInfo.close();
+    }
+    return available;
+}
+
+
+/*!
+ * \brief SlideDecoder::cacheKey
+ * \return The cache key of a slide: a modified file is a different slide
+ */
+QString
+SlideDecoder::cacheKey(QString sFileName) {
+    QFileInfo fileInfo(sFileName);
+    return QString("%1@%2")
+            .arg(sFileName)
+            .arg(fileInfo.lastModified().toMSecsSinceEpoch());
+}
+
+
+/*!
+ * \brief SlideDecoder::prefetch Decode the slides that will be shown soon
+ * \param fileNames The slides (full path) in the order they are needed
+ */
+void
+SlideDecoder::prefetch(QStringList fileNames) {
+    wantedList = fileNames;
+    if(!frameSize.isValid() || frameSize.isEmpty())
+        return;
+    updateBudget();
+    for(int i=0; i<wantedList.count(); i++) {
+        QString sFileName = wantedList.at(i);
+        QString sKey = cacheKey(sFileName);
+        if(frameCache.contains(sKey) || pendingSet.contains(sKey))
+            continue;
+        pendingSet.insert(sKey);
+        // The sooner a slide is needed, the higher its priority
+        pool.start(new SlideDecodeTask(this, sFileName, sKey, frameSize, pixelFormat, generation),
+                   wantedList.count()-i);
+    }
+}
+
+
+/*!
+ * \brief SlideDecoder::isReady
+ * \return true if the frame of the slide (as it is now on disk) is available
+ */
+bool
+SlideDecoder::isReady(QString sFileName) {
+    return frameCache.contains(cacheKey(sFileName));
+}
+
+
+/*!
+ * \brief SlideDecoder::frame
+ * \return The frame of the slide or a null image if not (yet) available
+ */
+QImage
+SlideDecoder::frame(QString sFileName) {
+    QImage *pFrame = frameCache.object(cacheKey(sFileName));// Now the most recently used
+    if(pFrame == Q_NULLPTR)
+        return QImage();
+    return *pFrame;
+}
+
+
+/*!
+ * \brief SlideDecoder::onFrameDecoded Invoked (on our Thread) when a decode is over
+ */
+void
+SlideDecoder::onFrameDecoded(QString sFileName, QString sKey, QImage image, int iGeneration) {
+    if(iGeneration != generation)
+        return;// Decoded at an old size
+    pendingSet.remove(sKey);
+    if(image.isNull()) {// Unreadable: show an empty frame instead of stalling
+        image = QImage(frameSize, pixelFormat);
+        image.fill(Qt::white);
+    }
+    int cost = qMax(1, int(image.sizeInBytes()/1024));
+    frameCache.insert(sKey, new QImage(image), cost);
+    if(wantedList.contains(sFileName) && frameCache.contains(sKey))
+        emit frameReady(sFileName);
+}
+
+
+/*!
+ * \brief SlideDecoder::decode Decode a slide and center it on a frame (thread safe)
+ * \param sFileName The slide file
+ * \param size The frame size
+ * \param format The frame pixel format
+ * \return The frame or a null image on error
+ *
+ * The image is decoded directly at the size it will be shown: the JPEG
+ * decoder then works on a reduced resolution, that is much faster and
+ * needs much less memory than decoding the full image and scaling it.
+ * The decoded image is dropped as soon as it has been drawn on the frame.
+ */
+QImage
+SlideDecoder::decode(QString sFileName, QSize size, QImage::Format format) {
+    QImage frame = mapFrame(sFileName, size, format);
+    if(!frame.isNull())
+        return frame;// Already prepared
+
+    QImageReader reader(sFileName);
+    QSize imageSize = reader.size();
+    if(imageSize.isValid())
+        reader.setScaledSize(imageSize.scaled(size, Qt::KeepAspectRatio));
+    QImage image = reader.read();
+    if(image.isNull()) {
+        markBroken(sFileName);
+        return QImage();
+    }
+    if(!imageSize.isValid())// The reader could not scale it
+        image = image.scaled(size, Qt::KeepAspectRatio);
+
+    frame = QImage(size, format);
+    int x = (size.width()-image.width())/2;
+    int y = (size.height()-image.height())/2;
+    QPainter painter(&frame);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.fillRect(frame.rect(), Qt::white);
+    painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+    painter.drawImage(x, y, image);
+    painter.end();
+    image = QImage();
+    saveFrame(sFileName, frame);
+    return frame;
+}
+
+
+/*!
+ * \brief SlideDecoder::prepare Prepare (in background) the frame file of a slide
+ * \param sFileName The slide just downloaded
+ * \param size The frame size
+ */
+void
+SlideDecoder::prepare(QString sFileName, QSize size) {
+    if(!size.isValid() || size.isEmpty())
+        return;
+    pool.start(new SlidePrepareTask(sFileName, size, pixelFormat), -1);// After the slides to show
+}
+
+
+/*!
+ * \brief SlideDecoder::framePath
+ * \return The frame file of a slide
+ */
+QString
+SlideDecoder::framePath(QString sFileName) {
+    QFileInfo fileInfo(sFileName);
+    return QString("%1/%2%3.frame")
+            .arg(fileInfo.absolutePath())
+            .arg(FRAME_DIR)
+            .arg(fileInfo.fileName());
+}
+
+
+/*!
+ * \brief SlideDecoder::mapFrame Map the prepared frame of a slide (thread safe)
+ * \param sFileName The slide
+ * \param size The frame size
+ * \param format The frame pixel format
+ * \return The (read only) frame or a null image if not prepared for this size
+ * and format or the slide has been modified since
+ */
+QImage
+SlideDecoder::mapFrame(QString sFileName, QSize size, QImage::Format format) {
+    QFile *pFile = new QFile(framePath(sFileName));
+    if(!pFile->open(QIODevice::ReadOnly)) {
+        delete pFile;
+        return QImage();
+    }
+    frameHeader header;
+    bool bValid = (pFile->read(reinterpret_cast<char *>(&header), sizeof(header)) == qint64(sizeof(header))) &&
+                  (memcmp(header.magic, FRAME_MAGIC, sizeof(header.magic)) == 0) &&
+                  (int(header.width) == size.width()) &&
+                  (int(header.height) == size.height()) &&
+                  (header.format == quint32(format)) &&
+                  (header.sourceTime == QFileInfo(sFileName).lastModified().toMSecsSinceEpoch()) &&
+                  (pFile->size() == qint64(sizeof(header)) + qint64(header.bytesPerLine)*header.height);
+    uchar *pData = Q_NULLPTR;
+    if(bValid)
+        pData = pFile->map(0, pFile->size());
+    if(pData == Q_NULLPTR) {
+        pFile->close();
+        delete pFile;
+        return QImage();
+    }
+    // The image is read only: painting on it makes a copy
+    const uchar *pPixels = pData + sizeof(header);
+    return QImage(pPixels, int(header.width), int(header.height), int(header.bytesPerLine),
+                  format, unmapFrame, pFile);
+}
+
+
+/*!
+ * \brief SlideDecoder::saveFrame Save the frame of a slide (thread safe)
+ * \return true if saved
+ */
+bool
+SlideDecoder::saveFrame(QString sFileName, const QImage &frame) {
+    QString sFramePath = framePath(sFileName);
+    QDir().mkpath(QFileInfo(sFramePath).absolutePath());
+    frameHeader header;
+    memcpy(header.magic, FRAME_MAGIC, sizeof(header.magic));
+    header.width        = quint32(frame.width());
+    header.height       = quint32(frame.height());
+    header.bytesPerLine = quint32(frame.bytesPerLine());
+    header.format       = quint32(frame.format());
+    header.sourceTime   = QFileInfo(sFileName).lastModified().toMSecsSinceEpoch();
+    QSaveFile file(sFramePath);// Written aside and renamed when complete
+    if(!file.open(QIODevice::WriteOnly))
+        return false;
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(frame.constBits()), frame.sizeInBytes());
+    return file.commit();
+}
+
+
+/*!
+ * \brief SlideDecoder::markBroken Quarantine a slide that can't be decoded
+ *
+ * The mark holds the modification time of the slide: a new
+ * version of the file will be tried again.
+ */
+void
+SlideDecoder::markBroken(QString sFileName) {
+    QFileInfo fileInfo(sFileName);
+    if(!fileInfo.exists())
+        return;
+    QString sMarkPath = QString("%1/%2%3.bad")
+                        .arg(fileInfo.absolutePath())
+                        .arg(FRAME_DIR)
+                        .arg(fileInfo.fileName());
+    QDir().mkpath(QFileInfo(sMarkPath).absolutePath());
+    QSaveFile mark(sMarkPath);
+    if(mark.open(QIODevice::WriteOnly)) {
+        mark.write(QByteArray::number(fileInfo.lastModified().toMSecsSinceEpoch()));
+        mark.commit();
+    }
+}
+
+
+/*!
+ * \brief SlideDecoder::isBroken
+ * \return true if the slide (as it is now on disk) can't be decoded
+ */
+bool
+SlideDecoder::isBroken(QString sFileName) {
+    QFileInfo fileInfo(sFileName);
+    QFile mark(QString("%1/%2%3.bad")
+               .arg(fileInfo.absolutePath())
+               .arg(FRAME_DIR)
+               .arg(fileInfo.fileName()));
+    if(!mark.open(QIODevice::ReadOnly))
+        return false;
+    qint64 markTime = mark.readAll().toLongLong();
+    mark.close();
+    return markTime == fileInfo.lastModified().toMSecsSinceEpoch();
+}
+
+
+/*!
+ * \brief SlideDecoder::removeFrame Remove the frame and the mark of a slide
+ * (e.g. when the slide is moved out of its folder)
+ * \param sFileName The slide
+ */
+void
+SlideDecoder::removeFrame(QString sFileName) {
+    QFileInfo fileInfo(sFileName);
+    QString sFrameBase = QString("%1/%2%3")
+                         .arg(fileInfo.absolutePath())
+                         .arg(FRAME_DIR)
+                         .arg(fileInfo.fileName());
+    QFile::remove(sFrameBase + QString(".frame"));
+    QFile::remove(sFrameBase + QString(".bad"));
+}
+
+
+/*!
+ * \brief SlideDecoder::pruneFrames Remove the frames and marks of the deleted slides
+ * \param sSlideDir The slide folder
+ */
+void
+SlideDecoder::pruneFrames(QString sSlideDir) {
+    if(!sSlideDir.endsWith(QString("/"))) sSlideDir+= QString("/");
+    QDir frameDir(sSlideDir + QString(FRAME_DIR));
+    if(!frameDir.exists())
+        return;
+    QFileInfoList frameList = frameDir.entryInfoList(QStringList() << "*.frame" << "*.bad",
+                                                     QDir::Files);
+    for(int i=0; i<frameList.count(); i++) {
+        QString sSlide = frameList.at(i).completeBaseName();// Without .frame or .bad
+        if(!QFileInfo::exists(sSlideDir + sSlide))
+            QFile::remove(frameList.at(i).absoluteFilePath());
+    }
+}
@@ -0,0 +1,81 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#ifndef SLIDEDECODER_H
+#define SLIDEDECODER_H
+
+#include <QObject>
+#include <QImage>
+#include <QCache>
+#include <QSet>
+#include <QSize>
+#include <QStringList>
+#include <QThreadPool>
+
+
+#define FRAME_DIR ".frames/" // Where the prepared frames are kept (in the slide folder)
+
+
+class SlideDecoder : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SlideDecoder(QObject *parent = Q_NULLPTR);
+    ~SlideDecoder();
+    void   setTargetSize(QSize size);
+    QSize  targetSize();
+    void   setFrameFormat(QImage::Format format);
+    QImage::Format frameFormat();
+    void   setCacheBudget(qint64 bytes);
+    void   prefetch(QStringList fileNames);
+    bool   isReady(QString sFileName);
+    QImage frame(QString sFileName);
+    void   prepare(QString sFileName, QSize size);
+
+    static QImage decode(QString sFileName, QSize size, QImage::Format format);
+    static bool   isBroken(QString sFileName);
+    static void   pruneFrames(QString sSlideDir);
+    static void   removeFrame(QString sFileName);
+    static qint64 availableMemory();
+
+signals:
+    void frameReady(QString sFileName);/*!< \brief emitted when a requested slide has been decoded */
+
+private slots:
+    void onFrameDecoded(QString sFileName, QString sKey, QImage image, int iGeneration);
+
+private:
+    QString cacheKey(QString sFileName);
+    void    updateBudget();
+    static QString framePath(QString sFileName);
+    static QImage  mapFrame(QString sFileName, QSize size, QImage::Format format);
+    static bool    saveFrame(QString sFileName, const QImage &frame);
+    static void    markBroken(QString sFileName);
+
+private:
+    QThreadPool            pool;
+    QSize                  frameSize;
+    QImage::Format         pixelFormat;
+    int                    generation;
+    QStringList            wantedList;
+    QSet<QString>          pendingSet;
+    QCache<QString, QImage> frameCache;
+    qint64                 cacheBudget;
+};
+
+#endif // SLIDEDECODER_H
@@ -20,14 +20,18 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <QDebug>
 #include <QPainter>
 #include <QApplication>
+#include <QScreen>
 
 #include "slidewindow.h"
+#include "slidedecoder.h"
+#include "transitionrenderer.h"
 #include "utility.h"
 
 
 #define STEADY_SHOW_TIME       5000 // Change slide time
 #define TRANSITION_TIME        3000 // Transition duration
-#define TRANSITION_GRANULARITY 30   // Steps to complete transition
+#define DEFAULT_REFRESH_RATE   60   // When the screen does not tell its own
+#define PREFETCH_DEPTH         3    // Slides decoded ahead of time
 
 
 /*!
@@ -35,17 +39,18 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
  * \param parent
  */
 SlideWindow::SlideWindow(QWidget *parent)
-    : QLabel(tr("In Attesa delle Slides"))
-    , pPresentImage(Q_NULLPTR)
-    , pNextImage(Q_NULLPTR)
+    : QWidget()
+    , sWaitingText(tr("In Attesa delle Slides"))
     , pPresentImageToShow(Q_NULLPTR)
     , pNextImageToShow(Q_NULLPTR)
     , pShownImage(Q_NULLPTR)
     , iCurrentSlide(0)
     , steadyShowTime(STEADY_SHOW_TIME)
     , transitionTime(TRANSITION_TIME)
-    , transitionGranularity(TRANSITION_GRANULARITY)
-    , transitionStepNumber(0)
+    , transitionProgress(0.0)
+    , transitionFrames(0)
+    , lastFrameRate(0.0)
+    , bLiveBlend(false)
 //    , transitionType(transition_Abrupt)
 //    , transitionType(transition_FromLeft)
     , transitionType(transition_Fade)
@@ -54,14 +59,23 @@ SlideWindow::SlideWindow(QWidget *parent)
     Q_UNUSED(parent);
 
     sSlideDir = QDir::homePath();// Just to have a default location
-    setAlignment(Qt::AlignCenter);
+    // We paint every pixel ourselves (see paintEvent())
+    setAttribute(Qt::WA_OpaquePaintEvent);
     setMinimumSize(QSize(320, 240));
 
+    transitionTimer.setTimerType(Qt::PreciseTimer);
     connect(&transitionTimer, SIGNAL(timeout()),
             this, SLOT(onTransitionTimeElapsed()));
     connect(&showTimer, SIGNAL(timeout()),
             this, SLOT(onNewSlideTimer()));
 
+    // The slides are decoded ahead of time on other Threads
+    pDecoder = new SlideDecoder(this);
+    connect(pDecoder, SIGNAL(frameReady(QString)),
+            this, SLOT(onFrameReady(QString)));
+    // ...and the transitions may be rendered ahead of time too
+    pRenderer = new TransitionRenderer(&framePool, this);
+
     panelPalette = QWidget::palette();
     panelGradient = QLinearGradient(0.0, 0.0, 0.0, height());
     panelGradient.setColorAt(0, QColor(0, 0, START_GRADIENT));
@@ -92,8 +106,6 @@ SlideWindow::~SlideWindow() {
     if(pPresentImageToShow) delete pPresentImageToShow;
     if(pNextImageToShow)    delete pNextImageToShow;
     if(pShownImage)         delete pShownImage;
-    if(pPresentImage)       delete pPresentImage;
-    if(pNextImage)          delete pNextImage;
 }
 
 
@@ -107,13 +119,66 @@ SlideWindow::setSlideDir(QString sNewDir) {
 }
 
 
+/*!
+ * \brief SlideWindow::setCacheBudget
+ * \param bytes The memory for the decoded slides (0 = adapt to the available memory)
+ */
+void
+SlideWindow::setCacheBudget(qint64 bytes) {
+    pDecoder->setCacheBudget(bytes);
+}
+
+
+/*!
+ * \brief SlideWindow::setPrecomposeBudget
+ * \param bytes The memory for the precomposed transition frames (0 = blend them live)
+ */
+void
+SlideWindow::setPrecomposeBudget(qint64 bytes) {
+    pRenderer->setBudget(bytes);
+    precompose();
+}
+
+
+/*!
+ * \brief SlideWindow::setLowMemoryMode
+ * \param bEnable true to use RGB16 frames (no alpha, half the memory)
+ *
+ * The slides are opaque: besides a slightly reduced color depth,
+ * they look the same. The slides are decoded again in the new format.
+ */
+void
+SlideWindow::setLowMemoryMode(bool bEnable) {
+    QImage::Format format = bEnable ? QImage::Format_RGB16 : QImage::Format_ARGB32_Premultiplied;
+    if(format == pDecoder->frameFormat())
+        return;
+    pDecoder->setFrameFormat(format);
+    discardFrames();
+    requestFrames();
+}
+
+
+/*!
+ * \brief SlideWindow::precompose Render the next transition while the present slide is on show
+ */
+void
+SlideWindow::precompose() {
+    if(!pRenderer->isEnabled() || !isReady() || transitionTimer.isActive())
+        return;
+    if(transitionType == transition_Abrupt)
+        return;
+    int nFrames = int(refreshRate()*transitionTime/1000.0);
+    pRenderer->render(*pPresentImageToShow, *pNextImageToShow, transitionType, nFrames);
+}
+
+
 /*!
  * \brief SlideWindow::isReady
- * \return
+ * \return true if both the present and the next slides have been decoded
  */
 bool
 SlideWindow::isReady() {
-    return (pPresentImage != Q_NULLPTR && pNextImage != Q_NULLPTR);
+    return (pPresentImageToShow != Q_NULLPTR && pNextImageToShow != Q_NULLPTR);
 }
 
 
@@ -132,78 +197,121 @@ SlideWindow::updateSlideList() {
         slideDir.setNameFilters(nameFilter);
         slideDir.setFilter(QDir::Files);
         slideList = slideDir.entryInfoList();
+        // The slides that can't be decoded are never shown
+        for(int i=slideList.count()-1; i>=0; i--) {
+            if(SlideDecoder::isBroken(slideList.at(i).absoluteFilePath()))
+                slideList.removeAt(i);
+        }
     }
 }
 
 
 /*!
- * \brief SlideWindow::addNewImage
- * \param image
+ * \brief SlideWindow::prepareSlide Prepare the frame of a new slide in background
+ * \param sFileName The slide (full path) just downloaded
  */
 void
-SlideWindow::addNewImage(QImage image) {
-    QImage* pImage = new QImage(image);
-    if(pPresentImage == Q_NULLPTR) {// That's the first image...
-        pPresentImage = pImage;
-        pNextImage    = Q_NULLPTR;
-        updateSlideList();
-        if(slideList.count() > 1) {
-            iCurrentSlide += 1;
-            iCurrentSlide = iCurrentSlide % slideList.count();
-            pNextImage = new QImage(slideList.at(iCurrentSlide).absoluteFilePath());
-        }
+SlideWindow::prepareSlide(QString sFileName) {
+    QSize frameSize = pDecoder->targetSize();
+    if(!frameSize.isValid() || frameSize.isEmpty()) {// Not yet shown: it will be full screen
+        QList<QScreen*> screens = QApplication::screens();
+        if(screens.count() > 1)
+            frameSize = screens.at(1)->geometry().size();
+        else
+            frameSize = QApplication::primaryScreen()->geometry().size();
     }
-    else if(pNextImage == Q_NULLPTR) {
-        pNextImage    = pImage;
-
-        QImage scaledPresentImage = pPresentImage->scaled(size(), Qt::KeepAspectRatio);
-        QImage scaledNextImage    = pNextImage->scaled(size(), Qt::KeepAspectRatio);
-
-        if(pPresentImageToShow) delete pPresentImageToShow;
-        if(pNextImageToShow)    delete pNextImageToShow;
-        if(pShownImage)         delete pShownImage;
-
-        pPresentImageToShow = new QImage(size(), QImage::Format_ARGB32_Premultiplied);
-        pNextImageToShow    = new QImage(size(), QImage::Format_ARGB32_Premultiplied);
-        pShownImage         = new QImage(size(), QImage::Format_ARGB32_Premultiplied);
-
-        int x = (size().width()-scaledPresentImage.width())/2;
-        int y = (size().height()-scaledPresentImage.height())/2;
-
-        QPainter presentPainter(pPresentImageToShow);
-        presentPainter.setCompositionMode(QPainter::CompositionMode_Source);
-        presentPainter.fillRect(rect(), Qt::white);
-        presentPainter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-        presentPainter.drawImage(x, y, scaledPresentImage);
-        presentPainter.end();
-
-        x = (size().width()-scaledNextImage.width())/2;
-        y = (size().height()-scaledNextImage.height())/2;
-
-        QPainter nextPainter(pNextImageToShow);
-        nextPainter.setCompositionMode(QPainter::CompositionMode_Source);
-        nextPainter.fillRect(rect(), Qt::white);
-        nextPainter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-        nextPainter.drawImage(x, y, scaledNextImage);
-        nextPainter.end();
-
-        computeRegions(&rectSourcePresent, &rectDestinationPresent,
-                       &rectSourceNext,    &rectDestinationNext);
-
-        QPainter painter(pShownImage);
-        painter.setCompositionMode(QPainter::CompositionMode_Source);
-        painter.drawImage(rectDestinationNext, *pNextImageToShow, rectSourceNext);
-        painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-        painter.drawImage(rectDestinationPresent, *pPresentImageToShow, rectSourcePresent);
-        painter.end();
-
-        setPixmap(QPixmap::fromImage(*pShownImage));
+    pDecoder->prepare(sFileName, frameSize);
+}
+
+
+/*!
+ * \brief SlideWindow::requestFrames
+ * Ask the decoder for the present slide and the next PREFETCH_DEPTH ones
+ */
+void
+SlideWindow::requestFrames() {
+    QStringList fileNames;
+    if(!sPresentSlide.isEmpty())
+        fileNames.append(sPresentSlide);
+    for(int i=0; i<PREFETCH_DEPTH && i<slideList.count(); i++) {
+        QString sFileName = slideList.at((iCurrentSlide+i) % slideList.count()).absoluteFilePath();
+        if(!fileNames.contains(sFileName))
+            fileNames.append(sFileName);
     }
-    else {
-        delete pPresentImage;
-        pPresentImage = pNextImage;
-        pNextImage = pImage;
+    pDecoder->prefetch(fileNames);
+}
+
+
+/*!
+ * \brief SlideWindow::onFrameReady Invoked when a slide has been decoded
+ * \param sFileName The slide
+ */
+void
+SlideWindow::onFrameReady(QString sFileName) {
+    QImage frame = pDecoder->frame(sFileName);
+    if(frame.isNull())// Modified in the meantime
+        return;
+    if(sFileName == sPresentSlide && pPresentImageToShow == Q_NULLPTR) {
+        pPresentImageToShow = new QImage(frame);
+        showPresentFrame();
+    }
+    if(sFileName == sNextSlide && pNextImageToShow == Q_NULLPTR) {
+        pNextImageToShow = new QImage(frame);
+    }
+    precompose();
+}
+
+
+/*!
+ * \brief SlideWindow::showPresentFrame Show the present slide alone
+ *
+ * The present frame is shared, not copied: the shown frame gets a
+ * buffer of its own only while a transition is blended live.
+ */
+void
+SlideWindow::showPresentFrame() {
+    if(pPresentImageToShow == Q_NULLPTR)
+        return;
+    if(pShownImage == Q_NULLPTR)
+        pShownImage = new QImage();
+    *pShownImage = *pPresentImageToShow;
+    update();
+}
+
+
+/*!
+ * \brief SlideWindow::releaseBlendFrame Give back to the pool the buffer of the live blend
+ */
+void
+SlideWindow::releaseBlendFrame() {
+    if(bLiveBlend && pShownImage)
+        framePool.recycle(*pShownImage);
+    bLiveBlend = false;
+}
+
+
+/*!
+ * \brief SlideWindow::advanceSlide The next slide becomes the present one
+ *
+ * The frame of the new next slide is taken from the decoder if it is
+ * already available or it will be when decoded: we never wait for it.
+ */
+void
+SlideWindow::advanceSlide() {
+    transitionProgress = 0.0;
+    if(pPresentImageToShow) delete pPresentImageToShow;
+    pPresentImageToShow = pNextImageToShow;
+    pNextImageToShow = Q_NULLPTR;
+    sPresentSlide = sNextSlide;
+    updateSlideList();
+    if(slideList.count() > 0) {
+        iCurrentSlide++;
+        iCurrentSlide = iCurrentSlide % slideList.count();
+        sNextSlide = slideList.at(iCurrentSlide).absoluteFilePath();
+        if(pDecoder->isReady(sNextSlide))
+            pNextImageToShow = new QImage(pDecoder->frame(sNextSlide));
     }
+    requestFrames();
 }
 
 
@@ -213,20 +321,15 @@ SlideWindow::addNewImage(QImage image) {
 void
 SlideWindow::startSlideShow() {
     if(bRunning) return;
+    SlideDecoder::pruneFrames(sSlideDir);
     updateSlideList();
-    if(slideList.count() > 0) {
-        if(pPresentImage == Q_NULLPTR) {// That's the first image...
-            addNewImage(QImage(slideList.at(0).absoluteFilePath()));
-            iCurrentSlide = 0;
-            if(slideList.count() > 1) {
-                addNewImage(QImage(slideList.at(1).absoluteFilePath()));
-                iCurrentSlide = 1;
-            }
-            else {// Only one image is in the directory
-                addNewImage(*pPresentImage);
-            }
-        }
+    if(slideList.count() > 0 && sPresentSlide.isEmpty()) {// That's the first image...
+        sPresentSlide = slideList.at(0).absoluteFilePath();
+        iCurrentSlide = (slideList.count() > 1) ? 1 : 0;
+        sNextSlide = slideList.at(iCurrentSlide).absoluteFilePath();
     }
+    pDecoder->setTargetSize(size());
+    requestFrames();
     showTimer.start(steadyShowTime);
     bRunning = true;
 }
@@ -238,7 +341,10 @@ SlideWindow::startSlideShow() {
 void
 SlideWindow::stopSlideShow() {
     showTimer.stop();
-    transitionTimer.stop();
+    if(transitionTimer.isActive()) {
+        transitionTimer.stop();
+        emit transitionDone();
+    }
     bRunning = false;
 }
 
@@ -249,7 +355,10 @@ SlideWindow::stopSlideShow() {
 void
 SlideWindow::pauseSlideShow() {
     showTimer.stop();
-    transitionTimer.stop();
+    if(transitionTimer.isActive()) {
+        transitionTimer.stop();
+        emit transitionDone();
+    }
     bRunning = false;
 }
 
@@ -265,26 +374,26 @@ SlideWindow::isRunning() {
 
 
 /*!
- * \brief SlideWindow::computeRegions
- * \param sourcePresent
- * \param destinationPresent
- * \param sourceNext
- * \param destinationNext
+ * \brief SlideWindow::presentSlideName
+ * \return The file name of the slide on show (if any)
  */
-void
-SlideWindow::computeRegions(QRect* sourcePresent, QRect* destinationPresent,
-                            QRect* sourceNext,    QRect* destinationNext)
-{
-    double percent = double(transitionStepNumber)/double(transitionGranularity);
-    *sourcePresent = QRect(0, 0,
-                           int(width()*(1.0-percent)+0.5), height());
-    *destinationPresent = *sourcePresent;
-    destinationPresent->translate(width()*percent, 0);
-
-    *sourceNext = QRect(int(double(width())*(1.0-percent)+0.5), 0,
-                        int(width()*percent+0.5), height());
-    *destinationNext = QRect(0, 0,
-                             int(width()*percent+0.5), height());
+QString
+SlideWindow::presentSlideName() {
+    if(sPresentSlide.isEmpty())
+        return QString();
+    return QFileInfo(sPresentSlide).fileName();
+}
+
+
+/*!
+ * \brief SlideWindow::nextSlideName
+ * \return The file name of the next slide to be shown (if any)
+ */
+QString
+SlideWindow::nextSlideName() {
+    if(iCurrentSlide < 0 || iCurrentSlide >= slideList.count())
+        return QString();
+    return slideList.at(iCurrentSlide).fileName();
 }
 
 
@@ -308,56 +417,41 @@ SlideWindow::keyPressEvent(QKeyEvent *event) {
 /*!
  * \brief SlideWindow::resizeEvent
  * \param event
+ *
+ * The slides are decoded again for the new size: until then the
+ * last frame stays on screen.
  */
 void
 SlideWindow::resizeEvent(QResizeEvent *event) {
     mySize = event->size();
-    if(pPresentImage==Q_NULLPTR || pNextImage==Q_NULLPTR) {
-        event->accept();
-        return;
-    }
-    QImage scaledPresentImage = pPresentImage->scaled(size(), Qt::KeepAspectRatio);
-    QImage scaledNextImage    = pNextImage->scaled(size(), Qt::KeepAspectRatio);
-
-    if(pPresentImageToShow) delete pPresentImageToShow;
-    if(pNextImageToShow)    delete pNextImageToShow;
-    if(pShownImage)         delete pShownImage;
-
-    pPresentImageToShow = new QImage(size(), QImage::Format_ARGB32_Premultiplied);
-    pNextImageToShow    = new QImage(size(), QImage::Format_ARGB32_Premultiplied);
-    pShownImage         = new QImage(size(), QImage::Format_ARGB32_Premultiplied);
-
-    int x = (size().width()-scaledPresentImage.width())/2;
-    int y = (size().height()-scaledPresentImage.height())/2;
-
-    QPainter presentPainter(pPresentImageToShow);
-    presentPainter.setCompositionMode(QPainter::CompositionMode_Source);
-    presentPainter.fillRect(rect(), Qt::white);
-    presentPainter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-    presentPainter.drawImage(x, y, scaledPresentImage);
-    presentPainter.end();
-
-    x = (size().width()-scaledNextImage.width())/2;
-    y = (size().height()-scaledNextImage.height())/2;
-
-    QPainter nextPainter(pNextImageToShow);
-    nextPainter.setCompositionMode(QPainter::CompositionMode_Source);
-    nextPainter.fillRect(rect(), Qt::white);
-    nextPainter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-    nextPainter.drawImage(x, y, scaledNextImage);
-    nextPainter.end();
+    pDecoder->setTargetSize(size());
+    if(pPresentImageToShow && pPresentImageToShow->size() != size())
+        discardFrames();
+    requestFrames();
+    event->accept();
+}
 
-    computeRegions(&rectSourcePresent, &rectDestinationPresent,
-                   &rectSourceNext,    &rectDestinationNext);
 
-    QPainter painter(pShownImage);
-    painter.setCompositionMode(QPainter::CompositionMode_Source);
-    painter.drawImage(rectDestinationNext, *pNextImageToShow, rectSourceNext);
-    painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-    painter.drawImage(rectDestinationPresent, *pPresentImageToShow, rectSourcePresent);
-    painter.end();
-
-    setPixmap(QPixmap::fromImage(*pShownImage));
+/*!
+ * \brief SlideWindow::discardFrames Drop the frames of the present and next slides
+ *
+ * To be called when the decoder will give them in a different size
+ * or format: until then the last frame stays on screen.
+ */
+void
+SlideWindow::discardFrames() {
+    if(transitionTimer.isActive()) {
+        transitionTimer.stop();
+        emit transitionDone();
+        if(bRunning)
+            showTimer.start(steadyShowTime);
+    }
+    transitionProgress = 0.0;
+    pRenderer->cancel();
+    if(pPresentImageToShow) delete pPresentImageToShow;
+    pPresentImageToShow = Q_NULLPTR;
+    if(pNextImageToShow) delete pNextImageToShow;
+    pNextImageToShow = Q_NULLPTR;
 }
 
 
@@ -370,127 +464,157 @@ SlideWindow::onNewSlideTimer() {
     if(slideList.count() == 0) {// Still no slides !
         return;
     }
-    if(pPresentImage == Q_NULLPTR) {// That's the first image...
-        addNewImage(QImage(slideList.at(0).absoluteFilePath()));
-        iCurrentSlide = 0;
-        if(slideList.count() > 1) {
-            addNewImage(QImage(slideList.at(1).absoluteFilePath()));
-            iCurrentSlide = 1;
-        }
-        else {// Only one image is in the directory
-            addNewImage(*pPresentImage);
-        }
+    if(sPresentSlide.isEmpty()) {// That's the first image...
+        sPresentSlide = slideList.at(0).absoluteFilePath();
+        iCurrentSlide = (slideList.count() > 1) ? 1 : 0;
+        sNextSlide = slideList.at(iCurrentSlide).absoluteFilePath();
+        requestFrames();
+        return;
+    }
+    if(!isReady()) {// Still decoding: try again at the next tick
+        requestFrames();
+        return;
     }
     if(transitionType == transition_FromLeft) {
-        showTimer.stop();
-        transitionStepNumber = 0;
-        transitionTimer.start(int(double(transitionTime)/double(transitionGranularity)));
+        startTransition();
     }
     else if(transitionType == transition_Abrupt) {
-        transitionStepNumber = 0;
-        if(pPresentImageToShow) delete pPresentImageToShow;
-        *pPresentImage = *pNextImage;
-        pPresentImageToShow = pNextImageToShow;
-        if(slideList.count() == 0) {
-            return;
-        }
-        iCurrentSlide += 1;
-        iCurrentSlide = iCurrentSlide % slideList.count();
-        addNewImage(QImage(slideList.at(iCurrentSlide).absoluteFilePath()));
-        QImage scaledNextImage = pNextImage->scaled(size(), Qt::KeepAspectRatio);
-        pNextImageToShow = new QImage(size(), QImage::Format_ARGB32_Premultiplied);
-
-        if(pShownImage) delete pShownImage;
-        pShownImage = new QImage(size(), QImage::Format_ARGB32_Premultiplied);
-        int x = (size().width()-scaledNextImage.width())/2;
-        int y = (size().height()-scaledNextImage.height())/2;
-
-        QPainter nextPainter(pNextImageToShow);
-        nextPainter.setCompositionMode(QPainter::CompositionMode_Source);
-        nextPainter.fillRect(rect(), Qt::white);
-        nextPainter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-        nextPainter.drawImage(x, y, scaledNextImage);
-        nextPainter.end();
-
-        computeRegions(&rectSourcePresent, &rectDestinationPresent,
-                       &rectSourceNext,    &rectDestinationNext);
-        QPainter painter(pShownImage);
-        painter.setCompositionMode(QPainter::CompositionMode_Source);
-        painter.drawImage(rectDestinationNext, *pNextImageToShow, rectSourceNext);
-        painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-        painter.drawImage(rectDestinationPresent, *pPresentImageToShow, rectSourcePresent);
-        painter.end();
-
-        setPixmap(QPixmap::fromImage(*pShownImage));
+        advanceSlide();
+        showPresentFrame();
     }
     else if (transitionType == transition_Fade) {
-        showTimer.stop();
-        transitionStepNumber = 0;
-        transitionTimer.start(int(double(transitionTime)/double(transitionGranularity)));
+        startTransition();
     }
     // else if (transitionType == other types...
 }
 
 
+/*!
+ * \brief SlideWindow::startTransition
+ *
+ * The transition is redrawn at the screen refresh rate, but its progress
+ * depends only on the time elapsed since its start: the steps that can't
+ * be drawn in time are simply skipped and the transition always lasts
+ * transitionTime.
+ */
+void
+SlideWindow::startTransition() {
+    showTimer.stop();
+    releaseBlendFrame();// Left by a transition stopped halfway
+    transitionProgress = 0.0;
+    transitionFrames = 0;
+    // A sequence not yet complete would only steal the CPU to the live blend
+    if(!pRenderer->isReady(*pPresentImageToShow, *pNextImageToShow, transitionType))
+        pRenderer->cancel();
+    transitionClock.start();
+    transitionTimer.start(qMax(1, int(1000.0/refreshRate())));
+    emit transitionStarted();
+}
+
+
+/*!
+ * \brief SlideWindow::refreshRate
+ * \return The refresh rate of the screen showing the slides
+ */
+qreal
+SlideWindow::refreshRate() {
+    qreal rate = screen() ? screen()->refreshRate() : qreal(DEFAULT_REFRESH_RATE);
+    if(rate < 1.0)
+        rate = DEFAULT_REFRESH_RATE;
+    return rate;
+}
+
+
+/*!
+ * \brief SlideWindow::frameRate
+ * \return The frames per second drawn during the last transition
+ */
+double
+SlideWindow::frameRate() {
+    return lastFrameRate;
+}
+
+
+/*!
+ * \brief SlideWindow::bufferHighWater
+ * \return The most memory ever used by the frame buffer pool
+ */
+qint64
+SlideWindow::bufferHighWater() {
+    return framePool.highWater();
+}
+
+
 /*!
  * \brief SlideWindow::onTransitionTimeElapsed
  */
 void
 SlideWindow::onTransitionTimeElapsed() {
-    if(pPresentImage == Q_NULLPTR || pNextImage == Q_NULLPTR || pShownImage == Q_NULLPTR)
+    if(pPresentImageToShow == Q_NULLPTR || pNextImageToShow == Q_NULLPTR || pShownImage == Q_NULLPTR)
         return;
-    transitionStepNumber++;
-    if(transitionStepNumber > transitionGranularity) {
+    qint64 elapsed = transitionClock.elapsed();
+    if(elapsed >= transitionTime) {
         transitionTimer.stop();
-        transitionStepNumber = 0;
-        if(pPresentImageToShow) delete pPresentImageToShow;
-        *pPresentImage = *pNextImage;
-        pPresentImageToShow = pNextImageToShow;
-        updateSlideList();
-        if(slideList.count() == 0) {
+        lastFrameRate = elapsed > 0 ? 1000.0*transitionFrames/elapsed : 0.0;
+        releaseBlendFrame();
+        advanceSlide();
+        showPresentFrame();
+        emit transitionDone();
+        showTimer.start(steadyShowTime);
+        precompose();
+        return;
+    }
+    transitionProgress = double(elapsed)/double(transitionTime);
+    transitionFrames++;
+    if(!bLiveBlend && !pRenderer->isReady(*pPresentImageToShow, *pNextImageToShow, transitionType)) {
+        // Blend live into a buffer of the pool
+        QImage blendFrame = framePool.acquire(pPresentImageToShow->size(), pPresentImageToShow->format());
+        if(blendFrame.isNull())
             return;
-        }
-        iCurrentSlide++;
-        iCurrentSlide = iCurrentSlide % slideList.count();
-        addNewImage(QImage(slideList.at(iCurrentSlide).absoluteFilePath()));
-
-        QImage scaledNextImage = pNextImage->scaled(size(), Qt::KeepAspectRatio);
-        pNextImageToShow = new QImage(size(), QImage::Format_ARGB32_Premultiplied);
-
-        if(pShownImage) delete pShownImage;
-        pShownImage = new QImage(size(), QImage::Format_ARGB32_Premultiplied);
-        int x = (size().width()-scaledNextImage.width())/2;
-        int y = (size().height()-scaledNextImage.height())/2;
+        *pShownImage = blendFrame;
+        bLiveBlend = true;
+    }
+    if(!bLiveBlend) {
+        // Precomposed: just show the right frame of the sequence
+        QImage frame = pRenderer->frame(transitionProgress);
+        if(frame.isNull() || frame.cacheKey() == pShownImage->cacheKey())
+            return;// Nothing new to show
+        *pShownImage = frame;
+    }
+    else {
+        TransitionRenderer::compose(transitionType, *pPresentImageToShow, *pNextImageToShow,
+                                    transitionProgress, pShownImage);
+    }
+    // Both transitions move every pixel of the frame
+    update();
+}
 
-        QPainter nextPainter(pNextImageToShow);
-        nextPainter.setCompositionMode(QPainter::CompositionMode_Source);
-        nextPainter.fillRect(rect(), Qt::white);
-        nextPainter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-        nextPainter.drawImage(x, y, scaledNextImage);
-        nextPainter.end();
 
-        showTimer.start(steadyShowTime);
+/*!
+ * \brief SlideWindow::paintEvent Show the frame straight from its buffer
+ * \param event
+ *
+ * Only the region to repaint is copied on the screen. Before the first
+ * slide (or while the slides are decoded for a new size) the window
+ * shows the waiting message (or the last frame centered).
+ */
+void
+SlideWindow::paintEvent(QPaintEvent *event) {
+    QPainter painter(this);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    if(pShownImage && pShownImage->size() == size()) {
+        painter.drawImage(event->rect(), *pShownImage, event->rect());
+        return;
     }
-    if(transitionType == transition_FromLeft) {
-        computeRegions(&rectSourcePresent, &rectDestinationPresent,
-                       &rectSourceNext,    &rectDestinationNext);
-        QPainter painter(pShownImage);
-        painter.setCompositionMode(QPainter::CompositionMode_Source);
-        painter.drawImage(rectDestinationNext, *pNextImageToShow, rectSourceNext);
-        painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-        painter.drawImage(rectDestinationPresent, *pPresentImageToShow, rectSourcePresent);
-        painter.end();
+    painter.fillRect(event->rect(), palette().brush(QPalette::Window));
+    painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+    if(pShownImage) {
+        int x = (width()-pShownImage->width())/2;
+        int y = (height()-pShownImage->height())/2;
+        painter.drawImage(x, y, *pShownImage);
     }
-    else if (transitionType == transition_Fade) {
-        QPainter painter(pShownImage);
-        qreal opacity = qreal(transitionStepNumber)/qreal(transitionGranularity);
-        painter.setOpacity(opacity);
-        painter.setCompositionMode(QPainter::CompositionMode_Source);
-        painter.drawImage(0, 0, *pNextImageToShow);
-        painter.setOpacity(1.0-opacity);
-        painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-        painter.drawImage(0, 0, *pPresentImageToShow);
-        painter.end();
+    else {
+        painter.setPen(palette().color(QPalette::WindowText));
+        painter.drawText(rect(), Qt::AlignCenter, sWaitingText);
     }
-    setPixmap(QPixmap::fromImage(*pShownImage));
 }
@@ -20,13 +20,20 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define SLIDEWINDOW_H
 
 #include <QTimer>
-#include <QLabel>
+#include <QElapsedTimer>
+#include <QWidget>
+#include <QImage>
+#include <QBrush>
 #include <QFileInfoList>
 
 #include <qevent.h>
 
+#include "framepool.h"
 
-class SlideWindow : public QLabel
+QT_FORWARD_DECLARE_CLASS(SlideDecoder)
+QT_FORWARD_DECLARE_CLASS(TransitionRenderer)
+
+class SlideWindow : public QWidget
 {
     Q_OBJECT
 
@@ -34,13 +41,24 @@ public:
     SlideWindow(QWidget *parent = Q_NULLPTR);
     ~SlideWindow();
     void setSlideDir(QString sNewDir);
+    void setCacheBudget(qint64 bytes);
+    void setPrecomposeBudget(qint64 bytes);
+    void setLowMemoryMode(bool bEnable);
+    void prepareSlide(QString sFileName);
     void keyPressEvent(QKeyEvent *event);
-    void addNewImage(QImage image);
     void startSlideShow();
     void stopSlideShow();
     void pauseSlideShow();
     bool isReady();
     bool isRunning();
+    QString nextSlideName();
+    QString presentSlideName();
+    double frameRate();
+    qint64 bufferHighWater();
+
+signals:
+    void transitionStarted();/*!< \brief emitted when a slide transition begins */
+    void transitionDone();   /*!< \brief emitted when a slide transition is over */
 
 public:
     /*!
@@ -53,19 +71,36 @@ public:
     };
 
 private:
-    void computeRegions(QRect* sourcePresent, QRect* destinationPresent, QRect* sourceNext, QRect* destinationNext);
     void updateSlideList();
+    void requestFrames();
+    void showPresentFrame();
+    void advanceSlide();
+    void startTransition();
+    void precompose();
+    void releaseBlendFrame();
+    void discardFrames();
+    qreal refreshRate();
 
 public slots:
     void onNewSlideTimer();
     void onTransitionTimeElapsed();
     void resizeEvent(QResizeEvent *event);
 
+protected:
+    void paintEvent(QPaintEvent *event);
+
+private slots:
+    void onFrameReady(QString sFileName);
+
 private:
     QString sSlideDir;
+    QString sWaitingText;
     QFileInfoList slideList;
-    QImage* pPresentImage;
-    QImage* pNextImage;
+    SlideDecoder* pDecoder;
+    TransitionRenderer* pRenderer;
+    FramePool framePool;
+    QString sPresentSlide;
+    QString sNextSlide;
     QImage* pPresentImageToShow;
     QImage* pNextImageToShow;
     QImage* pShownImage;
@@ -76,13 +111,12 @@ private:
     int iCurrentSlide;
     int steadyShowTime;
     int transitionTime;
-    int transitionGranularity;
-    int transitionStepNumber;
+    double transitionProgress;
+    QElapsedTimer transitionClock;
+    int transitionFrames;
+    double lastFrameRate;
+    bool bLiveBlend;
     QSize mySize;
-    QRect rectSourcePresent;
-    QRect rectSourceNext;
-    QRect rectDestinationPresent;
-    QRect rectDestinationNext;
 
     transitionMode transitionType;
     bool bRunning;
@@ -0,0 +1,246 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#include <QtTest>
+#include <QImage>
+
+#include "blendkernels.h"
+#include "transitionrenderer.h"
+#include "slidewindow.h"
+
+
+#define FRAME_WIDTH          67 // Not a multiple of the vector widths: the tails are tested too
+#define FRAME_HEIGHT         9
+#define MAX_CHANNEL_ERROR    3  // QPainter rounds the opacity (and the products) in its own way
+#define MAX_CHANNEL_ERROR_16 2  // In 5/6 bit units: QPainter blends RGB16 with a coarser opacity
+
+
+/*!
+ * \brief The tst_BlendKernels class
+ * Every row kernel must give exactly the result of the scalar one and,
+ * within MAX_CHANNEL_ERROR (MAX_CHANNEL_ERROR_16 for RGB16), the result
+ * of the QPainter composition
+ * used when the kernels can't handle the frames.
+ * The wipe only copies pixels: it must match QPainter exactly.
+ */
+class tst_BlendKernels : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void cleanup();
+    void fade_data();
+    void fade();
+    void wipe_data();
+    void wipe();
+
+private:
+    static void   addFormats();
+    static QImage testFrame(QImage::Format format, quint32 seed);
+    static int    maxChannelError(const QImage &first, const QImage &second);
+};
+
+
+static const double progressList[] = {0.0, 0.004, 0.1, 0.25, 0.5, 0.73, 0.99, 1.0};
+
+static const struct {
+    const char    *sName;
+    QImage::Format format;
+} formatList[] = {
+    {"ARGB32_Premultiplied", QImage::Format_ARGB32_Premultiplied},
+    {"RGB16",                QImage::Format_RGB16}// The low memory mode
+};
+
+static const struct {
+    const char *sName;
+    int         kernel;
+} kernelList[] = {
+    {"scalar", kernel_Scalar},
+    {"sse2",   kernel_Sse2},
+    {"avx2",   kernel_Avx2},
+    {"neon",   kernel_Neon}// RGB16 frames: the scalar kernel
+};
+
+
+/*!
+ * \brief tst_BlendKernels::cleanup Back to the kernel chosen for this CPU
+ */
+void
+tst_BlendKernels::cleanup() {
+    setBlendKernel(kernel_Auto);
+}
+
+
+/*!
+ * \brief tst_BlendKernels::addFormats The frame formats used by the slide show
+ */
+void
+tst_BlendKernels::addFormats() {
+    QTest::addColumn<int>("format");
+    for(size_t i=0; i<sizeof(formatList)/sizeof(formatList[0]); i++)
+        QTest::newRow(formatList[i].sName) << int(formatList[i].format);
+}
+
+
+/*!
+ * \brief tst_BlendKernels::fade_data
+ */
+void
+tst_BlendKernels::fade_data() {
+    QTest::addColumn<int>("kernel");
+    QTest::addColumn<int>("format");
+    for(size_t i=0; i<sizeof(kernelList)/sizeof(kernelList[0]); i++) {
+        for(size_t j=0; j<sizeof(formatList)/sizeof(formatList[0]); j++) {
+            QTest::newRow(QString("%1 %2")
+                          .arg(kernelList[i].sName)
+                          .arg(formatList[j].sName)
+                          .toLatin1().constData())
+                    << kernelList[i].kernel << int(formatList[j].format);
+        }
+    }
+}
+
+
+/*!
+ * \brief tst_BlendKernels::fade
+ */
+void
+tst_BlendKernels::fade() {
+    QFETCH(int, kernel);
+    QFETCH(int, format);
+    if(!setBlendKernel(kernel))
+        QSKIP("Kernel not available on this CPU");
+    QImage present = testFrame(QImage::Format(format), 1);
+    QImage next    = testFrame(QImage::Format(format), 2);
+    for(size_t i=0; i<sizeof(progressList)/sizeof(progressList[0]); i++) {
+        double progress = progressList[i];
+        QImage reference(present.size(), present.format());
+        QVERIFY(setBlendKernel(kernel_Scalar));
+        TransitionRenderer::compose(SlideWindow::transition_Fade, present, next, progress, &reference);
+
+        QImage blended(present.size(), present.format());
+        QVERIFY(setBlendKernel(kernel));
+        TransitionRenderer::compose(SlideWindow::transition_Fade, present, next, progress, &blended);
+
+        QImage painted(present.size(), present.format());
+        painted.fill(Qt::red);// Must not show through
+        TransitionRenderer::composeWithPainter(SlideWindow::transition_Fade, present, next, progress, &painted);
+
+        QVERIFY2(blended == reference,
+                 qPrintable(QString("Not the result of the scalar kernel at %1").arg(progress)));
+        int error = maxChannelError(blended, painted);
+        int maxError = (present.format() == QImage::Format_RGB16) ? MAX_CHANNEL_ERROR_16 : MAX_CHANNEL_ERROR;
+        QVERIFY2(error <= maxError,
+                 qPrintable(QString("Error %1 with respect to QPainter at %2").arg(error).arg(progress)));
+    }
+}
+
+
+/*!
+ * \brief tst_BlendKernels::wipe_data
+ */
+void
+tst_BlendKernels::wipe_data() {
+    addFormats();
+}
+
+
+/*!
+ * \brief tst_BlendKernels::wipe
+ * The same progress must give the same split (no seam) in both the paths
+ */
+void
+tst_BlendKernels::wipe() {
+    QFETCH(int, format);
+    QImage present = testFrame(QImage::Format(format), 3);
+    QImage next    = testFrame(QImage::Format(format), 4);
+    for(size_t i=0; i<sizeof(progressList)/sizeof(progressList[0]); i++) {
+        double progress = progressList[i];
+        QImage copied(present.size(), present.format());
+        TransitionRenderer::compose(SlideWindow::transition_FromLeft, present, next, progress, &copied);
+
+        QImage painted(present.size(), present.format());
+        painted.fill(Qt::red);// Must not show through
+        TransitionRenderer::composeWithPainter(SlideWindow::transition_FromLeft, present, next, progress, &painted);
+
+        QVERIFY2(copied == painted,
+                 qPrintable(QString("Different from QPainter at %1").arg(progress)));
+    }
+}
+
+
+/*!
+ * \brief tst_BlendKernels::testFrame
+ * \return An opaque frame of pseudo random pixels (always the same for a seed)
+ */
+QImage
+tst_BlendKernels::testFrame(QImage::Format format, quint32 seed) {
+    QImage frame(FRAME_WIDTH, FRAME_HEIGHT, format);
+    quint32 state = 2463534242U + seed;
+    for(int y=0; y<frame.height(); y++) {
+        for(int x=0; x<frame.width(); x++) {
+            state ^= state << 13;// xorshift32
+            state ^= state >> 17;
+            state ^= state << 5;
+            if(format == QImage::Format_RGB16)
+                reinterpret_cast<quint16 *>(frame.scanLine(y))[x] = quint16(state);
+            else
+                reinterpret_cast<quint32 *>(frame.scanLine(y))[x] = state | 0xff000000;// Opaque
+        }
+    }
+    return frame;
+}
+
+
+/*!
+ * \brief tst_BlendKernels::maxChannelError
+ * \return The largest difference of a channel between two frames
+ * (for RGB16 frames in units of the 5 or 6 bit channels)
+ */
+int
+tst_BlendKernels::maxChannelError(const QImage &first, const QImage &second) {
+    int maxError = 0;
+    if(first.format() == QImage::Format_RGB16) {
+        for(int y=0; y<first.height(); y++) {
+            const quint16 *pFirst  = reinterpret_cast<const quint16 *>(first.constScanLine(y));
+            const quint16 *pSecond = reinterpret_cast<const quint16 *>(second.constScanLine(y));
+            for(int x=0; x<first.width(); x++) {
+                maxError = qMax(maxError, qAbs((pFirst[x] >> 11) - (pSecond[x] >> 11)));
+                maxError = qMax(maxError, qAbs(((pFirst[x] >> 5) & 0x3f) - ((pSecond[x] >> 5) & 0x3f)));
+                maxError = qMax(maxError, qAbs((pFirst[x] & 0x1f) - (pSecond[x] & 0x1f)));
+            }
+        }
+        return maxError;
+    }
+    for(int y=0; y<first.height(); y++) {
+        const quint32 *pFirst  = reinterpret_cast<const quint32 *>(first.constScanLine(y));
+        const quint32 *pSecond = reinterpret_cast<const quint32 *>(second.constScanLine(y));
+        for(int x=0; x<first.width(); x++) {
+            for(int shift=0; shift<32; shift+=8) {
+                int error = qAbs(int((pFirst[x] >> shift) & 0xff) - int((pSecond[x] >> shift) & 0xff));
+                maxError = qMax(maxError, error);
+            }
+        }
+    }
+    return maxError;
+}
+
+
+QTEST_MAIN(tst_BlendKernels)
+
+#include "tst_blendkernels.moc"
@@ -0,0 +1,36 @@
+# Compares the slide transition kernels (scalar, SSE2, AVX2, NEON),
+# on ARGB32 and RGB16 frames, with the QPainter composition they replace:
+#     qmake tests/tst_blendkernels && make check
+# (on a headless machine: QT_QPA_PLATFORM=offscreen make check)
+# The kernels not available on the CPU running the test are skipped.
+
+QT += core
+QT += gui
+QT += widgets
+QT += testlib
+
+CONFIG += c++11
+CONFIG += testcase
+CONFIG += console
+CONFIG -= app_bundle
+
+DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
+
+# As in VolleyPanel.pro: let the NEON kernels be built on the Raspberry Pi
+equals(QT_ARCH, "arm"): QMAKE_CXXFLAGS += -march=armv8-a -mfpu=neon-fp-armv8
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+    ../../blendkernels.cpp \
+    ../../framepool.cpp \
+    ../../slidedecoder.cpp \
+    ../../transitionrenderer.cpp \
+    tst_blendkernels.cpp
+
+
+HEADERS += \
+    ../../blendkernels.h \
+    ../../framepool.h \
+    ../../slidedecoder.h \
+    ../../transitionrenderer.h
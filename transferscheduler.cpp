@@ -0,0 +1,253 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#include <QMutexLocker>
+
+#include "transferscheduler.h"
+
+
+#define PAUSE_POLL_TIME  250 // In msec: recheck interval while paused or yielding
+#define MIN_CHUNK_SIZE   16*1024
+
+
+/*!
+ * \brief TransferScheduler::TransferScheduler Arbitrates the background file transfers
+ * \param parent The parent object.
+ *
+ * The File Updaters (each one running in its own Thread) ask the scheduler
+ * how long to wait before requesting the next chunk of a file.
+ * The scheduler:
+ * - orders the files by when they will be needed (the next slide first),
+ *   then by size (small files before large ones);
+ * - lets only the most urgent transfer go on when more of them compete;
+ * - enforces a (configurable) bandwidth cap with a token bucket;
+ * - pauses the transfers while a slide transition is running and
+ *   reduces the bandwidth while a video is playing, so that neither the
+ *   score channel nor the animations suffer from a background download.
+ *
+ * All the public methods are thread safe.
+ */
+TransferScheduler::TransferScheduler(QObject *parent)
+    : QObject(parent)
+    , bandwidthLimit(0)
+    , busyBandwidthLimit(0)
+    , tokens(0)
+    , lastRefill(0)
+    , bVideoPlaying(false)
+    , bTransitionRunning(false)
+{
+    clock.start();
+}
+
+
+/*!
+ * \brief TransferScheduler::setBandwidthLimit
+ * \param bytesPerSecond The maximum download rate (0 means unlimited)
+ * \param busyBytesPerSecond The maximum rate while a video is playing (0 means as above)
+ */
+void
+TransferScheduler::setBandwidthLimit(qint64 bytesPerSecond, qint64 busyBytesPerSecond) {
+    QMutexLocker locker(&mutex);
+    bandwidthLimit     = qMax(qint64(0), bytesPerSecond);
+    busyBandwidthLimit = qMax(qint64(0), busyBytesPerSecond);
+    tokens = 0;
+}
+
+
+/*!
+ * \brief TransferScheduler::setVideoPlaying To be called when a Spot starts or stops
+ */
+void
+TransferScheduler::setVideoPlaying(bool bPlaying) {
+    QMutexLocker locker(&mutex);
+    bVideoPlaying = bPlaying;
+}
+
+
+/*!
+ * \brief TransferScheduler::setTransitionRunning To be called when a slide transition starts or ends
+ */
+void
+TransferScheduler::setTransitionRunning(bool bRunning) {
+    QMutexLocker locker(&mutex);
+    bTransitionRunning = bRunning;
+}
+
+
+/*!
+ * \brief TransferScheduler::setManifest The files of a category, as listed by the Server
+ * \param sCategory The category (i.e. the File Updater name)
+ * \param fileNames The file names
+ *
+ * Spots and Slides are shown in alphabetical order: so is the manifest.
+ */
+void
+TransferScheduler::setManifest(QString sCategory, QStringList fileNames) {
+    fileNames.sort();
+    QMutexLocker locker(&mutex);
+    manifestMap.insert(sCategory, fileNames);
+}
+
+
+/*!
+ * \brief TransferScheduler::setPlayPosition The file of a category that will be shown next
+ */
+void
+TransferScheduler::setPlayPosition(QString sCategory, QString sFileName) {
+    QMutexLocker locker(&mutex);
+    positionMap.insert(sCategory, sFileName);
+}
+
+
+/*!
+ * \brief TransferScheduler::priorityKey
+ * \param sCategory The file category
+ * \param sFileName The file name
+ * \param fileSize The file size
+ * \return a key: the lower the key, the sooner the file is needed
+ *
+ * The first LOOKAHEAD files to be shown are strictly ordered;
+ * all the other files are ordered by size.
+ */
+quint64
+TransferScheduler::priorityKey(QString sCategory, QString sFileName, qint64 fileSize) {
+    QMutexLocker locker(&mutex);
+    QStringList manifest = manifestMap.value(sCategory);
+    QString sPosition = positionMap.value(sCategory);
+    int rank = LOOKAHEAD;
+    int iFile = manifest.indexOf(sFileName);
+    if(iFile >= 0) {
+        int iStart = 0;// The first file not yet shown
+        while(iStart < manifest.count() && manifest.at(iStart) < sPosition)
+            iStart++;
+        rank = (iFile - iStart + manifest.count()) % manifest.count();
+        rank = qMin(rank, LOOKAHEAD);
+    }
+    quint64 size = quint64(qBound(qint64(0), fileSize, (qint64(1) << 48) - 1));
+    return (quint64(rank) << 48) | size;
+}
+
+
+/*!
+ * \brief TransferScheduler::setPendingKey Signal that a category has a file to transfer
+ * \param sCategory The file category
+ * \param key The priority key of the file being transferred
+ */
+void
+TransferScheduler::setPendingKey(QString sCategory, quint64 key) {
+    QMutexLocker locker(&mutex);
+    pendingMap.insert(sCategory, key);
+}
+
+
+/*!
+ * \brief TransferScheduler::clearPending Signal that a category has nothing left to transfer
+ */
+void
+TransferScheduler::clearPending(QString sCategory) {
+    QMutexLocker locker(&mutex);
+    pendingMap.remove(sCategory);
+}
+
+
+/*!
+ * \brief TransferScheduler::delayBeforeRequest
+ * \param sCategory The category asking to request a new chunk
+ * \return The time (in ms) to wait before asking for it (0 = go on)
+ */
+int
+TransferScheduler::delayBeforeRequest(QString sCategory) {
+    QMutexLocker locker(&mutex);
+    if(bTransitionRunning)
+        return PAUSE_POLL_TIME;
+    // A more urgent transfer is running ?
+    quint64 myKey = pendingMap.value(sCategory, 0);
+    QMapIterator<QString, quint64> i(pendingMap);
+    while(i.hasNext()) {
+        i.next();
+        if(i.key() != sCategory && i.value() < myKey)
+            return PAUSE_POLL_TIME;
+    }
+    qint64 limit = currentLimit();
+    if(limit == 0)
+        return 0;
+    refill();
+    if(tokens >= 0)
+        return 0;
+    return int(qMin(qint64(-tokens)*1000/limit+1, qint64(10*PAUSE_POLL_TIME)));
+}
+
+
+/*!
+ * \brief TransferScheduler::consume Account for the bytes just received
+ */
+void
+TransferScheduler::consume(qint64 bytes) {
+    QMutexLocker locker(&mutex);
+    refill();
+    tokens -= bytes;
+}
+
+
+/*!
+ * \brief TransferScheduler::chunkSize
+ * \param maxChunkSize The chunk size requested when unlimited
+ * \return The chunk size to request
+ *
+ * With a bandwidth cap the chunks are reduced to about 1/10 s of
+ * transfer, to avoid long bursts at full link speed.
+ */
+int
+TransferScheduler::chunkSize(int maxChunkSize) {
+    QMutexLocker locker(&mutex);
+    qint64 limit = currentLimit();
+    if(limit == 0)
+        return maxChunkSize;
+    return int(qBound(qint64(MIN_CHUNK_SIZE), limit/10, qint64(maxChunkSize)));
+}
+
+
+/*!
+ * \brief TransferScheduler::currentLimit (mutex must be held)
+ * \return The bandwidth limit in force (0 = unlimited)
+ */
+qint64
+TransferScheduler::currentLimit() {
+    if(bVideoPlaying && busyBandwidthLimit > 0) {
+        if(bandwidthLimit > 0)
+            return qMin(bandwidthLimit, busyBandwidthLimit);
+        return busyBandwidthLimit;
+    }
+    return bandwidthLimit;
+}
+
+
+/*!
+ * \brief TransferScheduler::refill Token bucket refill (mutex must be held)
+ */
+void
+TransferScheduler::refill() {
+    qint64 now = clock.elapsed();
+    qint64 limit = currentLimit();
+    if(limit > 0) {
+        tokens += (now-lastRefill)*limit/1000;
+        // Allow, at most, a burst of 1/4 s
+        tokens = qMin(tokens, limit/4);
+    }
+    lastRefill = now;
+}
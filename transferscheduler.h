@@ -0,0 +1,68 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#ifndef TRANSFERSCHEDULER_H
+#define TRANSFERSCHEDULER_H
+
+#include <QObject>
+#include <QMutex>
+#include <QMap>
+#include <QStringList>
+#include <QElapsedTimer>
+
+
+class TransferScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TransferScheduler(QObject *parent = Q_NULLPTR);
+
+    void    setBandwidthLimit(qint64 bytesPerSecond, qint64 busyBytesPerSecond);
+    void    setVideoPlaying(bool bPlaying);
+    void    setTransitionRunning(bool bRunning);
+    void    setManifest(QString sCategory, QStringList fileNames);
+    void    setPlayPosition(QString sCategory, QString sFileName);
+
+    quint64 priorityKey(QString sCategory, QString sFileName, qint64 fileSize);
+    void    setPendingKey(QString sCategory, quint64 key);
+    void    clearPending(QString sCategory);
+    int     delayBeforeRequest(QString sCategory);
+    void    consume(qint64 bytes);
+    int     chunkSize(int maxChunkSize);
+
+    static const int LOOKAHEAD = 2;/*!< \brief Files transferred strictly in the order they are needed */
+
+private:
+    qint64  currentLimit();
+    void    refill();
+
+private:
+    QMutex                  mutex;
+    QElapsedTimer           clock;
+    qint64                  bandwidthLimit;
+    qint64                  busyBandwidthLimit;
+    qint64                  tokens;
+    qint64                  lastRefill;
+    bool                    bVideoPlaying;
+    bool                    bTransitionRunning;
+    QMap<QString, QStringList> manifestMap;
+    QMap<QString, QString>  positionMap;
+    QMap<QString, quint64>  pendingMap;
+};
+
+#endif // TRANSFERSCHEDULER_H
@@ -0,0 +1,348 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#include <QPainter>
+#include <QRunnable>
+#include <QThread>
+
+#include "transitionrenderer.h"
+#include "framepool.h"
+#include "slidewindow.h"
+#include "slidedecoder.h"
+#include "blendkernels.h"
+
+
+#define SEQUENCE_RAM_FRACTION 2  // The sequence may use 1/2 of the available memory
+#define MIN_SEQUENCE_FRAMES   10 // Fewer frames would look worse than a live blend
+
+
+/*!
+ * \brief The SequenceRenderTask class Renders a transition sequence on a pool Thread
+ */
+class SequenceRenderTask : public QRunnable
+{
+public:
+    SequenceRenderTask(TransitionRenderer *pMyRenderer, QImage myPresent, QImage myNext,
+                       int myType, QImage *pMyFrames, int myFrames,
+                       QAtomicInt *pMyAbort, int myGeneration)
+        : pRenderer(pMyRenderer)
+        , present(myPresent)
+        , next(myNext)
+        , transitionType(myType)
+        , pFrames(pMyFrames)
+        , nFrames(myFrames)
+        , pAbort(pMyAbort)
+        , generation(myGeneration)
+    {
+    }
+
+    void run() {
+        // The score and the live transitions come first
+        QThread::currentThread()->setPriority(QThread::LowPriority);
+        for(int i=0; i<nFrames; i++) {
+            if(pAbort->loadAcquire())
+                return;
+            TransitionRenderer::compose(transitionType, present, next,
+                                        double(i+1)/double(nFrames+1), &pFrames[i]);
+        }
+        QMetaObject::invokeMethod(pRenderer, "onSequenceDone", Qt::QueuedConnection,
+                                  Q_ARG(int, generation));
+    }
+
+private:
+    TransitionRenderer *pRenderer;
+    QImage              present;
+    QImage              next;
+    int                 transitionType;
+    QImage             *pFrames;
+    int                 nFrames;
+    QAtomicInt         *pAbort;
+    int                 generation;
+};
+
+
+/*!
+ * \brief TransitionRenderer::TransitionRenderer Renders the slide transitions ahead of time
+ * \param pMyFramePool Where the frame buffers come from
+ * \param parent The parent object.
+ *
+ * A transition depends only on the present and the next slides, that
+ * are known long before it starts: while the present slide is on show,
+ * a low priority worker Thread renders the whole sequence of transition
+ * frames into buffers taken from the Slide Window FramePool (and kept
+ * from one transition to the next). The GUI Thread then only has to show the ready frames.
+ * The memory of the pool is bounded by a budget (0 disables the mode)
+ * and by the memory available: when it is too scarce the pool is
+ * released and the transitions are blended live again.
+ */
+TransitionRenderer::TransitionRenderer(FramePool *pMyFramePool, QObject *parent)
+    : QObject(parent)
+    , pFramePool(pMyFramePool)
+    , budget(0)
+    , generation(0)
+    , nSequenceFrames(0)
+    , presentKey(0)
+    , nextKey(0)
+    , sequenceType(-1)
+    , bRendering(false)
+    , bReady(false)
+{
+    pool.setMaxThreadCount(1);
+}
+
+
+/*!
+ * \brief TransitionRenderer::~TransitionRenderer Stop the running sequence
+ */
+TransitionRenderer::~TransitionRenderer() {
+    cancel();
+}
+
+
+/*!
+ * \brief TransitionRenderer::setBudget
+ * \param bytes The memory for the precomposed frames (0 = disabled)
+ */
+void
+TransitionRenderer::setBudget(qint64 bytes) {
+    budget = qMax(qint64(0), bytes);
+    if(budget == 0)
+        release();
+}
+
+
+/*!
+ * \brief TransitionRenderer::isEnabled
+ * \return true if the transitions may be precomposed
+ */
+bool
+TransitionRenderer::isEnabled() {
+    return budget > 0;
+}
+
+
+/*!
+ * \brief TransitionRenderer::render Start rendering a transition sequence
+ * \param present The slide on show
+ * \param next The slide that will follow
+ * \param transitionType One of SlideWindow::transitionMode
+ * \param nFrames The frames wanted (as many as the screen can show)
+ *
+ * Nothing happens if that very sequence is already ready or in progress.
+ * The frames actually rendered may be fewer, to stay within the budget.
+ */
+void
+TransitionRenderer::render(const QImage &present, const QImage &next, int transitionType, int nFrames) {
+    if(budget == 0 || present.isNull() || next.isNull() || present.size() != next.size()) {
+        release();
+        return;
+    }
+    if((bReady || bRendering) &&
+       (present.cacheKey() == presentKey) &&
+       (next.cacheKey() == nextKey) &&
+       (transitionType == sequenceType))
+        return;
+    cancel();
+
+    qint64 frameBytes = qMax(qint64(1), qint64(present.sizeInBytes()));
+    qint64 poolBytes = 0;
+    for(int i=0; i<frameSequence.count(); i++)
+        poolBytes += frameSequence.at(i).sizeInBytes();
+    qint64 maxFrames = budget/frameBytes;
+    qint64 available = SlideDecoder::availableMemory();
+    if(available >= 0)
+        maxFrames = qMin(maxFrames, (available+poolBytes)/SEQUENCE_RAM_FRACTION/frameBytes);
+    nFrames = int(qMin(qint64(nFrames), maxFrames));
+    if(nFrames < MIN_SEQUENCE_FRAMES) {// Not enough memory: blend live
+        release();
+        return;
+    }
+
+    if(!frameSequence.isEmpty() &&
+       (frameSequence.first().size() != present.size() ||
+        frameSequence.first().format() != present.format()))
+        frameSequence.clear();// Of another resolution: the pool drops them
+    while(frameSequence.count() > nFrames)
+        pFramePool->recycle(frameSequence.takeLast());
+    while(frameSequence.count() < nFrames) {
+        QImage frame = pFramePool->acquire(present.size(), present.format());
+        if(frame.isNull()) {// Allocation failed
+            release();
+            return;
+        }
+        frameSequence.append(frame);
+    }
+    nSequenceFrames = nFrames;
+    presentKey      = present.cacheKey();
+    nextKey         = next.cacheKey();
+    sequenceType    = transitionType;
+    bRendering      = true;
+    pool.start(new SequenceRenderTask(this, present, next, transitionType,
+                                      frameSequence.data(), nFrames,
+                                      &abortRequest, generation));
+}
+
+
+/*!
+ * \brief TransitionRenderer::cancel Stop the running sequence (if any)
+ *
+ * The worker checks for the request before every frame, so we wait
+ * at most for one frame to complete.
+ */
+void
+TransitionRenderer::cancel() {
+    abortRequest.storeRelease(1);
+    pool.waitForDone();
+    abortRequest.storeRelease(0);
+    generation++;
+    bRendering = false;
+    bReady = false;
+}
+
+
+/*!
+ * \brief TransitionRenderer::release Free the frame buffers
+ */
+void
+TransitionRenderer::release() {
+    cancel();
+    for(int i=0; i<frameSequence.count(); i++)
+        pFramePool->recycle(frameSequence.at(i));
+    frameSequence.clear();
+    frameSequence.squeeze();
+    pFramePool->trim();
+    nSequenceFrames = 0;
+}
+
+
+/*!
+ * \brief TransitionRenderer::isReady
+ * \return true if the whole sequence for these slides has been rendered
+ */
+bool
+TransitionRenderer::isReady(const QImage &present, const QImage &next, int transitionType) {
+    return bReady &&
+           (present.cacheKey() == presentKey) &&
+           (next.cacheKey() == nextKey) &&
+           (transitionType == sequenceType);
+}
+
+
+/*!
+ * \brief TransitionRenderer::frame
+ * \param progress The transition progress (0..1)
+ * \return The precomposed frame to show or a null image if the
+ * present slide has still to be shown as it is
+ */
+QImage
+TransitionRenderer::frame(double progress) {
+    if(!bReady)
+        return QImage();
+    int iFrame = int(progress*(nSequenceFrames+1)) - 1;
+    if(iFrame < 0)
+        return QImage();
+    return frameSequence.at(qMin(iFrame, nSequenceFrames-1));
+}
+
+
+/*!
+ * \brief TransitionRenderer::onSequenceDone Invoked (on our Thread) when a sequence is complete
+ */
+void
+TransitionRenderer::onSequenceDone(int iGeneration) {
+    if(iGeneration != generation)
+        return;// Cancelled in the meantime
+    bRendering = false;
+    bReady = true;
+}
+
+
+/*!
+ * \brief TransitionRenderer::compose Draw a frame of a transition
+ * \param transitionType One of SlideWindow::transitionMode
+ * \param present The slide leaving
+ * \param next The slide entering
+ * \param progress The transition progress (0..1)
+ * \param pDestination The frame to write (as large as the slides)
+ *
+ * The blend kernels write straight into the destination:
+ * QPainter is used only when they can't handle the frames.
+ */
+void
+TransitionRenderer::compose(int transitionType, const QImage &present, const QImage &next,
+                            double progress, QImage *pDestination)
+{
+    bool bDone = false;
+    if(transitionType == SlideWindow::transition_FromLeft)
+        bDone = wipeFromLeft(present, next, splitPosition(pDestination->width(), progress), pDestination);
+    else if(transitionType == SlideWindow::transition_Fade)
+        bDone = crossFade(present, next, int(256.0*progress), pDestination);
+    if(!bDone)
+        composeWithPainter(transitionType, present, next, progress, pDestination);
+}
+
+
+/*!
+ * \brief TransitionRenderer::composeWithPainter Draw a frame of a transition with QPainter
+ * (for the frames the blend kernels can't handle)
+ *
+ * The same arguments of compose(): the result must match the one
+ * of the kernels (the tests compare them).
+ */
+void
+TransitionRenderer::composeWithPainter(int transitionType, const QImage &present, const QImage &next,
+                                       double progress, QImage *pDestination)
+{
+    int width  = pDestination->width();
+    int height = pDestination->height();
+    if(transitionType == SlideWindow::transition_FromLeft) {
+        // A single rounding for both the slides: no seam between them
+        int xSplit = splitPosition(width, progress);
+        QRect sourcePresent(0, 0, width-xSplit, height);
+        QRect destinationPresent(sourcePresent);
+        destinationPresent.translate(xSplit, 0);
+        QRect sourceNext(width-xSplit, 0, xSplit, height);
+        QRect destinationNext(0, 0, xSplit, height);
+        QPainter painter(pDestination);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        painter.drawImage(destinationNext, next, sourceNext);
+        painter.drawImage(destinationPresent, present, sourcePresent);
+        painter.end();
+    }
+    else if(transitionType == SlideWindow::transition_Fade) {
+        // The next slide replaces whatever was in the destination,
+        // then the present one is blended over it
+        QPainter painter(pDestination);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        painter.drawImage(0, 0, next);
+        painter.setOpacity(1.0-qreal(progress));
+        painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+        painter.drawImage(0, 0, present);
+        painter.end();
+    }
+}
+
+
+/*!
+ * \brief TransitionRenderer::splitPosition
+ * \return The width of the entering slide already visible in a "From Left" wipe
+ */
+int
+TransitionRenderer::splitPosition(int width, double progress) {
+    return qBound(0, int(width*progress+0.5), width);
+}
@@ -0,0 +1,71 @@
+/*
+ *
+Copyright (C) 2016  Gabriele Salvato
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+#ifndef TRANSITIONRENDERER_H
+#define TRANSITIONRENDERER_H
+
+#include <QObject>
+#include <QImage>
+#include <QVector>
+#include <QAtomicInt>
+#include <QThreadPool>
+
+QT_FORWARD_DECLARE_CLASS(FramePool)
+
+
+class TransitionRenderer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TransitionRenderer(FramePool *pMyFramePool, QObject *parent = Q_NULLPTR);
+    ~TransitionRenderer();
+    void   setBudget(qint64 bytes);
+    bool   isEnabled();
+    void   render(const QImage &present, const QImage &next, int transitionType, int nFrames);
+    void   cancel();
+    bool   isReady(const QImage &present, const QImage &next, int transitionType);
+    QImage frame(double progress);
+
+    static void compose(int transitionType, const QImage &present, const QImage &next,
+                        double progress, QImage *pDestination);
+    static void composeWithPainter(int transitionType, const QImage &present, const QImage &next,
+                                   double progress, QImage *pDestination);
+
+private slots:
+    void onSequenceDone(int iGeneration);
+
+private:
+    void release();
+    static int splitPosition(int width, double progress);
+
+private:
+    QThreadPool     pool;
+    FramePool      *pFramePool;
+    QAtomicInt      abortRequest;
+    qint64          budget;
+    int             generation;
+    QVector<QImage> frameSequence;
+    int             nSequenceFrames;
+    qint64          presentKey;
+    qint64          nextKey;
+    int             sequenceType;
+    bool            bRendering;
+    bool            bReady;
+};
+
+#endif // TRANSITIONRENDERER_H
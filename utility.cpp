@@ -19,6 +19,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <QTextStream>
 #include <QDateTime>
 #include <QDebug>
+#include <QCryptographicHash>
 
 #include "utility.h"
 
@@ -84,3 +85,18 @@ logMessage(QFile *logFile, QString sFunctionName, QString sMessage) {
 }
 
 
+/*!
+ * \brief fileMd5 The digest listed for a file in the Server manifest
+ * \param sFileName The file path
+ * \return The MD5 of the file content (in hex) or QString() on error
+ */
+QString
+fileMd5(QString sFileName) {
+    QFile file(sFileName);
+    if(!file.open(QIODevice::ReadOnly))
+        return QString();
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    if(!hash.addData(&file))
+        return QString();
+    return QString(hash.result().toHex());
+}
@@ -46,4 +46,5 @@ enum commands {
 
 QString XML_Parse(QString input_string, QString token);
 void logMessage(QFile *logFile, QString sFunctionName, QString sMessage);
+QString fileMd5(QString sFileName);
 
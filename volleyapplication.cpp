@@ -4,20 +4,25 @@
 #include <QDir>
 #include <QStandardPaths>
 #include <QSettings>
+#include <QCommandLineParser>
 
 #include "volleyapplication.h"
 #include "serverdiscoverer.h"
 #include "messagewindow.h"
+#include "netlinkwatcher.h"
+#include "panelsimulator.h"
 
 
 #define NETWORK_CHECK_TIME    3000 // In msec
+#define NETWORK_SAFETY_TIME  30000 // In msec: the check when the changes are notified
 
 
 VolleyApplication::VolleyApplication(int &argc, char **argv)
     : QApplication(argc, argv)
     , logFile(nullptr)
-    , pServerDiscoverer(nullptr)
+    , pPanelSimulator(nullptr)
     , pNoNetWindow(nullptr)
+    , pNetlinkWatcher(nullptr)
 {
     pSettings = new QSettings("Gabriele Salvato", "Volley Panel");
     sLanguage = pSettings->value("language/current",  QString("Italiano")).toString();
@@ -54,16 +59,42 @@ VolleyApplication::VolleyApplication(int &argc, char **argv)
     pNoNetWindow->setDisplayedText(tr("In Attesa della Connessione con la Rete"));
     pNoNetWindow->showFullScreen();
 
+    // "--simulate N" runs N Panels (offscreen) to load test the Server
+    QCommandLineParser parser;
+    QCommandLineOption simulateOption(QString("simulate"),
+                                      QString("Simulate <instances> Panels."),
+                                      QString("instances"));
+    parser.addOption(simulateOption);
+    parser.parse(arguments());
+    int nInstances = parser.value(simulateOption).toInt();
+
     // Create a "PanelServer Discovery Service" but not start it
     // until we are sure that there is an active network connection
-    pServerDiscoverer = new ServerDiscoverer(logFile);
-    connect(pServerDiscoverer, SIGNAL(checkNetwork()),
-            this, SLOT(onRecheckNetwork()));
+    if(nInstances > 0) {
+        pPanelSimulator = new PanelSimulator(nInstances,
+                                             QString("%1volley_sim/").arg(sBaseDir),
+                                             logFile, this);
+        discovererList = pPanelSimulator->discoverers();
+    }
+    else {
+        discovererList.append(new ServerDiscoverer(logFile));
+    }
+    for(int i=0; i<discovererList.count(); i++) {
+        connect(discovererList.at(i), SIGNAL(checkNetwork()),
+                this, SLOT(onRecheckNetwork()));
+    }
+
+    // The kernel tells us when the network changes: the periodic
+    // check is needed only as a safety net (or where not available)
+    pNetlinkWatcher = new NetlinkWatcher(logFile, this);
+    connect(pNetlinkWatcher, SIGNAL(networkChanged()),
+            this, SLOT(onNetworkChanged()));
+    networkReadyTimer.setInterval(pNetlinkWatcher->isValid() ? NETWORK_SAFETY_TIME : NETWORK_CHECK_TIME);
 
     // When the network becomes available we will start the
     // "PanelServer Discovery Service".
     // Let's start the periodic check for the network
-    networkReadyTimer.start(NETWORK_CHECK_TIME);
+    networkReadyTimer.start();
 
     // And now it is time to check if the Network
     // is already up and working
@@ -76,14 +107,19 @@ VolleyApplication::onTimeToCheckNetwork() {
     networkReadyTimer.stop();
     if(isConnectedToNetwork()) {
         // Let's start the "Server Discovery Service"
-        if(!pServerDiscoverer->Discover()) {
+        bool bStarted = true;
+        for(int i=0; i<discovererList.count(); i++) {
+            if(!discovererList.at(i)->Discover())
+                bStarted = false;
+        }
+        if(!bStarted) {
             if(pNoNetWindow == Q_NULLPTR)
                 pNoNetWindow = new MessageWindow(Q_NULLPTR);
             // If the service is unable to start then probably
             // The network connection went down.
             pNoNetWindow->setDisplayedText(tr("Errore: Server Discovery Non Avviato"));
             // then restart checking...
-            networkReadyTimer.start(NETWORK_CHECK_TIME);
+            networkReadyTimer.start();
         }
         else {
             delete pNoNetWindow;
@@ -96,6 +132,8 @@ VolleyApplication::onTimeToCheckNetwork() {
         pNoNetWindow->setDisplayedText(tr("In Attesa della Connessione con la Rete"));
         // No other window should obscure this one
         pNoNetWindow->showFullScreen();
+        // Keep waiting for it
+        networkReadyTimer.start();
     }
 }
 
@@ -107,7 +145,22 @@ VolleyApplication::onRecheckNetwork() {
     pNoNetWindow->setDisplayedText(tr("In Attesa della Connessione con la Rete"));
     // No other window should obscure this one
     pNoNetWindow->showFullScreen();
-    networkReadyTimer.start(NETWORK_CHECK_TIME);
+    networkReadyTimer.start();
+}
+
+
+/*!
+ * \brief VolleyApplication::onNetworkChanged
+ * Invoked when a link or an address has changed
+ */
+void
+VolleyApplication::onNetworkChanged() {
+    if(networkReadyTimer.isActive())// Still waiting for the network
+        onTimeToCheckNetwork();
+    else {
+        for(int i=0; i<discovererList.count(); i++)
+            discovererList.at(i)->onNetworkChanged();
+    }
 }
 
 
@@ -3,11 +3,14 @@
 #include <QApplication>
 #include <QTranslator>
 #include <QTimer>
+#include <QList>
 
 
 QT_FORWARD_DECLARE_CLASS(QSettings)
 QT_FORWARD_DECLARE_CLASS(ServerDiscoverer)
 QT_FORWARD_DECLARE_CLASS(MessageWindow)
+QT_FORWARD_DECLARE_CLASS(NetlinkWatcher)
+QT_FORWARD_DECLARE_CLASS(PanelSimulator)
 QT_FORWARD_DECLARE_CLASS(QFile)
 
 
@@ -20,6 +23,7 @@ public:
 private slots:
     void onTimeToCheckNetwork();
     void onRecheckNetwork();
+    void onNetworkChanged();
 
 private:
     bool isConnectedToNetwork();
@@ -31,8 +35,10 @@ public:
 private:
     QSettings         *pSettings;
     QFile             *logFile;
-    ServerDiscoverer  *pServerDiscoverer;
+    QList<ServerDiscoverer*> discovererList;
+    PanelSimulator    *pPanelSimulator;
     MessageWindow     *pNoNetWindow;
+    NetlinkWatcher    *pNetlinkWatcher;
     QString            sLanguage;
     QString            logFileName;
     QTimer             networkReadyTimer;
@@ -11,8 +11,8 @@
 #include "timeoutwindow.h"
 #include "utility.h"
 
-VolleyPanel::VolleyPanel(const QString& myServerUrl, QFile *myLogFile, QWidget *parent)
-    : ScorePanel(myServerUrl, myLogFile, parent)
+VolleyPanel::VolleyPanel(const QString& myServerUrl, QFile *myLogFile, const QString &sMyBaseDir, QWidget *parent)
+    : ScorePanel(myServerUrl, myLogFile, sMyBaseDir, parent)
     , iServizio(0)
     , maxTeamNameLen(15)
     , pTimeoutWindow(Q_NULLPTR)
@@ -29,11 +29,6 @@ VolleyPanel::VolleyPanel(const QString& myServerUrl, QFile *myLogFile, QWidget *
     iTimeoutFontSize = panelSize.height()/8; // 2 Righe
     iSetFontSize     = panelSize.height()/8; // 2 Righe
 
-    connect(pPanelServerSocket, SIGNAL(textMessageReceived(QString)),
-            this, SLOT(onTextMessageReceived(QString)));
-    connect(pPanelServerSocket, SIGNAL(binaryMessageReceived(QByteArray)),
-            this, SLOT(onBinaryMessageReceived(QByteArray)));
-
     pSettings = new QSettings("Gabriele Salvato", "Segnapunti Volley");
 
     // QWidget propagates explicit palette roles from parent to child.
@@ -19,7 +19,7 @@ class VolleyPanel : public ScorePanel
     Q_OBJECT
 
 public:
-    VolleyPanel(const QString& myServerUrl, QFile *myLogFile, QWidget *parent = nullptr);
+    VolleyPanel(const QString& myServerUrl, QFile *myLogFile, const QString &sMyBaseDir = QString(), QWidget *parent = nullptr);
     ~VolleyPanel();
     void closeEvent(QCloseEvent *event);
     void changeEvent(QEvent *event);